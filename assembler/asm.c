@@ -0,0 +1,989 @@
+/*
+ * Assembler for uCPU, version 0.1, 2022-06-22.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Source line BNF syntax:
+ *
+ * <source-line>   ::= <opt-label> <mnem-or-dir> <operand> <opt-comment> | <opt-label> ";" <opt-comment> | <opt-label> | ""
+ * <opt-label>     ::= <$-prefixed-dec> | ""
+ * <mnem-or-dir>   ::= <mnemonic> | <directive>
+ * <mnemonic>      ::= "ANA" | "ANI" | "XRA" | "XRI" | "ADA" | "ADI" | "SBA" | "SBI" | "BNC" | "BNZ" | "JPR" | "JMP" | "LDA" | "LDI" | "STA" | "STX"
+ * <directive>     ::= "ORG"
+ * <operand>       ::= <two-hex> | <%-prefixed-two-hex> | "%IX" | "%IY" | <$-prefixed-dec> | <indir-modes>
+ * <indir-modes>   ::= "@IX" | "@IY" | "@IX+" | "@IY+" | "@-IX" | "@-IY"
+ * <opt-comment>   ::= <comment-text> | ""
+ *
+ * All tokens must be separated by white space. The syntax is case-insensitive.
+ * <$-prefixed-dec> is an "$" followed by a positive decimal number with up to 4 digits. $1, $01, $001, etc., are all the same. Even $+01!
+ * <two-hex> is a two digit hexadecimal number in the range 00 - FF, and <%-prefixed-two-hex> is the same prefixed by "%".
+ *
+ * The assembler works on a source held in memory and keeps all of its
+ * state in an asm_t, so that one process can assemble any number of
+ * sources, also from several threads (see ../server).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "asm.h"
+
+#define TOKEN(name, c0, c1, c2, code, type) {{c0, c1, c2, 0}, code, type},
+const token_t token[TOKENS] = {
+    /* instructions */
+    ISA_INSNS(TOKEN)
+    /* directives */
+    ISA_DIRECTIVES(TOKEN)
+};
+#undef TOKEN
+
+#define INDREG(name, text, code) {text, code},
+const indreg_t indreg[ISA_COUNT(ISA_REGS) + 1] = {
+    ISA_REGS(INDREG)
+    {NULL, INVALID}
+};
+#undef INDREG
+
+/* indices of token[] */
+#define T_ENUM(name, c0, c1, c2, code, type) T_##name,
+enum {ISA_INSNS(T_ENUM) ISA_DIRECTIVES(T_ENUM)};
+#undef T_ENUM
+
+#ifdef PROFILE
+
+#include <time.h>
+
+static const char *prof_name[P_NONE] = {"tokenize", "pass 1", "pass 2", "listing", "hex write"};
+static double prof_time[P_NONE], prof_last;
+static int prof_cur = P_NONE;
+unsigned long prof_lines, prof_passes, prof_allocs;
+
+static double prof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* charges the time since the last switch to the current phase */
+void prof_phase(int phase)
+{
+    double t = prof_now();
+
+    if (prof_cur != P_NONE)
+	prof_time[prof_cur] += t - prof_last;
+    prof_last = t;
+    prof_cur = phase;
+}
+
+void prof_report(void)
+{
+    double total = 0;
+    unsigned long src_lines = prof_passes ? prof_lines / prof_passes : 0;
+    int i;
+
+    prof_phase(P_NONE);
+
+    for (i = 0; i < P_NONE; ++i)
+	total += prof_time[i];
+
+    fprintf(stderr, "%lu source lines, %lu pass(es), %.3f s\n", src_lines, prof_passes, total);
+    for (i = 0; i < P_NONE; ++i)
+	fprintf(stderr, "  %-10s %8.3f s %8.1f ns/line\n", prof_name[i], prof_time[i],
+		src_lines ? prof_time[i] * 1e9 / src_lines : 0.0);
+    fprintf(stderr, "%.0f lines/s, %.2f allocations/line\n",
+	    total > 0 ? src_lines / total : 0.0, prof_lines ? (double) prof_allocs / prof_lines : 0.0);
+}
+
+#define strdup(s) (++prof_allocs, strdup(s))
+#define malloc(n) (++prof_allocs, malloc(n))
+
+#endif
+
+static void str_toupper(char *p) {
+    while (!*p) {
+	*p = toupper(*p);
+	++p;
+    }
+}
+
+static unsigned parse_label(char *p, int base, unsigned max_width, unsigned max_val)
+{
+    char *q;
+    unsigned lnum;
+
+    lnum = strtoul(p, &q, base);
+    if (lnum <= max_val && q - p <= max_width && !*q)
+	return lnum;
+    else
+	return INVALID;
+}
+
+/* index in token[] of the mnemonic or directive p starts with, INVALID if none */
+static unsigned mnemonic(const char *p)
+{
+    const unsigned char *u = (const unsigned char *) p;
+    unsigned t;
+
+#define CASE(name, c0, c1, c2, code, type) case ISA_HASH(c0, c1, c2): t = T_##name; break;
+    switch (ISA_HASH(u[0], u[1], u[2])) {
+	ISA_INSNS(CASE)
+	ISA_DIRECTIVES(CASE)
+	default:
+	    return INVALID;
+    }
+#undef CASE
+
+    return memcmp(p, token[t].name, 3) == 0 ? t : INVALID;
+}
+
+static lst_entry_t *lst_add(asm_t *a, unsigned line, unsigned kind)
+{
+    lst_entry_t *e;
+
+    if (a->lst_len == a->lst_size) {
+	a->lst_size = a->lst_size ? 2 * a->lst_size : 4096;
+	a->lst = realloc(a->lst, a->lst_size * sizeof(*a->lst));
+    }
+
+    e = &a->lst[a->lst_len++];
+    memset(e, 0, sizeof(*e));
+    e->line = line;
+    e->kind = kind;
+    e->text = e->token = NO_TEXT;
+    e->lnum = e->olnum = NO_LABEL;
+
+    return e;
+}
+
+static unsigned lst_add_text(asm_t *a, const char *s)
+{
+    unsigned n = strlen(s) + 1, offset = a->lst_text_len;
+
+    if (a->lst_text_len + n > a->lst_text_size) {
+	while (a->lst_text_len + n > a->lst_text_size)
+	    a->lst_text_size = a->lst_text_size ? 2 * a->lst_text_size : 65536;
+	a->lst_text = realloc(a->lst_text, a->lst_text_size);
+    }
+
+    memcpy(&a->lst_text[offset], s, n);
+    a->lst_text_len += n;
+
+    return offset;
+}
+
+/* message for a line of the final pass when there is no listing */
+static void line_message(const asm_t *a, unsigned line, const char *fmt, unsigned arg)
+{
+    if (a->msg_file == NULL)
+	return;
+    fprintf(a->msg_file, "%s:%u: ", a->src_name, line);
+    fprintf(a->msg_file, fmt, arg);
+}
+
+/* next line of the source into line_buf, split exactly as fgets() would */
+int asm_next_line(const char *src, size_t len, size_t *pos, char *line_buf)
+{
+    unsigned n = len - *pos < LINE_WIDTH - 1 ? len - *pos : LINE_WIDTH - 1;
+
+    if (*pos >= len)
+	return 0;
+
+    n = scan_newline(&src[*pos], n) + 1;
+    if (*pos + n > len || n == LINE_WIDTH)
+	--n;
+    memcpy(line_buf, &src[*pos], n);
+    line_buf[n] = 0;
+    *pos += n;
+
+    return 1;
+}
+
+void asm_init(asm_t *a, const char *src_name, int listing, FILE *msg_file)
+{
+    memset(a, 0, sizeof(*a));
+    a->src_name = src_name;
+    a->listing = listing;
+    a->msg_file = msg_file;
+    a->threads = 1;
+}
+
+/*
+ * Assembles one line at address pc in the current pass, returns the
+ * address of the next line. The listing entry and the messages are
+ * produced only if record is set.
+ */
+static unsigned char assemble_line(asm_t *a, const char *line_buf, unsigned line_cnt, unsigned char pc, line_info_t *li, int record)
+{
+    char src_line[LINE_WIDTH + SCAN_PAD], *p, *msg, *comment = NULL;
+    const char *name = NULL;
+    unsigned lnum = INVALID, olnum = INVALID, optype = INVALID, opcode = INVALID;
+    unsigned operand = 0, flags = 0, tok = 0, len, ntok, t;
+    enum {LABEL, MNEMONIC, OPERAND, COMMENT} parser_state = LABEL;
+    unsigned char tok_index[MAX_TOKENS];
+    lst_entry_t *e;
+    unsigned i;
+
+    li->pc = pc;
+
+    /* the parser never looks past the fourth token, the comment */
+    len = strlen(line_buf);
+    memcpy(src_line, line_buf, len + 1);
+    str_toupper(src_line);
+    ntok = scan_tokens(src_line, len, tok_index, MAX_TOKENS);
+    PROFILE_PHASE(P_PASS1 + a->second_pass);
+    for (t = 0; t < ntok; ++t) {
+	p = &src_line[tok_index[t]];
+	switch (parser_state) {
+	    case LABEL:
+		if (*p == '$') {
+		    /* label present */
+		    lnum = parse_label(p + 1, 10, 4, 9999);
+		    if (!a->second_pass && lnum == INVALID) {
+			msg = "incorrect label";
+			goto syntax_error;
+		    }
+		    if (a->second_pass && a->label[lnum] != pc) {
+			++a->warning;
+			flags |= F_REDEF;
+			if (record && !a->listing)
+			    line_message(a, line_cnt, "Warning: multiple definitions of label \"$%u\", the last definition wins.\n", lnum);
+		    }
+		    a->label[lnum] = pc;
+		    parser_state = MNEMONIC;
+		    continue;
+		}
+	    /* falling through if no label */
+	    case MNEMONIC:
+		if (*p == ';') {
+		    comment = p - src_line + (char *) line_buf;
+		    goto print_listing;
+		}
+		if ((i = mnemonic(p)) != INVALID) {
+		    name = token[i].name;
+		    opcode = token[i].code;
+		    optype = token[i].type;
+		    tok = i;
+		}
+		if (!a->second_pass && name == NULL) {
+		    msg = "unexpected token";
+		    goto syntax_error;
+		}
+		if (opcode < ORG)
+		    a->rom[pc] = opcode << 8;
+		parser_state = OPERAND;
+		continue;
+	    case OPERAND:
+		if (*p == '$') {
+		    if (!a->second_pass && optype != LAB && optype != IMM) {
+			msg = "incorrect operand";
+			goto syntax_error;
+		    }
+		    olnum = parse_label(p + 1, 10, 4, 9999);
+		    if (!a->second_pass && olnum == INVALID) {
+			msg = "incorrect label operand";
+			goto syntax_error;
+		    }
+		    if (a->label[olnum] == INVALID) {
+			if (a->second_pass) {
+			    ++a->other_error;
+			    flags |= F_UNDEF;
+			    if (record && !a->listing)
+				line_message(a, line_cnt, "Error: label \"$%u\" is not defined. Operand left uninitialized.\n", olnum);
+			}
+			goto set_operand;
+		    }
+		    operand = a->label[olnum];
+		} else {
+		    for (i = 0; indreg[i].name != NULL; ++i)
+			if (strcmp(p, indreg[i].name) == 0) {
+			    operand = indreg[i].code;
+			    break;
+			}
+		    if (operand != 0) {
+			if (!a->second_pass && optype != REG)
+			{
+			    msg = "not allowed indexed mode operand";
+			    goto syntax_error;
+			}
+			goto set_operand;
+		    }
+		    if (*p == '%') {
+			if (!a->second_pass && optype != REG) {
+			    msg = "not allowed or incorrect operand";
+			    goto syntax_error;
+			}
+			++p;
+		    } else
+			if (!a->second_pass && optype == REG) {
+			    msg = "reg operand reguired, possibly add \"%\" prefix to";
+			    goto syntax_error;
+			}
+		    operand = parse_label(p, 16, 2, 0xff);
+		    if (!a->second_pass && operand == INVALID) {
+			msg = (optype == REG && --p) ? "incorrect reg operand" : "incorrect operand";
+			goto syntax_error;
+		    }
+		    if (opcode == ORG)
+			pc = operand;
+		}
+set_operand:
+		if (opcode < ORG)
+		    a->rom[pc] |= operand;
+		parser_state = COMMENT;
+		continue;
+	    case COMMENT:
+		comment = p - src_line + (char *) line_buf;
+		goto print_listing;
+	}
+    }
+
+print_listing:
+
+    PROFILE_PHASE(P_LISTING);
+
+    if (record && a->listing) {
+	e = lst_add(a, line_cnt, L_LINE);
+	e->pc = pc;
+	e->word = a->rom[pc];
+	e->lnum = lnum != INVALID ? lnum : NO_LABEL;
+	e->olnum = olnum != INVALID ? olnum : NO_LABEL;
+	e->tok = tok;
+	e->operand = operand;
+	e->flags = flags;
+	if (parser_state >= OPERAND)
+	    e->flags |= F_INSTR;
+	if (parser_state >= OPERAND && opcode < ORG)
+	    e->flags |= F_CODE;
+	if (comment != NULL)
+	    e->text = lst_add_text(a, comment);
+    }
+
+    li->lnum = lnum != INVALID ? lnum : NO_LABEL;
+    li->kind = parser_state < OPERAND ? LI_NONE : opcode < ORG ? LI_CODE : LI_ORG;
+    li->org = opcode == ORG ? operand : 0;
+    li->flags = flags;
+
+    if (parser_state >= OPERAND && opcode < ORG)
+	a->rom_line[pc++] = line_cnt;
+
+    goto done;
+
+syntax_error:
+
+    PROFILE_PHASE(P_LISTING);
+
+    ++a->syntax_error;
+
+    if (record && a->listing) {
+	e = lst_add(a, line_cnt, L_SYNTAX);
+	e->msg = msg;
+	e->token = lst_add_text(a, p);
+	e->text = lst_add_text(a, line_buf);
+    } else if (record && a->msg_file != NULL) {
+	fprintf(a->msg_file, "%s:%u: Syntax error: %s \"%s\".\n", a->src_name, line_cnt, msg, p);
+    }
+
+    li->lnum = lnum != INVALID ? lnum : NO_LABEL;
+    li->kind = LI_SYNTAX;
+    li->org = li->flags = 0;
+
+done:
+
+    return pc;
+}
+
+static void reset(asm_t *a)
+{
+    int i;
+
+    for (i = 0; i < LABELS; ++i)
+	a->label[i] = INVALID;
+    memset(a->rom, 0, sizeof(a->rom));
+    a->second_pass = a->syntax_error = a->other_error = a->warning = 0;
+    a->lst_len = a->lst_text_len = 0;
+    a->lines = 0;
+}
+
+static line_info_t *line_add(asm_t *a)
+{
+    if (a->lines == a->line_size) {
+	a->line_size = a->line_size ? 2 * a->line_size : 4096;
+	a->line = realloc(a->line, a->line_size * sizeof(*a->line));
+    }
+
+    return &a->line[a->lines++];
+}
+
+static int assemble_serial(asm_t *a, const char *src, size_t len)
+{
+    char line_buf[LINE_WIDTH];
+    size_t src_pos;
+    unsigned line_cnt;
+    unsigned char pc;
+
+    reset(a);
+
+second_pass:
+
+    pc = 0;
+    line_cnt = 0;
+    src_pos = 0;
+    a->lst_len = a->lst_text_len = 0;
+    a->lines = 0;
+
+    PROFILE_COUNT(passes);
+    PROFILE_PHASE(P_TOKENIZE);
+
+    while (asm_next_line(src, len, &src_pos, line_buf)) {
+	pc = assemble_line(a, line_buf, line_cnt, pc, line_add(a), 1);
+	++line_cnt;
+
+	PROFILE_COUNT(lines);
+	PROFILE_PHASE(P_TOKENIZE);
+    }
+
+    /* do second pass */
+
+    if (!a->syntax_error && !a->second_pass) {
+	a->second_pass = 1;
+	goto second_pass;
+    }
+
+    PROFILE_PHASE(P_NONE);
+
+    return a->syntax_error;
+}
+
+#ifndef PROFILE		/* the phase timing is not thread safe */
+
+/*
+ * Parallel assembly. The source is split at line ends into one chunk per
+ * thread, and each chunk is assembled in two passes of its own:
+ *
+ * 1. Sizing: the first pass over the chunk from address 0. Every uCPU
+ *    instruction is one word, so up to its first "ORG" the addresses of
+ *    a chunk are relative to its entry address, after it absolute.
+ * 2. A prefix sum over the chunks gives their entry addresses, then the
+ *    labels of all chunks are merged into the label table in order.
+ * 3. Emission: the final pass over every chunk from its entry address
+ *    with the label table as the final pass would have it at the start
+ *    of the chunk (the last definitions, but those of a redefined label
+ *    made before the chunk), into the chunk's own ROM, listing and
+ *    messages, which are merged in the order of the chunks.
+ *
+ * The result is that of assemble_serial(). A source with syntax errors
+ * is assembled again serially, for the messages of the first pass.
+ */
+
+/* smaller sources are not worth the threads */
+#define PARALLEL_MIN (1 << 20)
+
+typedef struct {
+    asm_t c;			/* the chunk's state */
+    asm_t *a;
+    const char *src;
+    size_t len;
+    unsigned line0;		/* number of the first line */
+    unsigned first_org;		/* line of the first "ORG" in the chunk */
+    unsigned char entry, exit;	/* addresses at the start and the end */
+    char *msg;			/* messages of the final pass */
+    size_t msg_len;
+} chunk_t;
+
+static void *chunk_size(void *arg)
+{
+    chunk_t *k = arg;
+    asm_t *c = &k->c;
+    char line_buf[LINE_WIDTH];
+    size_t pos = 0;
+    unsigned char pc = 0;
+
+    k->first_org = INVALID;
+    while (asm_next_line(k->src, k->len, &pos, line_buf)) {
+	line_info_t *li = line_add(c);
+
+	pc = assemble_line(c, line_buf, c->lines - 1, pc, li, 0);
+	if (li->kind == LI_ORG && k->first_org == INVALID)
+	    k->first_org = c->lines - 1;
+    }
+    k->exit = pc;
+
+    return NULL;
+}
+
+static void *chunk_emit(void *arg)
+{
+    chunk_t *k = arg;
+    asm_t *c = &k->c;
+    char line_buf[LINE_WIDTH];
+    size_t pos = 0;
+    unsigned n = k->line0;
+    unsigned char pc = k->entry;
+    FILE *msg_file = NULL;
+
+    if (!c->listing && k->a->msg_file != NULL)
+	msg_file = open_memstream(&k->msg, &k->msg_len);
+    c->msg_file = msg_file;
+
+    while (asm_next_line(k->src, k->len, &pos, line_buf)) {
+	pc = assemble_line(c, line_buf, n, pc, &k->a->line[n], 1);
+	++n;
+    }
+
+    if (msg_file != NULL)
+	fclose(msg_file);
+
+    return NULL;
+}
+
+/* runs fn on every chunk, each on a thread of its own but the first */
+static void run_chunks(chunk_t *k, unsigned n, void *(*fn)(void *))
+{
+    pthread_t tid[n];
+    unsigned i;
+
+    for (i = 1; i < n; ++i)
+	if (pthread_create(&tid[i], NULL, fn, &k[i]) != 0)
+	    fn(&k[i]), tid[i] = 0;
+    fn(&k[0]);
+    for (i = 1; i < n; ++i)
+	if (tid[i])
+	    pthread_join(tid[i], NULL);
+}
+
+/* appends the listing of the chunk */
+static void lst_append(asm_t *a, const asm_t *c)
+{
+    unsigned i, base = a->lst_text_len;
+
+    if (c->lst_text_len > 0) {
+	while (a->lst_text_len + c->lst_text_len > a->lst_text_size)
+	    a->lst_text_size = a->lst_text_size ? 2 * a->lst_text_size : 65536;
+	a->lst_text = realloc(a->lst_text, a->lst_text_size);
+	memcpy(&a->lst_text[base], c->lst_text, c->lst_text_len);
+	a->lst_text_len += c->lst_text_len;
+    }
+
+    for (i = 0; i < c->lst_len; ++i) {
+	lst_entry_t *e = lst_add(a, 0, 0);
+
+	*e = c->lst[i];
+	if (e->text != NO_TEXT)
+	    e->text += base;
+	if (e->token != NO_TEXT)
+	    e->token += base;
+    }
+}
+
+/* returns -1 if the source has to be assembled serially */
+static int assemble_parallel(asm_t *a, const char *src, size_t len, unsigned threads)
+{
+    chunk_t *k = calloc(threads, sizeof(*k));
+    size_t start = 0, end;
+    unsigned n, i, j, lines = 0;
+    unsigned char pc = 0;
+    int rc = -1;
+
+    if (k == NULL)
+	return -1;
+
+    /* chunks of about the same size, starting after a line end */
+    for (n = 0; n < threads && start < len; ++n) {
+	end = n == threads - 1 ? len : len / threads * (n + 1);
+	if (end < start)
+	    end = start;
+	while (end < len && src[end - 1] != '\n')
+	    ++end;
+	k[n].a = a;
+	k[n].src = &src[start];
+	k[n].len = end - start;
+	asm_init(&k[n].c, a->src_name, a->listing, NULL);
+	start = end;
+    }
+
+    run_chunks(k, n, chunk_size);
+
+    reset(a);
+
+    for (i = 0; i < n; ++i) {
+	asm_t *c = &k[i].c;
+
+	if (c->syntax_error)
+	    goto out;
+
+	/* the prefix sum of the addresses and the labels */
+	k[i].entry = pc;
+	k[i].line0 = lines;
+	for (j = 0; j < c->lines; ++j) {
+	    const line_info_t *li = &c->line[j];
+	    unsigned char addr = j <= k[i].first_org ? pc + li->pc : li->pc;
+
+	    if (li->lnum != NO_LABEL)
+		a->label[li->lnum] = addr;
+	}
+	pc = k[i].first_org != INVALID ? k[i].exit : pc + k[i].exit;
+	lines += c->lines;
+    }
+
+    /* the labels as the final pass finds them at the start of every chunk */
+    for (i = 0; i < n; ++i) {
+	asm_t *c = &k[i].c;
+
+	memcpy(c->label, i == 0 ? a->label : k[i - 1].c.label, sizeof(a->label));
+	if (i > 0)
+	    for (j = 0; j < k[i - 1].c.lines; ++j) {
+		const line_info_t *li = &k[i - 1].c.line[j];
+
+		if (li->lnum != NO_LABEL)
+		    c->label[li->lnum] = j <= k[i - 1].first_org ? (unsigned char) (k[i - 1].entry + li->pc) : li->pc;
+	    }
+    }
+
+    while (a->line_size < lines) {
+	a->line_size = a->line_size ? 2 * a->line_size : 4096;
+	a->line = realloc(a->line, a->line_size * sizeof(*a->line));
+    }
+
+    for (i = 0; i < n; ++i) {
+	asm_t *c = &k[i].c;
+
+	memset(c->rom_line, 0xff, sizeof(c->rom_line));
+	c->second_pass = 1;
+	c->lst_len = c->lst_text_len = 0;
+    }
+
+    run_chunks(k, n, chunk_emit);
+
+    a->second_pass = 1;
+    a->lines = lines;
+
+    for (i = 0; i < n; ++i) {
+	asm_t *c = &k[i].c;
+
+	for (j = 0; j < ROM_WORDS; ++j)
+	    if (c->rom_line[j] != INVALID) {
+		a->rom[j] = c->rom[j];
+		a->rom_line[j] = c->rom_line[j];
+	    }
+	a->other_error += c->other_error;
+	a->warning += c->warning;
+	if (k[i].msg != NULL)
+	    fwrite(k[i].msg, 1, k[i].msg_len, a->msg_file);
+	if (a->listing)
+	    lst_append(a, c);
+    }
+
+    rc = 0;
+
+out:
+    for (i = 0; i < n; ++i) {
+	asm_free(&k[i].c);
+	free(k[i].msg);
+    }
+    free(k);
+
+    return rc;
+}
+
+#endif /* PROFILE */
+
+/* assembles the source, returns the number of syntax errors */
+int asm_source(asm_t *a, const char *src, size_t len)
+{
+#ifndef PROFILE
+    if (a->threads > 1 && len >= PARALLEL_MIN && assemble_parallel(a, src, len, a->threads) == 0)
+	return 0;
+#endif
+
+    return assemble_serial(a, src, len);
+}
+
+/*
+ * Reassembles the line n of the source last assembled without errors,
+ * text is its new content as returned by asm_next_line(). This is
+ * possible only if the line defines the same label and moves the address
+ * as before, so that no other line changes: then the ROM word, the
+ * listing entry and the counts are updated and 0 is returned. Otherwise
+ * -1 is returned, and the whole source must be assembled again with
+ * asm_source(). A source with redefined labels is always assembled
+ * again, their value depends on the line within the final pass, and so
+ * is a line whose word is overwritten by a later line at the same address.
+ */
+int asm_patch(asm_t *a, unsigned n, const char *text)
+{
+    line_info_t li, *old;
+    unsigned saved = 0, word, word_line, lst_len = a->lst_len;
+    int errors = a->syntax_error;
+
+    if (!a->second_pass || a->warning || n >= a->lines || strlen(text) >= LINE_WIDTH)
+	return -1;
+    old = &a->line[n];
+    if (old->kind == LI_CODE && a->rom_line[old->pc] != n)
+	return -1;
+
+    /* syntax check with the first pass, which must not move the label */
+    if (old->lnum != NO_LABEL)
+	saved = a->label[old->lnum];
+    word = a->rom[old->pc];
+    word_line = a->rom_line[old->pc];
+    a->second_pass = 0;
+    assemble_line(a, text, n, old->pc, &li, 0);
+    a->second_pass = 1;
+    if (old->lnum != NO_LABEL)
+	a->label[old->lnum] = saved;
+    a->rom[old->pc] = word;
+    a->rom_line[old->pc] = word_line;
+
+    if (a->syntax_error != errors || li.lnum != old->lnum || li.kind != old->kind ||
+	(li.kind == LI_ORG && li.org != old->org)) {
+	a->syntax_error = errors;
+	return -1;
+    }
+
+    if (old->flags & F_UNDEF)
+	--a->other_error;
+
+    /* the final pass has exactly one listing entry per line */
+    a->lst_len = n;
+    assemble_line(a, text, n, old->pc, old, 1);
+    a->lst_len = lst_len;
+
+    return 0;
+}
+
+/* buffered output of the listing file */
+
+typedef struct {
+    FILE *file;
+    unsigned len;
+    char buf[65536];
+} out_t;
+
+static void out_flush(out_t *o)
+{
+    fwrite(o->buf, 1, o->len, o->file);
+    o->len = 0;
+}
+
+static void out(out_t *o, const char *s, unsigned n)
+{
+    while (n > 0) {
+	unsigned k = sizeof(o->buf) - o->len;
+
+	if (k > n)
+	    k = n;
+	memcpy(&o->buf[o->len], s, k);
+	o->len += k;
+	s += k;
+	n -= k;
+	if (o->len == sizeof(o->buf))
+	    out_flush(o);
+    }
+}
+
+static void out_str(out_t *o, const char *s)
+{
+    out(o, s, strlen(s));
+}
+
+/* formats an unsigned decimal right aligned in width, like "%*u" */
+static int fmt_dec(char *p, unsigned v, int width)
+{
+    char tmp[16];
+    int n = 0, i = 0;
+
+    do
+	tmp[n++] = '0' + v % 10;
+    while ((v /= 10) != 0);
+
+    for (; i < width - n; ++i)
+	p[i] = ' ';
+    while (n > 0)
+	p[i++] = tmp[--n];
+
+    return i;
+}
+
+/* formats digits upper case hex digits, like "%0*X" */
+static int fmt_hex(char *p, unsigned v, int digits)
+{
+    int i;
+
+    for (i = digits - 1; i >= 0; --i, v >>= 4)
+	p[i] = "0123456789ABCDEF"[v & 0xf];
+
+    return digits;
+}
+
+static void out_dec(out_t *o, unsigned v, int width)
+{
+    char tmp[16];
+
+    out(o, tmp, fmt_dec(tmp, v, width));
+}
+
+/* the line goes to the listing column by column, later fields overwrite */
+static int put_field(char *buf, int end, int pos, const char *s, int n)
+{
+    memcpy(&buf[pos], s, n);
+    return pos + n > end ? pos + n : end;
+}
+
+static void write_entry(out_t *o, const asm_t *a, const lst_entry_t *e)
+{
+    char buf[LST_LINE_WIDTH + 64], tmp[16];
+    int n, end;
+
+    if (e->flags & F_REDEF) {
+	out_str(o, "Warning: multiple definitions of label \"$");
+	out_dec(o, e->lnum, 0);
+	out_str(o, "\", the last definition wins.\n");
+    }
+
+    if (e->flags & F_UNDEF) {
+	out_str(o, "Error: label \"$");
+	out_dec(o, e->olnum, 0);
+	out_str(o, "\" is not defined. Operand left uninitialized.\n");
+    }
+
+    if (e->kind == L_SYNTAX) {
+	out_str(o, "Syntax error: ");
+	out_str(o, e->msg);
+	out_str(o, " \"");
+	out_str(o, &a->lst_text[e->token]);
+	out_str(o, "\". The following source line is ignored.\n");
+	out_dec(o, e->line, 4);
+	out_str(o, ":\t\t\t");
+	out_str(o, &a->lst_text[e->text]);
+	return;
+    }
+
+    memset(buf, ' ', 48);
+
+    n = fmt_dec(tmp, e->line, 4);
+    memcpy(&tmp[n], ":   ", 4);
+    n += 4;
+    n += fmt_hex(&tmp[n], e->pc, 2);
+    end = put_field(buf, 0, 0, tmp, n);
+
+    if (e->flags & F_CODE)
+	end = put_field(buf, end, 12, tmp, fmt_hex(tmp, e->word, 3));
+
+    if (e->lnum != NO_LABEL) {
+	tmp[0] = '$';
+	end = put_field(buf, end, 24, tmp, 1 + fmt_dec(&tmp[1], e->lnum, 0));
+    }
+
+    if (e->flags & F_INSTR) {
+	end = put_field(buf, end, 32, token[e->tok].name, strlen(token[e->tok].name));
+	if (e->olnum != NO_LABEL) {
+	    tmp[0] = '$';
+	    n = 1 + fmt_dec(&tmp[1], e->olnum, 0);
+	} else {
+	    tmp[0] = token[e->tok].type == REG ? '%' : ' ';
+	    n = 1 + fmt_hex(&tmp[1], e->operand, 2);
+	}
+	end = put_field(buf, end, 40, tmp, n);
+    }
+
+    if (e->text != NO_TEXT)
+	end = put_field(buf, end, 48, &a->lst_text[e->text], strlen(&a->lst_text[e->text]));
+
+    if (buf[end - 1] != '\n')
+	buf[end++] = '\n';
+
+    out(o, buf, end);
+}
+
+/* writes the listing recorded by the last asm_source() */
+int asm_write_listing(const asm_t *a, FILE *f)
+{
+    out_t *o = malloc(sizeof(*o));
+    unsigned i;
+
+    if (o == NULL)
+	return -1;
+    o->file = f;
+    o->len = 0;
+
+    PROFILE_PHASE(P_LISTING);
+
+    out_str(o, " ---- Source file: ");
+    out_str(o, a->src_name);
+    out_str(o, a->second_pass ? ". Second pass assembler listing. ----\n\n" : ". First pass assembler listing. ----\n\n");
+
+    for (i = 0; i < a->lst_len; ++i)
+	write_entry(o, a, &a->lst[i]);
+
+    out_flush(o);
+    free(o);
+
+    PROFILE_PHASE(P_NONE);
+
+    return ferror(f) ? -1 : 0;
+}
+
+int asm_write_hex(const asm_t *a, FILE *f)
+{
+    int i, j;
+
+    PROFILE_PHASE(P_HEX);
+
+    for (i = 0; i < 16; ++i) {
+	for (j = 0; j < 16; ++j)
+	    fprintf(f, "%4.03X", a->rom[(i<<4)+j]);
+	fputc('\n', f);
+    }
+
+    PROFILE_PHASE(P_NONE);
+
+    return ferror(f) ? -1 : 0;
+}
+
+void asm_free(asm_t *a)
+{
+    free(a->lst);
+    free(a->lst_text);
+    free(a->line);
+    a->lst = NULL;
+    a->lst_text = NULL;
+    a->line = NULL;
+    a->lst_len = a->lst_size = a->lst_text_len = a->lst_text_size = 0;
+    a->lines = a->line_size = 0;
+}
+
+/* reads the whole file into a malloc()ed buffer */
+int read_file(const char *name, char **buf, size_t *len)
+{
+    FILE *f;
+    size_t size = 65536, n = 0, k;
+    struct stat st;
+    char *p;
+
+    if ((f = fopen(name, "r")) == NULL)
+	return -1;
+
+    /* one read for a regular file, the loop is for pipes */
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode))
+	size = st.st_size + 1;
+
+    p = malloc(size);
+    while (p != NULL && (k = fread(&p[n], 1, size - n, f)) > 0)
+	if ((n += k) == size)
+	    p = realloc(p, size *= 2);
+
+    fclose(f);
+
+    if (p == NULL)
+	return -1;
+
+    *buf = p;
+    *len = n;
+
+    return 0;
+}
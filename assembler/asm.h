@@ -0,0 +1,153 @@
+/*
+ * Assembler for uCPU, reentrant core.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#ifndef ASM_H
+#define ASM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "isa.h"
+
+/* size of input line buffer */
+#define LINE_WIDTH 256
+
+/* buffer size for the listing file line */
+#define LST_LINE_WIDTH (LINE_WIDTH+64)
+
+#define INVALID ((unsigned)-1)
+
+#define LABELS 10000
+#define ROM_WORDS 256
+
+typedef enum {REG, IMM, LAB, IND} operand_t;
+
+/* the mnemonics and directives, see ../sim/isa.h */
+typedef struct {
+    char name[4];
+    unsigned code;
+    operand_t type;
+} token_t;
+
+#define DIRECTIVE(name, c0, c1, c2, code, type) name = code,
+enum {ISA_DIRECTIVES(DIRECTIVE)};
+#undef DIRECTIVE
+
+#define TOKENS (ISA_COUNT(ISA_INSNS) + ISA_COUNT(ISA_DIRECTIVES))
+
+extern const token_t token[TOKENS];
+
+typedef struct {
+    char *name;
+    unsigned code;
+} indreg_t;
+
+extern const indreg_t indreg[ISA_COUNT(ISA_REGS) + 1];
+
+/*
+ * Listing. The final pass records one entry per source line, the listing
+ * file is written from these entries after assembly, if it was requested.
+ */
+
+/* entry kinds */
+#define L_LINE   0	/* assembled line */
+#define L_SYNTAX 1	/* line ignored due to a syntax error */
+
+/* entry flags */
+#define F_CODE   0x01	/* line emitted a ROM word */
+#define F_INSTR  0x02	/* mnemonic or directive present */
+#define F_REDEF  0x04	/* label redefined */
+#define F_UNDEF  0x08	/* operand label not defined */
+
+#define NO_LABEL 0xffff
+#define NO_TEXT  ((unsigned)-1)
+
+typedef struct {
+    unsigned line;		/* source line number */
+    unsigned text;		/* comment (L_LINE) or source line (L_SYNTAX) */
+    unsigned token;		/* offending token (L_SYNTAX) */
+    const char *msg;		/* syntax error message (L_SYNTAX) */
+    unsigned short word, lnum, olnum;
+    unsigned char kind, flags, pc, tok, operand;
+} lst_entry_t;
+
+/* what a line of the source does to the addresses */
+typedef struct {
+    unsigned short lnum;	/* label defined on the line or NO_LABEL */
+    unsigned char pc;		/* address at the start of the line */
+    unsigned char kind;		/* LI_* */
+    unsigned char org;		/* "ORG" operand */
+    unsigned char flags;	/* F_REDEF, F_UNDEF of the final pass */
+} line_info_t;
+
+#define LI_NONE   0		/* no code */
+#define LI_CODE   1		/* emits a ROM word */
+#define LI_ORG    2		/* sets the address */
+#define LI_SYNTAX 3		/* syntax error */
+
+/* assembler state, one per thread, reusable for any number of sources */
+typedef struct {
+    const char *src_name;
+    int listing;		/* record the listing entries */
+    FILE *msg_file;		/* messages if there is no listing, may be NULL */
+    unsigned threads;		/* for large sources, see asm.c */
+
+    unsigned label[LABELS];
+    unsigned rom[ROM_WORDS];
+    unsigned rom_line[ROM_WORDS];	/* line that wrote the word last */
+    unsigned lines;
+    line_info_t *line;
+    unsigned line_size;
+    int second_pass, syntax_error, other_error, warning;
+
+    lst_entry_t *lst;
+    unsigned lst_len, lst_size;
+    char *lst_text;
+    unsigned lst_text_len, lst_text_size;
+} asm_t;
+
+void asm_init(asm_t *a, const char *src_name, int listing, FILE *msg_file);
+int asm_source(asm_t *a, const char *src, size_t len);
+int asm_patch(asm_t *a, unsigned n, const char *text);
+int asm_next_line(const char *src, size_t len, size_t *pos, char *line_buf);
+int asm_write_listing(const asm_t *a, FILE *f);
+int asm_write_hex(const asm_t *a, FILE *f);
+void asm_free(asm_t *a);
+
+int read_file(const char *name, char **buf, size_t *len);
+
+/* scan.c, the line buffers need SCAN_PAD bytes more for the vector loads */
+#define SCAN_PAD 32
+#define MAX_TOKENS 4
+
+unsigned scan_newline(const char *s, unsigned n);
+unsigned scan_tokens(char *line, unsigned len, unsigned char *tok, unsigned max);
+
+#ifdef PROFILE
+
+/*
+ * Profiling build (make ucasm-prof): accumulates the wall time of every
+ * assembler phase and counts heap allocations, the report is printed to
+ * stderr at exit.
+ */
+
+enum {P_TOKENIZE, P_PASS1, P_PASS2, P_LISTING, P_HEX, P_NONE};
+
+extern unsigned long prof_lines, prof_passes, prof_allocs;
+
+void prof_phase(int phase);
+void prof_report(void);
+
+#define PROFILE_PHASE(phase) prof_phase(phase)
+#define PROFILE_COUNT(counter) (++prof_##counter)
+
+#else
+
+#define PROFILE_PHASE(phase) ((void) 0)
+#define PROFILE_COUNT(counter) ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * Source scanning for the uCPU assembler.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Finds the line ends in the source and the tokens of a line 16 (SSE2)
+ * or 32 (AVX2) bytes at a time. A line is at most LINE_WIDTH - 1 bytes,
+ * so its token characters make a bit mask of LINE_WIDTH bits, from which
+ * the token boundaries are taken with count trailing zeros instead of
+ * testing every byte against the delimiters as strtok() does. AVX2 is
+ * chosen at run time if the CPU has it. Elsewhere, or built with
+ * -DSCAN_SCALAR, the lines are split by strtok_r() and their ends found
+ * by memchr(): a bit mask made a byte at a time is slower than both.
+ *
+ * The '$', '%', '@' and ';' prefixes are not classified here, the parser
+ * tests the first byte of a token for them.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "asm.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && !defined(SCAN_SCALAR)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define MASK_WORDS (LINE_WIDTH / 64)
+
+static unsigned newline_scalar(const char *s, unsigned n)
+{
+    const char *p = memchr(s, '\n', n);
+
+    return p != NULL ? p - s : n;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Sets the bits of the token characters (not " \t\n") of line[0..len).
+ * The line buffer has LINE_WIDTH + SCAN_PAD bytes, the loads past len
+ * are masked out.
+ */
+static void token_mask_sse2(const char *line, unsigned len, uint64_t *mask)
+{
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), nl = _mm_set1_epi8('\n');
+    unsigned i;
+
+    memset(mask, 0, MASK_WORDS * sizeof(*mask));
+    for (i = 0; i < len; i += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *) &line[i]);
+	__m128i d = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)), _mm_cmpeq_epi8(v, nl));
+
+	mask[i >> 6] |= (uint64_t) (~_mm_movemask_epi8(d) & 0xffff) << (i & 63);
+    }
+    if (len < LINE_WIDTH)
+	mask[len >> 6] &= ((uint64_t) 1 << (len & 63)) - 1;
+    for (i = (len >> 6) + 1; i < MASK_WORDS; ++i)
+	mask[i] = 0;
+}
+
+__attribute__((target("avx2")))
+static void token_mask_avx2(const char *line, unsigned len, uint64_t *mask)
+{
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), nl = _mm256_set1_epi8('\n');
+    unsigned i;
+
+    memset(mask, 0, MASK_WORDS * sizeof(*mask));
+    for (i = 0; i < len; i += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) &line[i]);
+	__m256i d = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)), _mm256_cmpeq_epi8(v, nl));
+
+	mask[i >> 6] |= (uint64_t) (uint32_t) ~_mm256_movemask_epi8(d) << (i & 63);
+    }
+    if (len < LINE_WIDTH)
+	mask[len >> 6] &= ((uint64_t) 1 << (len & 63)) - 1;
+    for (i = (len >> 6) + 1; i < MASK_WORDS; ++i)
+	mask[i] = 0;
+}
+
+static unsigned newline_sse2(const char *s, unsigned n)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    unsigned i, m;
+
+    for (i = 0; i + 16 <= n; i += 16)
+	if ((m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) &s[i]), nl))) != 0)
+	    return i + __builtin_ctz(m);
+
+    return i + newline_scalar(&s[i], n - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned newline_avx2(const char *s, unsigned n)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    unsigned i, m;
+
+    for (i = 0; i + 32 <= n; i += 32)
+	if ((m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) &s[i]), nl))) != 0)
+	    return i + __builtin_ctz(m);
+
+    return i + newline_sse2(&s[i], n - i);
+}
+
+static void (*token_mask)(const char *, unsigned, uint64_t *);
+static unsigned (*newline)(const char *, unsigned);
+
+/* picks the widest implementation the CPU has, before main() */
+__attribute__((constructor))
+static void scan_init(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	token_mask = token_mask_avx2;
+	newline = newline_avx2;
+    } else {
+	token_mask = token_mask_sse2;
+	newline = newline_sse2;
+    }
+}
+
+/* offset of the first '\n' in s[0..n), n if there is none */
+unsigned scan_newline(const char *s, unsigned n)
+{
+    return newline(s, n);
+}
+
+/* position of the first bit equal to want at or after pos, LINE_WIDTH if none */
+static unsigned next_bit(const uint64_t *mask, unsigned pos, int want)
+{
+    unsigned i = pos >> 6;
+    uint64_t m;
+
+    if (pos >= LINE_WIDTH)
+	return LINE_WIDTH;
+
+    m = (want ? mask[i] : ~mask[i]) & ~(((uint64_t) 1 << (pos & 63)) - 1);
+    while (m == 0) {
+	if (++i == MASK_WORDS)
+	    return LINE_WIDTH;
+	m = want ? mask[i] : ~mask[i];
+    }
+
+    return (i << 6) + __builtin_ctzll(m);
+}
+
+/*
+ * Splits the line (LINE_WIDTH + SCAN_PAD bytes of buffer, zero terminated at len)
+ * into tokens as strtok() with " \t\n" would: each of the first max
+ * tokens is zero terminated in place and its offset stored in tok[].
+ * Returns the number of tokens found.
+ */
+unsigned scan_tokens(char *line, unsigned len, unsigned char *tok, unsigned max)
+{
+    uint64_t mask[MASK_WORDS];
+    unsigned n = 0, pos = 0, end;
+
+    token_mask(line, len, mask);
+
+    while (n < max && (pos = next_bit(mask, pos, 1)) < len) {
+	end = next_bit(mask, pos, 0);
+	if (end > len)
+	    end = len;
+	tok[n++] = pos;
+	line[end] = 0;
+	pos = end + 1;
+    }
+
+    return n;
+}
+
+#else
+
+unsigned scan_newline(const char *s, unsigned n)
+{
+    return newline_scalar(s, n);
+}
+
+unsigned scan_tokens(char *line, unsigned len, unsigned char *tok, unsigned max)
+{
+    unsigned n = 0;
+    char *p, *save;
+
+    for (p = strtok_r(line, " \t\n", &save); p != NULL && n < max; ) {
+	tok[n++] = p - line;
+	if (n < max)
+	    p = strtok_r(NULL, " \t\n", &save);
+    }
+
+    return n;
+}
+
+#endif
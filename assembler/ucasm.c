@@ -2,355 +2,281 @@
  * Assembler for uCPU, version 0.1, 2022-06-22.
  * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
  *
- * Source line BNF syntax:
+ * Command line front end, the source syntax is described in asm.c.
  *
- * <source-line>   ::= <opt-label> <mnem-or-dir> <operand> <opt-comment> | <opt-label> ";" <opt-comment> | <opt-label> | ""
- * <opt-label>     ::= <$-prefixed-dec> | ""
- * <mnem-or-dir>   ::= <mnemonic> | <directive>
- * <mnemonic>      ::= "ANA" | "ANI" | "XRA" | "XRI" | "ADA" | "ADI" | "SBA" | "SBI" | "BNC" | "BNZ" | "JPR" | "JMP" | "LDA" | "LDI" | "STA" | "STX"
- * <directive>     ::= "ORG"
- * <operand>       ::= <two-hex> | <%-prefixed-two-hex> | "%IX" | "%IY" | <$-prefixed-dec> | <indir-modes>
- * <indir-modes>   ::= "@IX" | "@IY" | "@IX+" | "@IY+" | "@-IX" | "@-IY"
- * <opt-comment>   ::= <comment-text> | ""
+ * With -w (--watch) the source is assembled again whenever it is written.
+ * If the changed lines neither define other labels nor move addresses,
+ * only they are reassembled (asm_patch()), otherwise the whole source.
+ * With -s and -n every new ROM is loaded into the named simulator session
+ * of ucserver, which keeps running with its state and RAM.
  *
- * All tokens must be separated by white space. The syntax is case-insensitive.
- * <$-prefixed-dec> is an "$" followed by a positive decimal number with up to 4 digits. $1, $01, $001, etc., are all the same. Even $+01!
- * <two-hex> is a two digit hexadecimal number in the range 00 - FF, and <%-prefixed-two-hex> is the same prefixed by "%".
+ * Sources of a megabyte and more are assembled by as many threads as
+ * there are CPUs, or -j of them.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdarg.h>
 #include <string.h>
-#include <ctype.h>
-
-/* size of input line buffer */
-#define LINE_WIDTH 256
-
-/* buffer size for the listing file line */
-#define LST_LINE_WIDTH (LINE_WIDTH+64)
-
-#define INVALID ((unsigned)-1)
-
-typedef enum {REG, IMM, LAB, IND} operand_t;
-
-typedef struct {
-    char *name;
-    unsigned code;
-    operand_t type;
-} token_t;
-
-const token_t token[18] = {
-    /* instructions */
-    {"ANA", 0x0, REG},
-    {"ANI", 0x1, IMM},
-    {"XRA", 0x2, REG},
-    {"XRI", 0x3, IMM},
-    {"ADA", 0x4, REG},
-    {"ADI", 0x5, IMM},
-    {"SBA", 0x6, REG},
-    {"SBI", 0x7, IMM},
-    {"BNC", 0x8, LAB},
-    {"BNZ", 0x9, LAB},
-    {"JPR", 0xA, REG},
-    {"JMP", 0xB, LAB},
-    {"LDA", 0xC, REG},
-    {"LDI", 0xD, IMM},
-    {"STA", 0xE, REG},
-    {"STX", 0xF, REG},
-#define ORG 0x10
-    /* directives */
-    {"ORG", ORG, IMM},
-    {NULL,  INVALID, INVALID}
-};
-
-typedef struct {
-    char *name;
-    unsigned code;
-} indreg_t;
-
-const indreg_t indreg[9] = {
-    {"%IX",  0xf8},
-    {"%IY",  0xf9},
-    {"@IX",  0xfa},
-    {"@IY",  0xfb},
-    {"@IX+", 0xfc},
-    {"@IY+", 0xfd},
-    {"@-IX", 0xfe},
-    {"@-IY", 0xff},
-    {NULL, INVALID}
-};
-
-void str_toupper(char *p) {
-    while (!*p) {
-	*p = toupper(*p);
-	++p;
-    }
-}
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/inotify.h>
 
-unsigned parse_label(char *p, int base, unsigned max_width, unsigned max_val)
-{
-    char *q;
-    unsigned lnum;
+#include "asm.h"
+#include "ucproto.h"
 
-    lnum = strtoul(p, &q, base);
-    if (lnum <= max_val && q - p <= max_width && !*q)
-	return lnum;
-    else
-	return INVALID;
+void usage(const char *prog)
+{
+    printf("Usage: %s [-j <threads>] [-l <listing>] <source> <hexdump>\n", prog);
+    printf("       %s <source> <listing> <hexdump>\n", prog);
+    printf("       %s -w [-l <listing>] [-s <socket> -n <session>] <source> <hexdump>\n", prog);
 }
 
-int putatpos(char *strbuf, int pos, ...)
+/* the assembler state is large, keep it off the stack */
+static asm_t a;
+
+/* writes the listing and the hex file, returns the exit code */
+static int output(const char *lst_name, const char *hex_name)
 {
-    static char *buf;
-    static int end;
-    char *fmt;
-    va_list ap;
+    FILE *lst_file, *hex_file;
+
+    if (lst_name != NULL) {
+	if ((lst_file = fopen(lst_name, "w")) == NULL || asm_write_listing(&a, lst_file) != 0 || fclose(lst_file) != 0) {
+	    perror(lst_name);
+	    return 1;
+	}
+    }
 
-    va_start(ap, pos);
+    if (a.syntax_error > 0) {
+	fprintf(stderr, "There were %d syntax error(s), hex file was not generated.%s\n", a.syntax_error,
+		lst_name != NULL ? " Check listing file." : "");
+	return 1;
+    }
 
-    if (strbuf != NULL) {
-	buf = strbuf;
-	end = pos;
-    } else {
-	if (pos > end)
-	    buf[end] = ' ';
-	fmt = va_arg(ap, char *);
-	pos += vsprintf(&buf[pos], fmt, ap);
-	if (pos < end)
-	    buf[pos] = ' ';
-	else
-	    end = pos;
+    if (a.other_error > 0 || a.warning > 0) {
+	fprintf(stderr, "There were %d warning(s) and %d error(s).%s\n", a.warning, a.other_error,
+		lst_name != NULL ? " Check listing file." : "");
     }
 
-    va_end(ap);
+    if ((hex_file = fopen(hex_name, "w")) == NULL || asm_write_hex(&a, hex_file) != 0 || fclose(hex_file) != 0) {
+	perror(hex_name);
+	return 1;
+    }
 
-    return pos;
+    return 0;
 }
 
-int main(int argc, char *argv[])
+/*
+ * Assembles the new source, only the changed lines if possible. Returns
+ * the number of lines reassembled, -1 if the whole source was.
+ */
+static int reassemble(const char *old, size_t old_len, const char *src, size_t len)
 {
-    FILE *src_file, *lst_file, *hex_file;
-    char line_buf[LINE_WIDTH];
-    unsigned label[10000];
-    unsigned rom[256];
-    unsigned line_cnt;
-    unsigned char pc;
-    int i, j, second_pass = 0, syntax_error = 0, other_error = 0, warning = 0;
-
-    if (argc != 4) {
-	printf("Usage: %s <source> <listing> <hexdump>\n", argv[0]);
-	return -1;
+    char old_buf[LINE_WIDTH], line_buf[LINE_WIDTH];
+    size_t old_pos = 0, pos = 0;
+    unsigned n;
+    int patched = 0, more_old, more;
+
+    for (n = 0; ; ++n) {
+	more_old = asm_next_line(old, old_len, &old_pos, old_buf);
+	more = asm_next_line(src, len, &pos, line_buf);
+	if (!more_old || !more)
+	    break;
+	if (strcmp(old_buf, line_buf) == 0)
+	    continue;
+	if (asm_patch(&a, n, line_buf) != 0)
+	    goto full;
+	++patched;
     }
 
-    for (i = 0; i < 10000; ++i)
-	label[i] = INVALID;
-
-    src_file = fopen(argv[1], "r");
-    lst_file = fopen(argv[2], "w");
-
-    fprintf(lst_file, " ---- Source file: %s. First pass assembler listing. ----\n\n", argv[1]);
-
-second_pass:
-
-    pc = 0;
-    line_cnt = 0;
-
-    while (fgets(line_buf, LINE_WIDTH, src_file) != NULL) {
-	char *p, *src_line, *lst_line, *msg, *comment = NULL, *name = NULL;
-	unsigned lnum = INVALID, olnum = INVALID, optype = INVALID, opcode = INVALID;
-	unsigned operand = 0;
-        enum {LABEL, MNEMONIC, OPERAND, COMMENT} parser_state = LABEL;
-	static const char *delim = " \t\n";
-	static const char *format_str = "Syntax error: %s \"%s\". The following source line is ignored.\n%4u:\t\t\t%s";
-
-	src_line = strdup(line_buf);
-	str_toupper(src_line);
-	for (p = strtok(src_line, delim); p != NULL; p = strtok(NULL, delim)) {
-	    switch (parser_state) {
-		case LABEL:
-		    if (*p == '$') {
-			/* label present */
-			lnum = parse_label(p + 1, 10, 4, 9999);
-			if (!second_pass && lnum == INVALID) {
-			    msg = "incorrect label";
-			    goto syntax_error;
-			}
-			if (second_pass && label[lnum] != pc) {
-			    ++warning;
-			    fprintf(lst_file, "Warning: multiple definitions of label \"$%u\", the last definition wins.\n", lnum);
-			}
-			label[lnum] = pc;
-			parser_state = MNEMONIC;
-			continue;
-		    }
-		/* falling through if no label */
-		case MNEMONIC:
-		    if (*p == ';') {
-			comment = p - src_line + line_buf;
-			goto print_listing;
-		    }
-		    for (i = 0; token[i].name != NULL; ++i)
-			if (memcmp(p, token[i].name, 3) == 0) {
-			    name = token[i].name;
-			    opcode = token[i].code;
-			    optype = token[i].type;
-			    break;
-			}
-		    if (!second_pass && name == NULL) {
-			msg = "unexpected token";
-			goto syntax_error;
-		    }
-		    if (opcode < ORG)
-			rom[pc] = opcode << 8;
-		    parser_state = OPERAND;
-		    continue;
-		case OPERAND:
-		    if (*p == '$') {
-			if (!second_pass && optype != LAB && optype != IMM) {
-			    msg = "incorrect operand";
-			    goto syntax_error;
-			}
-			olnum = parse_label(p + 1, 10, 4, 9999);
-			if (!second_pass && olnum == INVALID) {
-			    msg = "incorrect label operand";
-			    goto syntax_error;
-			}
-			if (label[olnum] == INVALID) {
-			    if (second_pass) {
-				++other_error;
-				fprintf(lst_file, "Error: label \"$%u\" is not defined. Operand left uninitialized.\n", olnum);
-			    }
-			    break;
-			}
-			operand = label[olnum];
-		    } else {
-			for (i = 0; indreg[i].name != NULL; ++i)
-			    if (strcmp(p, indreg[i].name) == 0) {
-				operand = indreg[i].code;
-				break;
-			    }
-			if (operand != 0) {
-			    if (!second_pass && optype != REG)
-			    {
-				msg = "not allowed indexed mode operand";
-				goto syntax_error;
-			    }
-			    goto set_operand;
-			}
-			if (*p == '%') {
-			    if (!second_pass && optype != REG) {
-				msg = "not allowed or incorrect operand";
-				goto syntax_error;
-			    }
-			    ++p;
-			} else
-			    if (!second_pass && optype == REG) {
-				msg = "reg operand reguired, possibly add \"%\" prefix to";
-				goto syntax_error;
-			    }
-			operand = parse_label(p, 16, 2, 0xff);
-			if (!second_pass && operand == INVALID) {
-			    msg = (optype == REG && --p) ? "incorrect reg operand" : "incorrect operand";
-			    goto syntax_error;
-			}
-			if (opcode == ORG)
-			    pc = operand;
-		    }
-set_operand:
-		    if (opcode < ORG)
-			rom[pc] |= operand;
-		    parser_state = COMMENT;
-		    continue;
-		case COMMENT:
-		    comment = p - src_line + line_buf;
-		    goto print_listing;
-	    }
-	}
-
-print_listing:
+    if (!more_old && !more)
+	return patched;
 
-	lst_line = malloc(LST_LINE_WIDTH);
-	memset(lst_line, ' ', LST_LINE_WIDTH);
+full:
+    asm_source(&a, src, len);
 
-	putatpos(lst_line, 0);
+    return -1;
+}
 
-	putatpos(NULL, 0, "%4u:   %02X", line_cnt, pc);
+/* loads the ROM into the simulator session of the server */
+static void push(const char *sock_name, const char *session)
+{
+    unsigned char req[LOAD_REQUEST_SIZE], *reply = NULL;
+    unsigned status, i;
+    size_t reply_len;
+    int fd;
+
+    for (i = 0; i < ROM_WORDS; ++i)
+	put_u16(req + 2 * i, a.rom[i]);
+
+    if ((fd = uc_connect(sock_name)) < 0 ||
+	send_frame(fd, CMD_ATTACH, session, strlen(session)) != 0 ||
+	recv_frame(fd, &status, &reply, &reply_len) != 0 || status != ST_OK) {
+	fprintf(stderr, "%s: cannot attach to session %s\n", sock_name, session);
+	goto out;
+    }
+    free(reply);
+    reply = NULL;
 
-	if (parser_state >= OPERAND && opcode < ORG) {
-	    putatpos(NULL, 12, "%03X", rom[pc]);
-	    ++pc;
-	}
+    if (send_frame(fd, CMD_LOAD, req, sizeof(req)) != 0 ||
+	recv_frame(fd, &status, &reply, &reply_len) != 0 || status != ST_OK || reply_len != 2)
+	fprintf(stderr, "%s: ROM not loaded\n", sock_name);
+    else
+	fprintf(stderr, "%u word(s) loaded into session %s\n", get_u16(reply), session);
 
-	if (lnum != INVALID)
-	    putatpos(NULL, 24, "$%u", lnum);
+out:
+    free(reply);
+    if (fd >= 0)
+	close(fd);
+}
 
-	if (parser_state >= OPERAND) {
-	    putatpos(NULL, 32, "%s", name);
-	    if (olnum != INVALID)
-		putatpos(NULL, 40, "$%u", olnum);
-	    else
-		putatpos(NULL, 40, optype == REG ? "%%%02X" : "%3.02X", operand);
-	}
+static double now(void)
+{
+    struct timespec ts;
 
-	if (comment != NULL)
-	    putatpos(NULL, 48, "%s", comment);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-	i = strlen(lst_line);
-	if (lst_line[--i] != '\n') {
-	    lst_line[++i] = '\n';
-	    lst_line[++i] = 0;
-	}
+static int watch(const char *src_name, const char *lst_name, const char *hex_name,
+		 const char *sock_name, const char *session)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char dir[PATH_MAX], *src, *old;
+    const char *base;
+    size_t len, old_len;
+    ssize_t n;
+    int fd, patched;
+    double t;
+
+    /* editors often replace the file, so the directory is watched */
+    if ((base = strrchr(src_name, '/')) != NULL) {
+	snprintf(dir, sizeof(dir), "%.*s", (int) (base - src_name) + 1, src_name);
+	++base;
+    } else {
+	strcpy(dir, ".");
+	base = src_name;
+    }
 
-	fputs(lst_line, lst_file);
-	free(lst_line);
+    if ((fd = inotify_init()) < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+	perror(dir);
+	return 1;
+    }
 
-	goto next_line;
+    if (read_file(src_name, &old, &old_len) != 0) {
+	perror(src_name);
+	return 1;
+    }
 
-syntax_error:
+    asm_source(&a, old, old_len);
+    if (output(lst_name, hex_name) == 0 && session != NULL)
+	push(sock_name, session);
 
-	++syntax_error;
-	fprintf(lst_file, format_str, msg, p, line_cnt, line_buf);
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+	const struct inotify_event *e;
+	char *p;
+	int changed = 0;
 
-next_line:
+	for (p = buf; p < buf + n; p += sizeof(*e) + e->len) {
+	    e = (const struct inotify_event *) p;
+	    if (e->len > 0 && strcmp(e->name, base) == 0)
+		changed = 1;
+	}
 
-	free(src_line);
-	++line_cnt;
-    }
+	if (!changed || read_file(src_name, &src, &len) != 0)
+	    continue;
 
-    /* do second pass */
+	t = now();
+	patched = reassemble(old, old_len, src, len);
+	t = now() - t;
 
-    if (!syntax_error && !second_pass) {
-	rewind(src_file);
-	freopen(argv[2], "w", lst_file);
+	if (patched < 0)
+	    fprintf(stderr, "%s: assembled in %.3f ms\n", src_name, t * 1e3);
+	else
+	    fprintf(stderr, "%s: %d line(s) reassembled in %.3f ms\n", src_name, patched, t * 1e3);
 
-	fprintf(lst_file, " ---- Source file: %s. Second pass assembler listing. ----\n\n", argv[1]);
+	if (output(lst_name, hex_name) == 0 && session != NULL && patched != 0)
+	    push(sock_name, session);
 
-	second_pass = 1;
-	goto second_pass;
+	free(old);
+	old = src;
+	old_len = len;
     }
 
-    fclose(src_file);
-    fclose(lst_file);
+    perror(dir);
 
-    if (syntax_error > 0) {
-	fprintf(stderr, "There were %d syntax error(s), hex file was not generated. Check listing file.\n", syntax_error);
-	return 1;
-    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+	{"watch", no_argument, NULL, 'w'},
+	{NULL, 0, NULL, 0}
+    };
+    char *src_name, *lst_name = NULL, *hex_name, *src;
+    const char *sock_name = DEFAULT_SOCKET, *session = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t len;
+    int i, watching = 0, rc;
+
+    while ((i = getopt_long(argc, argv, "j:l:ws:n:", options, NULL)) != -1)
+	switch (i) {
+	    case 'j':
+		threads = strtol(optarg, NULL, 0);
+		break;
+	    case 'l':
+		lst_name = optarg;
+		break;
+	    case 'w':
+		watching = 1;
+		break;
+	    case 's':
+		sock_name = optarg;
+		break;
+	    case 'n':
+		session = optarg;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
 
-    if (other_error > 0 || warning > 0) {
-	fprintf(stderr, "There were %d warning(s) and %d error(s). Check listing file.\n", warning, other_error);
+    if (argc - optind == 3 && lst_name == NULL && !watching) {
+	/* the old style invocation, listing is the second argument */
+	src_name = argv[optind];
+	lst_name = argv[optind + 1];
+	hex_name = argv[optind + 2];
+    } else if (argc - optind == 2) {
+	src_name = argv[optind];
+	hex_name = argv[optind + 1];
+    } else {
+	usage(argv[0]);
+	return -1;
     }
 
-    hex_file = fopen(argv[3], "w");
+#ifdef PROFILE
+    atexit(prof_report);
+#endif
+
+    asm_init(&a, src_name, lst_name != NULL, stderr);
+    if (threads > 1)
+	a.threads = threads;
+
+    if (watching)
+	return watch(src_name, lst_name, hex_name, sock_name, session);
 
-    for (i = 0; i < 16; ++i) {
-	for (j = 0; j < 16; ++j)
-	    fprintf(hex_file, "%4.03X", rom[(i<<4)+j]);
-	fputc('\n', hex_file);
+    if (read_file(src_name, &src, &len) != 0) {
+	perror(src_name);
+	return 1;
     }
 
-    fclose(hex_file);
+    asm_source(&a, src, len);
+    free(src);
 
-    return 0;
+    rc = output(lst_name, hex_name);
+    asm_free(&a);
+
+    return rc;
 }
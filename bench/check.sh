@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# Runs the benchmark programs and compares the final RAM with the golden
+# image <program>.gold and the cycle count with the one in cycles.ref.
+# A program fails if its RAM differs or it takes more cycles than the
+# reference. Fewer cycles are reported, the reference should then be
+# updated with "make golden".
+#
+# Usage: check.sh sim|rtl <program>...
+#
+# The sim runner uses $SIM (any simulator taking ucsim options), the rtl
+# runner uses $VVP with bench.vvp built from tb/bench.v.
+#
+
+SIM=${SIM:-../sim/ucsim}
+VVP=${VVP:-vvp}
+LIMIT=${LIMIT:-1000000}
+
+run_sim()
+{
+    $SIM -c $LIMIT -r $2 -o $3 $1
+}
+
+run_rtl()
+{
+    $VVP -n bench.vvp +rom=$1 +ram=$2 +dump=$3 +limit=$LIMIT
+}
+
+runner=$1
+shift
+
+case $runner in
+    sim|rtl) ;;
+    *) echo "Usage: $0 sim|rtl <program>..." >&2; exit 2 ;;
+esac
+
+failed=0
+
+printf "%-10s %10s %10s  %s\n" program cycles reference status
+
+for prog in "$@"; do
+    out=$prog.$runner.out
+    cycles=$(run_$runner $prog.hex $prog.ram $out | sed -n 's/^cycles: *//p')
+    ref=$(sed -n "s/^$prog  *//p" cycles.ref)
+
+    if [ -z "$cycles" ]; then
+	status="FAILED to run"
+	failed=1
+    elif ! tr a-f A-F < $out | cmp -s - $prog.gold; then
+	status="FAILED, RAM differs from $prog.gold"
+	failed=1
+    elif [ -z "$ref" ]; then
+	status="no reference"
+	failed=1
+    elif [ $cycles -gt $ref ]; then
+	status="REGRESSION by $((cycles - ref)) cycles"
+	failed=1
+    elif [ $cycles -lt $ref ]; then
+	status="improved by $((ref - cycles)) cycles"
+    else
+	status="ok"
+    fi
+
+    printf "%-10s %10s %10s  %s\n" $prog "$cycles" "$ref" "$status"
+done
+
+exit $failed
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Runs a cluster of the ROM images on uccluster serially and in parallel,
+# then every core of the serial run alone on ucsim replaying its inputs.
+# The parallel run must print the same state of the cores and leave the
+# same shared memory as the serial one, every replay the same state of
+# its core and the same shared memory.
+#
+# Usage: cluster.sh <cores> <rom>...
+#
+# $UCCLUSTER and $SIM are the simulators, the cluster is run with the
+# latencies in $LATENCIES on $THREADS threads. The shared memory is the
+# default of uccluster, %E0 - %F7.
+#
+
+UCCLUSTER=${UCCLUSTER:-../sim/uccluster}
+SIM=${SIM:-../sim/ucsim}
+LATENCIES=${LATENCIES:-1 16}
+THREADS=${THREADS:-2}
+LIMIT=${LIMIT:-1000000}
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <cores> <rom>..." >&2
+    exit 2
+fi
+
+cores=$1
+shift
+roms=$#
+
+# the shared cells of a dump, one per line
+shared()
+{
+    tr -s ' \n' '\n\n' < $1 | grep . | sed -n '225,248p'
+}
+
+failed=0
+
+printf "%-10s %10s  %s\n" run latency status
+
+for latency in $LATENCIES; do
+    args="-n $cores -l $latency -c $LIMIT"
+    $UCCLUSTER -s $args -o cluster.s.out -w cluster.log "$@" 2> /dev/null > cluster.s.txt
+    $UCCLUSTER -j $THREADS $args -o cluster.p.out "$@" 2> /dev/null > cluster.p.txt
+
+    if [ ! -s cluster.s.txt ]; then
+	status="FAILED to run"
+	failed=1
+    elif ! cmp -s cluster.s.txt cluster.p.txt || ! cmp -s cluster.s.out cluster.p.out; then
+	status="FAILED, the parallel run differs from the serial one"
+	failed=1
+    else
+	status="ok"
+    fi
+    printf "%-10s %10s  %s\n" parallel $latency "$status"
+
+    i=0
+    while [ $i -lt $cores ]; do
+	eval rom=\${$((i % roms + 1))}
+	state=$($SIM -c $LIMIT -P cluster.log.$i -o cluster.r.out $rom |
+		sed -n '1s/^/core '$i': /;1{h;d};2{H;d};3{H;g;s/\n/, /g;p}')
+
+	if [ -z "$state" ]; then
+	    status="FAILED to run"
+	    failed=1
+	elif [ "$state" != "$(sed -n "/^core $i:/p" cluster.s.txt)" ]; then
+	    status="FAILED, the state differs from the cluster"
+	    failed=1
+	elif [ "$(shared cluster.r.out)" != "$(shared cluster.s.out)" ]; then
+	    status="FAILED, the shared memory differs from the cluster"
+	    failed=1
+	else
+	    status="ok"
+	fi
+	printf "%-10s %10s  %s\n" "replay $i" $latency "$status"
+	i=$((i + 1))
+    done
+done
+
+exit $failed
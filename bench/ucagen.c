@@ -0,0 +1,139 @@
+/*
+ * Synthetic source generator for the assembler throughput benchmark.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Writes a valid uCPU source of the requested number of lines to stdout:
+ * blocks of 256 instructions, each starting with an "ORG", every fourth
+ * instruction labelled, branches mostly to forward labels, long comment
+ * lines and lines close to the assembler's LINE_WIDTH. A label always
+ * gets the same address in every block it is defined in, so the source
+ * assembles without warnings however long it is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "isa.h"
+
+/* must match LINE_WIDTH in assembler/ucasm.c */
+#define LINE_WIDTH 256
+
+/* blocks with distinct labels, 39 * 256 labels fit into $0 - $9999 */
+#define LABEL_BLOCKS 39
+
+static unsigned long seed = 1;
+
+static unsigned rnd(unsigned n)
+{
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    return (seed >> 33) % n;
+}
+
+/* the mnemonics of every operand class and the named operands, from ../sim/isa.h */
+#define REG_OP(name, c0, c1, c2, opcode, operand) ISA_IF(REG, operand, {c0, c1, c2, 0},)
+#define IMM_OP(name, c0, c1, c2, opcode, operand) ISA_IF(IMM, operand, {c0, c1, c2, 0},)
+#define LAB_OP(name, c0, c1, c2, opcode, operand) ISA_IF(LAB, operand, {c0, c1, c2, 0},)
+#define IND_REG(name, text, code) text,
+static const char reg_op[][4] = {ISA_INSNS(REG_OP)};
+static const char imm_op[][4] = {ISA_INSNS(IMM_OP)};
+static const char lab_op[][4] = {ISA_INSNS(LAB_OP)};
+static const char *ind_reg[] = {ISA_REGS(IND_REG)};
+
+static const char words[] =
+    "load the next element compare with the key and branch if the carry is clear "
+    "then store the accumulator through the index register and advance the pointer ";
+
+#define NELEM(a) (sizeof(a) / sizeof((a)[0]))
+
+/* appends a comment so that the line is len characters long */
+static int comment(char *line, int pos, int len)
+{
+    int n = len - pos - 2;
+
+    if (n <= 0)
+	return pos;
+    pos += sprintf(&line[pos], pos ? "\t;" : ";");
+    while (n > 0) {
+	int k = n < (int) sizeof(words) - 1 ? n : (int) sizeof(words) - 1;
+
+	memcpy(&line[pos], words, k);
+	pos += k;
+	n -= k;
+    }
+    line[pos] = 0;
+
+    return pos;
+}
+
+int main(int argc, char *argv[])
+{
+    char line[LINE_WIDTH];
+    unsigned long lines = 1000000, n = 0, block;
+    unsigned p, q;
+    int c, pos;
+
+    while ((c = getopt(argc, argv, "n:s:")) != -1)
+	switch (c) {
+	    case 'n':
+		lines = strtoul(optarg, NULL, 0);
+		break;
+	    case 's':
+		seed = strtoul(optarg, NULL, 0);
+		break;
+	    default:
+		printf("Usage: %s [-n <lines>] [-s <seed>]\n", argv[0]);
+		return -1;
+	}
+
+    for (block = 0; n < lines; ++block) {
+	unsigned base = (block % LABEL_BLOCKS) * 256;
+
+	printf(";\n; block %lu\n;\n\tORG\t00\n", block);
+	n += 4;
+
+	for (p = 0; p < 256 && n < lines; ++p, ++n) {
+	    pos = 0;
+	    if (p % 4 == 0)
+		pos += sprintf(&line[pos], "$%u", base + p);
+
+	    switch (rnd(3)) {
+		case 0:
+		    if (rnd(2))
+			pos += sprintf(&line[pos], "\t%s\t%s", reg_op[rnd(NELEM(reg_op))], ind_reg[rnd(NELEM(ind_reg))]);
+		    else
+			pos += sprintf(&line[pos], "\t%s\t%%%02X", reg_op[rnd(NELEM(reg_op))], rnd(0xf8));
+		    break;
+		case 1:
+		    pos += sprintf(&line[pos], "\t%s\t%02X", imm_op[rnd(NELEM(imm_op))], rnd(256));
+		    break;
+		default:
+		    /* forward to one of the next labels, backward at the block end */
+		    q = (p & ~3u) + 4 * (1 + rnd(4));
+		    pos += sprintf(&line[pos], "\t%s\t$%u", lab_op[rnd(NELEM(lab_op))], base + (q < 256 ? q : 0));
+		    break;
+	    }
+
+	    switch (rnd(16)) {
+		case 0:
+		    /* close to the input line buffer size */
+		    pos = comment(line, pos, LINE_WIDTH - 2 - rnd(8));
+		    break;
+		case 1: case 2: case 3: case 4:
+		    pos = comment(line, pos, pos + 8 + rnd(24));
+		    break;
+	    }
+	    puts(line);
+
+	    if (rnd(8) == 0 && n + 1 < lines) {
+		/* long comment line */
+		comment(line, 0, 120 + rnd(LINE_WIDTH - 130));
+		puts(line);
+		++n;
+	    }
+	}
+    }
+
+    return 0;
+}
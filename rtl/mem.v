@@ -7,11 +7,16 @@ input  wire  [7:0] abus;
 output wire [11:0] dbus;
 
 reg [11:0] mem[0:255];
+reg [8*256-1:0] file;
 
 assign dbus = en ? mem[abus] : 12'bz;
 
 initial
-  $readmemh("fib.hex", mem, 0, 255);
+  begin
+    if (!$value$plusargs("rom=%s", file))
+      file = "fib.hex";
+    $readmemh(file, mem, 0, 255);
+  end
 
 endmodule
 
@@ -25,6 +30,7 @@ input wire [7:0] abus;
 inout wire [7:0] dbus;
 
 reg [7:0] mem[0:255];
+reg [8*256-1:0] file;
 
 always @(posedge clk)
   if (wr_en)
@@ -33,6 +39,10 @@ always @(posedge clk)
 assign dbus = wr_en ? 8'bz : mem[abus];
 
 initial
-  $readmemh("null.hex", mem, 0, 255);
+  begin
+    if (!$value$plusargs("ram=%s", file))
+      file = "null.hex";
+    $readmemh(file, mem, 0, 255);
+  end
 
 endmodule
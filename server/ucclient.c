@@ -0,0 +1,401 @@
+/*
+ * Client of the uCPU assembler and simulator server.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Drop-in replacements of ucasm and ucsim working through ucserver:
+ *
+ *   ucclient [-s <socket>] asm [-l <listing>] <source> <hexdump>
+ *   ucclient [-s <socket>] asm <source> <listing> <hexdump>
+ *   ucclient [-s <socket>] [-n <session>] run [-b switch|threaded] [-c <max-cycles>] [-r <ram-init>] [-o <ram-dump>] <rom>
+ *
+ * The output and the exit codes are those of ucasm and ucsim. With a
+ * session name, the named simulator of the server is used, which keeps
+ * its state between the requests:
+ *
+ *   ucclient [-s <socket>] -n <session> load <rom>
+ *   ucclient [-s <socket>] -n <session> cont [-b switch|threaded] [-c <cycles>] [-z] [-o <ram-dump>]
+ *
+ * "load" replaces the ROM without resetting the simulator, "cont" runs
+ * for up to that many more cycles, from reset with -z. Also the reference
+ * for writing the protocol in other languages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "asm.h"
+#include "ucpu.h"
+#include "ucproto.h"
+
+#define DEFAULT_LIMIT 1000000UL
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-s <socket>] asm [-l <listing>] <source> <hexdump>\n", prog);
+    printf("       %s [-s <socket>] asm <source> <listing> <hexdump>\n", prog);
+    printf("       %s [-s <socket>] [-n <session>] run [-b switch|threaded] [-c <max-cycles>] [-r <ram-init>] [-o <ram-dump>] <rom>\n", prog);
+    printf("       %s [-s <socket>] -n <session> load <rom>\n", prog);
+    printf("       %s [-s <socket>] -n <session> cont [-b switch|threaded] [-c <cycles>] [-z] [-o <ram-dump>]\n", prog);
+}
+
+static int parse_backend(const char *name, unsigned *backend)
+{
+    if (strcmp(name, "switch") == 0)
+	*backend = BE_SWITCH;
+    else if (strcmp(name, "threaded") == 0)
+	*backend = BE_THREADED;
+    else
+	return -1;
+
+    return 0;
+}
+
+static int cmd_asm(int fd, int argc, char *argv[])
+{
+    char *lst_name = NULL, *src, *hex_name;
+    unsigned char *req, *reply;
+    unsigned status, syntax_error, other_error, warning, i, j;
+    size_t len, name_len, reply_len;
+    FILE *f;
+    int c;
+
+    while ((c = getopt(argc, argv, "l:")) != -1)
+	if (c == 'l')
+	    lst_name = optarg;
+	else
+	    return -1;
+
+    if (argc - optind == 3 && lst_name == NULL) {
+	/* the old style invocation, listing is the second argument */
+	lst_name = argv[optind + 1];
+	hex_name = argv[optind + 2];
+    } else if (argc - optind == 2)
+	hex_name = argv[optind + 1];
+    else
+	return -1;
+
+    if (read_file(argv[optind], &src, &len) != 0) {
+	perror(argv[optind]);
+	return 1;
+    }
+
+    name_len = strlen(argv[optind]);
+    if (name_len > 0xffff || 3 + name_len + len >= MAX_FRAME) {
+	fprintf(stderr, "%s: the source is too large for the server\n", argv[optind]);
+	return 1;
+    }
+    if ((req = malloc(3 + name_len + len)) == NULL)
+	return 1;
+    req[0] = lst_name != NULL ? AF_LISTING : 0;
+    put_u16(req + 1, name_len);
+    memcpy(req + 3, argv[optind], name_len);
+    memcpy(req + 3 + name_len, src, len);
+    free(src);
+
+    if (send_frame(fd, CMD_ASSEMBLE, req, 3 + name_len + len) != 0 ||
+	recv_frame(fd, &status, &reply, &reply_len) != 0 || reply_len < ASM_REPLY_SIZE) {
+	fprintf(stderr, "%s: no reply from the server\n", argv[optind]);
+	return 1;
+    }
+    free(req);
+
+    syntax_error = get_u32(reply);
+    other_error = get_u32(reply + 4);
+    warning = get_u32(reply + 8);
+
+    if (lst_name != NULL) {
+	if ((f = fopen(lst_name, "w")) == NULL) {
+	    perror(lst_name);
+	    return 1;
+	}
+	fwrite(reply + ASM_REPLY_SIZE, 1, reply_len - ASM_REPLY_SIZE, f);
+	fclose(f);
+    } else
+	fwrite(reply + ASM_REPLY_SIZE, 1, reply_len - ASM_REPLY_SIZE, stderr);
+
+    if (status != ST_OK) {
+	fprintf(stderr, "There were %u syntax error(s), hex file was not generated.%s\n", syntax_error,
+		lst_name != NULL ? " Check listing file." : "");
+	return 1;
+    }
+
+    if (other_error > 0 || warning > 0)
+	fprintf(stderr, "There were %u warning(s) and %u error(s).%s\n", warning, other_error,
+		lst_name != NULL ? " Check listing file." : "");
+
+    if ((f = fopen(hex_name, "w")) == NULL) {
+	perror(hex_name);
+	return 1;
+    }
+    for (i = 0; i < 16; ++i) {
+	for (j = 0; j < 16; ++j)
+	    fprintf(f, "%4.03X", get_u16(reply + 12 + 2 * ((i<<4)+j)));
+	fputc('\n', f);
+    }
+    fclose(f);
+    free(reply);
+
+    return 0;
+}
+
+/* prints the reply to CMD_RUN and CMD_CONT like ucsim, keeps the state in cpu */
+static halt_t print_reply(const unsigned char *reply, ucpu_t *cpu)
+{
+    const unsigned char *p = reply;
+    halt_t halt;
+
+    halt = *p++;
+    cpu->cycles = get_u64(p);
+    p += 8;
+    cpu->pc = *p++;
+    cpu->acc = *p++;
+    cpu->ix = *p++;
+    cpu->iy = *p++;
+    cpu->x = *p++;
+    cpu->cf = *p++;
+    cpu->zf = *p++;
+    memcpy(cpu->ram, p, RAM_SIZE);
+
+    printf("halt: %s\n", halt_name(halt));
+    printf("cycles: %lu\n", cpu->cycles);
+    printf("PC = %02X, Acc = %02X, IX = %02X, IY = %02X, CF = %u, ZF = %u, X = %02X\n",
+	   cpu->pc, cpu->acc, cpu->ix, cpu->iy, cpu->cf, cpu->zf, cpu->x);
+
+    return halt;
+}
+
+static int dump(const char *name, const ucpu_t *cpu)
+{
+    FILE *f;
+
+    if ((f = fopen(name, "w")) == NULL) {
+	perror(name);
+	return -1;
+    }
+    dump_hex(f, cpu->ram, RAM_SIZE);
+
+    return fclose(f);
+}
+
+static int cmd_run(int fd, int argc, char *argv[])
+{
+    static ucpu_t cpu;
+    unsigned char req[RUN_REQUEST_SIZE], *reply;
+    const char *ram_name = NULL, *dump_name = NULL;
+    unsigned long limit = DEFAULT_LIMIT;
+    unsigned backend = BE_SWITCH, status, i;
+    size_t reply_len;
+    halt_t halt;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:c:r:o:")) != -1)
+	switch (c) {
+	    case 'b':
+		if (parse_backend(optarg, &backend) != 0)
+		    return -1;
+		break;
+	    case 'c':
+		limit = strtoul(optarg, NULL, 0);
+		break;
+	    case 'r':
+		ram_name = optarg;
+		break;
+	    case 'o':
+		dump_name = optarg;
+		break;
+	    default:
+		return -1;
+	}
+
+    if (optind != argc - 1)
+	return -1;
+
+    if (load_hex(argv[optind], cpu.rom, ROM_SIZE, 1) < 0) {
+	perror(argv[optind]);
+	return 1;
+    }
+
+    if (ram_name != NULL && load_hex(ram_name, cpu.ram, RAM_SIZE, 0) < 0) {
+	perror(ram_name);
+	return 1;
+    }
+
+    put_u64(req, limit);
+    req[8] = backend;
+    for (i = 0; i < ROM_SIZE; ++i)
+	put_u16(req + 9 + 2 * i, cpu.rom[i]);
+    memcpy(req + 9 + 2 * ROM_SIZE, cpu.ram, RAM_SIZE);
+
+    if (send_frame(fd, CMD_RUN, req, sizeof(req)) != 0 ||
+	recv_frame(fd, &status, &reply, &reply_len) != 0 || status != ST_OK || reply_len != RUN_REPLY_SIZE) {
+	fprintf(stderr, "%s: no reply from the server\n", argv[optind]);
+	return 1;
+    }
+
+    halt = print_reply(reply, &cpu);
+    free(reply);
+
+    if (dump_name != NULL && dump(dump_name, &cpu) != 0)
+	return 1;
+
+    return halt == HALT_JMP ? 0 : 2;
+}
+
+static int cmd_load(int fd, int argc, char *argv[])
+{
+    static unsigned short rom[ROM_SIZE];
+    unsigned char req[LOAD_REQUEST_SIZE], *reply;
+    unsigned status, i;
+    size_t reply_len;
+
+    if (argc != 2)
+	return -1;
+
+    if (load_hex(argv[1], rom, ROM_SIZE, 1) < 0) {
+	perror(argv[1]);
+	return 1;
+    }
+
+    for (i = 0; i < ROM_SIZE; ++i)
+	put_u16(req + 2 * i, rom[i]);
+
+    if (send_frame(fd, CMD_LOAD, req, sizeof(req)) != 0 ||
+	recv_frame(fd, &status, &reply, &reply_len) != 0 || status != ST_OK || reply_len != 2) {
+	fprintf(stderr, "%s: no reply from the server\n", argv[1]);
+	return 1;
+    }
+
+    printf("%u word(s) changed\n", get_u16(reply));
+    free(reply);
+
+    return 0;
+}
+
+static int cmd_cont(int fd, int argc, char *argv[])
+{
+    static ucpu_t cpu;
+    unsigned char req[CONT_REQUEST_SIZE], *reply;
+    const char *dump_name = NULL;
+    unsigned long cycles = DEFAULT_LIMIT;
+    unsigned backend = BE_SWITCH, flags = 0, status;
+    size_t reply_len;
+    halt_t halt;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:c:zo:")) != -1)
+	switch (c) {
+	    case 'b':
+		if (parse_backend(optarg, &backend) != 0)
+		    return -1;
+		break;
+	    case 'c':
+		cycles = strtoul(optarg, NULL, 0);
+		break;
+	    case 'z':
+		flags |= CF_RESET;
+		break;
+	    case 'o':
+		dump_name = optarg;
+		break;
+	    default:
+		return -1;
+	}
+
+    if (optind != argc)
+	return -1;
+
+    put_u64(req, cycles);
+    req[8] = backend;
+    req[9] = flags;
+
+    if (send_frame(fd, CMD_CONT, req, sizeof(req)) != 0 ||
+	recv_frame(fd, &status, &reply, &reply_len) != 0 || status != ST_OK || reply_len != RUN_REPLY_SIZE) {
+	fprintf(stderr, "no reply from the server\n");
+	return 1;
+    }
+
+    halt = print_reply(reply, &cpu);
+    free(reply);
+
+    if (dump_name != NULL && dump(dump_name, &cpu) != 0)
+	return 1;
+
+    return halt == HALT_JMP ? 0 : 2;
+}
+
+/* makes the connection use the named simulator of the server */
+static int attach(int fd, const char *name)
+{
+    unsigned char *reply;
+    unsigned status;
+    size_t reply_len;
+
+    if (send_frame(fd, CMD_ATTACH, name, strlen(name)) != 0 ||
+	recv_frame(fd, &status, &reply, &reply_len) != 0)
+	return -1;
+    free(reply);
+
+    return status == ST_OK ? 0 : -1;
+}
+
+static const struct {
+    const char *name;
+    int (*cmd)(int fd, int argc, char *argv[]);
+    int session;	/* needs a session */
+} cmds[] = {
+    {"asm", cmd_asm, 0},
+    {"run", cmd_run, 0},
+    {"load", cmd_load, 1},
+    {"cont", cmd_cont, 1},
+    {NULL, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+    const char *path = DEFAULT_SOCKET, *session = NULL, *prog = argv[0];
+    int c, i, fd, rc;
+
+    /* "+" stops at the subcommand, its options are parsed separately */
+    while ((c = getopt(argc, argv, "+s:n:")) != -1)
+	if (c == 's')
+	    path = optarg;
+	else if (c == 'n')
+	    session = optarg;
+	else {
+	    usage(prog);
+	    return -1;
+	}
+
+    for (i = 0; optind < argc && cmds[i].name != NULL; ++i)
+	if (strcmp(argv[optind], cmds[i].name) == 0)
+	    break;
+
+    if (optind >= argc || cmds[i].name == NULL || (cmds[i].session && session == NULL)) {
+	usage(prog);
+	return -1;
+    }
+
+    if ((fd = uc_connect(path)) < 0) {
+	perror(path);
+	return 1;
+    }
+
+    if (session != NULL && attach(fd, session) != 0) {
+	fprintf(stderr, "%s: cannot attach\n", session);
+	return 1;
+    }
+
+    argc -= optind;
+    argv += optind;
+    optind = 1;
+
+    rc = cmds[i].cmd(fd, argc, argv);
+    close(fd);
+
+    if (rc < 0)
+	usage(prog);
+
+    return rc;
+}
@@ -0,0 +1,162 @@
+/*
+ * uCPU assembler/simulator server protocol, framing.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ucproto.h"
+
+void put_u16(unsigned char *p, unsigned v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+void put_u32(unsigned char *p, unsigned long v)
+{
+    put_u16(p, v & 0xffff);
+    put_u16(p + 2, v >> 16 & 0xffff);
+}
+
+void put_u64(unsigned char *p, unsigned long long v)
+{
+    put_u32(p, v & 0xffffffff);
+    put_u32(p + 4, v >> 32 & 0xffffffff);
+}
+
+unsigned get_u16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+unsigned long get_u32(const unsigned char *p)
+{
+    return get_u16(p) | (unsigned long) get_u16(p + 2) << 16;
+}
+
+unsigned long long get_u64(const unsigned char *p)
+{
+    return get_u32(p) | (unsigned long long) get_u32(p + 4) << 32;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+	ssize_t n = read(fd, p, len);
+
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return -1;
+	p += n;
+	len -= n;
+    }
+
+    return 0;
+}
+
+static int writev_full(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0) {
+	ssize_t n = writev(fd, iov, cnt);
+
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0)
+	    return -1;
+	while (cnt > 0 && (size_t) n >= iov->iov_len) {
+	    n -= iov->iov_len;
+	    ++iov;
+	    --cnt;
+	}
+	if (cnt > 0) {
+	    iov->iov_base = (char *) iov->iov_base + n;
+	    iov->iov_len -= n;
+	}
+    }
+
+    return 0;
+}
+
+/* one frame from two pieces of payload, written with a single system call */
+int send_frame2(int fd, unsigned code, const void *data, size_t len, const void *data2, size_t len2)
+{
+    unsigned char head[5];
+    struct iovec iov[3];
+
+    if (len + len2 >= MAX_FRAME)
+	return -1;
+
+    put_u32(head, 1 + len + len2);
+    head[4] = code;
+
+    iov[0].iov_base = head;
+    iov[0].iov_len = sizeof(head);
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len = len;
+    iov[2].iov_base = (void *) data2;
+    iov[2].iov_len = len2;
+
+    return writev_full(fd, iov, 3);
+}
+
+int send_frame(int fd, unsigned code, const void *data, size_t len)
+{
+    return send_frame2(fd, code, data, len, NULL, 0);
+}
+
+/* the payload is malloc()ed and zero terminated, free() it */
+int recv_frame(int fd, unsigned *code, unsigned char **data, size_t *len)
+{
+    unsigned char head[5];
+    unsigned long n;
+
+    if (read_full(fd, head, sizeof(head)) != 0)
+	return -1;
+
+    n = get_u32(head);
+    if (n < 1 || n > MAX_FRAME)
+	return -1;
+
+    *code = head[4];
+    *len = n - 1;
+    if ((*data = malloc(n)) == NULL)
+	return -1;
+    (*data)[*len] = 0;
+
+    if (read_full(fd, *data, *len) != 0) {
+	free(*data);
+	return -1;
+    }
+
+    return 0;
+}
+
+/* connects to the server, returns the socket */
+int uc_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+	close(fd);
+	return -1;
+    }
+
+    return fd;
+}
@@ -0,0 +1,109 @@
+/*
+ * uCPU assembler/simulator server protocol.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Requests and responses are frames on a Unix stream socket:
+ *
+ *   u32 length		length of what follows, code included
+ *   u8  code		request command or response status
+ *   ...		payload
+ *
+ * All integers are little endian. Any number of requests may be sent over
+ * one connection, each one is answered by exactly one response.
+ *
+ * CMD_ASSEMBLE
+ *   request:  u8 flags (AF_LISTING), u16 name length, source name (for the
+ *             messages and the listing), source text up to the frame end
+ *   response: u32 syntax errors, u32 errors, u32 warnings, 256 x u16 ROM,
+ *             text up to the frame end: the listing if AF_LISTING is set,
+ *             the messages otherwise, cut at MAX_FRAME
+ *   status:   ST_OK, ST_SYNTAX (the ROM is not valid)
+ *
+ * CMD_RUN
+ *   request:  u64 max cycles, u8 backend (BE_*), 256 x u16 ROM, 256 x u8 RAM
+ *   response: u8 halt (halt_t), u64 cycles, u8 PC, Acc, IX, IY, X, CF, ZF,
+ *             256 x u8 RAM
+ *   status:   ST_OK
+ *
+ * CMD_ATTACH
+ *   request:  session name up to the frame end
+ *   response: empty
+ *   status:   ST_OK
+ *   The connection's simulator becomes the named one, shared with every
+ *   other connection attached to that name and kept while the server runs.
+ *   CMD_RUN then also uses the session's simulator.
+ *
+ * CMD_LOAD
+ *   request:  256 x u16 ROM
+ *   response: u16 number of changed words
+ *   status:   ST_OK
+ *   Replaces the ROM of the simulator in place: the machine state and the
+ *   RAM are kept, only the changed words are decoded again.
+ *
+ * CMD_CONT
+ *   request:  u64 cycles, u8 backend (BE_*), u8 flags (CF_RESET)
+ *   response: as for CMD_RUN
+ *   status:   ST_OK
+ *   Runs the simulator from its current state for up to that many cycles,
+ *   from reset if CF_RESET is set. The cycle count of the response is the
+ *   total since the reset.
+ *
+ * Malformed requests are answered with ST_BAD_REQUEST and an empty payload.
+ */
+
+#ifndef UCPROTO_H
+#define UCPROTO_H
+
+#include <stddef.h>
+
+#define DEFAULT_SOCKET "/tmp/ucserver.sock"
+
+/*
+ * Frames larger than this are neither sent nor received. The source of a
+ * 256 word program is a few kilobytes, and so is its listing.
+ */
+#define MAX_FRAME (16UL << 20)
+
+/* request commands */
+#define CMD_ASSEMBLE 1
+#define CMD_RUN      2
+#define CMD_ATTACH   3
+#define CMD_LOAD     4
+#define CMD_CONT     5
+
+/* CMD_ASSEMBLE flags */
+#define AF_LISTING 0x01
+
+/* CMD_CONT flags */
+#define CF_RESET 0x01
+
+/* CMD_RUN backends */
+#define BE_SWITCH   0
+#define BE_THREADED 1
+
+/* response status */
+#define ST_OK          0
+#define ST_SYNTAX      1
+#define ST_BAD_REQUEST 2
+
+#define ASM_REPLY_SIZE (3 * 4 + 256 * 2)
+#define RUN_REQUEST_SIZE (8 + 1 + 256 * 2 + 256)
+#define RUN_REPLY_SIZE (1 + 8 + 7 + 256)
+#define LOAD_REQUEST_SIZE (256 * 2)
+#define CONT_REQUEST_SIZE (8 + 1 + 1)
+
+#define MAX_SESSION_NAME 255
+
+void put_u16(unsigned char *p, unsigned v);
+void put_u32(unsigned char *p, unsigned long v);
+void put_u64(unsigned char *p, unsigned long long v);
+unsigned get_u16(const unsigned char *p);
+unsigned long get_u32(const unsigned char *p);
+unsigned long long get_u64(const unsigned char *p);
+
+int send_frame(int fd, unsigned code, const void *data, size_t len);
+int send_frame2(int fd, unsigned code, const void *data, size_t len, const void *data2, size_t len2);
+int recv_frame(int fd, unsigned *code, unsigned char **data, size_t *len);
+int uc_connect(const char *path);
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ * Assembler and simulator server for uCPU.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Serves CMD_ASSEMBLE and CMD_RUN requests (see ucproto.h) on a Unix
+ * socket, so that editors and test runners pay neither a process start
+ * nor file I/O per request. Every connection gets a thread with its own
+ * assembler state, whose label table and listing buffers are reused from
+ * request to request, and its own simulator with the pre-decoded ROM of
+ * the threaded backend: a run of the same ROM is not decoded again, a
+ * changed ROM only in the changed words. Connections may attach to a
+ * named simulator instead and share it, e.g. "ucasm -w" loading every
+ * change of the ROM into the simulator a test runner keeps running.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "asm.h"
+#include "ucpu.h"
+#include "ucproto.h"
+
+typedef struct sim {
+    struct sim *next;
+    char *name;
+    pthread_mutex_t lock;
+    ucpu_t cpu;
+    decode_t dec;
+    unsigned short dec_rom[ROM_SIZE];	/* ROM the decode was made for */
+    int dec_valid;
+} sim_t;
+
+typedef struct {
+    int fd;
+    asm_t a;
+    sim_t own, *sim;
+} session_t;
+
+/* named simulators, never freed */
+static sim_t *sims;
+static pthread_mutex_t sims_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int verbose;
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-v] [-s <socket>]\n", prog);
+}
+
+/*
+ * request:  u8 flags, u16 name length, name, source
+ * response: see ucproto.h
+ */
+static int do_assemble(session_t *s, const unsigned char *req, size_t len)
+{
+    unsigned char reply[ASM_REPLY_SIZE];
+    char *name, *text = NULL;
+    size_t name_len, text_len = 0;
+    FILE *f;
+    unsigned i;
+    int rc;
+
+    if (len < 3 || (name_len = get_u16(req + 1)) > len - 3)
+	return send_frame(s->fd, ST_BAD_REQUEST, NULL, 0);
+
+    if ((name = malloc(name_len + 1)) == NULL || (f = open_memstream(&text, &text_len)) == NULL) {
+	free(name);
+	return -1;
+    }
+    memcpy(name, req + 3, name_len);
+    name[name_len] = 0;
+
+    s->a.src_name = name;
+    s->a.listing = req[0] & AF_LISTING;
+    s->a.msg_file = f;
+
+    asm_source(&s->a, (const char *) req + 3 + name_len, len - 3 - name_len);
+    if (s->a.listing)
+	asm_write_listing(&s->a, f);
+    fclose(f);
+    if (text_len >= MAX_FRAME - sizeof(reply))
+	text_len = MAX_FRAME - sizeof(reply) - 1;
+
+    put_u32(reply, s->a.syntax_error);
+    put_u32(reply + 4, s->a.other_error);
+    put_u32(reply + 8, s->a.warning);
+    for (i = 0; i < ROM_SIZE; ++i)
+	put_u16(reply + 12 + 2 * i, s->a.rom[i]);
+
+    rc = send_frame2(s->fd, s->a.syntax_error ? ST_SYNTAX : ST_OK, reply, sizeof(reply), text, text_len);
+
+    free(text);
+    free(name);
+    s->a.src_name = NULL;
+
+    return rc;
+}
+
+/* brings the decoded ROM up to date, only the changed words are decoded */
+static unsigned update_decode(sim_t *sim)
+{
+    unsigned i, changed = 0;
+
+    for (i = 0; i < ROM_SIZE; ++i)
+	if (!sim->dec_valid || sim->dec_rom[i] != sim->cpu.rom[i]) {
+	    sim->dec.kind[i] = ucpu_decode_word(sim->cpu.rom[i], i);
+	    sim->dec_rom[i] = sim->cpu.rom[i];
+	    ++changed;
+	}
+    sim->dec_valid = 1;
+
+    return changed;
+}
+
+static int send_state(session_t *s, const ucpu_t *cpu, halt_t halt)
+{
+    unsigned char reply[RUN_REPLY_SIZE], *p = reply;
+
+    *p++ = halt;
+    put_u64(p, cpu->cycles);
+    p += 8;
+    *p++ = cpu->pc;
+    *p++ = cpu->acc;
+    *p++ = cpu->ix;
+    *p++ = cpu->iy;
+    *p++ = cpu->x;
+    *p++ = cpu->cf;
+    *p++ = cpu->zf;
+    memcpy(p, cpu->ram, RAM_SIZE);
+
+    return send_frame(s->fd, ST_OK, reply, sizeof(reply));
+}
+
+static halt_t run(sim_t *sim, unsigned backend, unsigned long long max)
+{
+    if (backend == BE_THREADED) {
+	update_decode(sim);
+	return ucpu_run_threaded(&sim->cpu, &sim->dec, max);
+    }
+
+    return ucpu_run(&sim->cpu, max);
+}
+
+static int do_run(session_t *s, const unsigned char *req, size_t len)
+{
+    sim_t *sim = s->sim;
+    unsigned backend, i;
+    halt_t halt;
+    int rc;
+
+    if (len != RUN_REQUEST_SIZE || (backend = req[8]) > BE_THREADED)
+	return send_frame(s->fd, ST_BAD_REQUEST, NULL, 0);
+
+    pthread_mutex_lock(&sim->lock);
+    for (i = 0; i < ROM_SIZE; ++i)
+	sim->cpu.rom[i] = get_u16(req + 9 + 2 * i) & 0xfff;
+    memcpy(sim->cpu.ram, req + 9 + 2 * ROM_SIZE, RAM_SIZE);
+
+    ucpu_reset(&sim->cpu);
+    halt = run(sim, backend, get_u64(req));
+    rc = send_state(s, &sim->cpu, halt);
+    pthread_mutex_unlock(&sim->lock);
+
+    return rc;
+}
+
+static int do_attach(session_t *s, const unsigned char *req, size_t len)
+{
+    sim_t *sim;
+
+    if (len < 1 || len > MAX_SESSION_NAME || memchr(req, 0, len) != NULL)
+	return send_frame(s->fd, ST_BAD_REQUEST, NULL, 0);
+
+    pthread_mutex_lock(&sims_lock);
+    for (sim = sims; sim != NULL; sim = sim->next)
+	if (strcmp(sim->name, (const char *) req) == 0)
+	    break;
+    if (sim == NULL && (sim = calloc(1, sizeof(*sim))) != NULL) {
+	sim->name = strdup((const char *) req);
+	pthread_mutex_init(&sim->lock, NULL);
+	sim->next = sims;
+	sims = sim;
+	if (verbose)
+	    fprintf(stderr, "session %s\n", sim->name);
+    }
+    pthread_mutex_unlock(&sims_lock);
+
+    if (sim == NULL)
+	return -1;
+    s->sim = sim;
+
+    return send_frame(s->fd, ST_OK, NULL, 0);
+}
+
+static int do_load(session_t *s, const unsigned char *req, size_t len)
+{
+    sim_t *sim = s->sim;
+    unsigned char reply[2];
+    unsigned i;
+
+    if (len != LOAD_REQUEST_SIZE)
+	return send_frame(s->fd, ST_BAD_REQUEST, NULL, 0);
+
+    pthread_mutex_lock(&sim->lock);
+    for (i = 0; i < ROM_SIZE; ++i)
+	sim->cpu.rom[i] = get_u16(req + 2 * i) & 0xfff;
+    put_u16(reply, update_decode(sim));
+    pthread_mutex_unlock(&sim->lock);
+
+    return send_frame(s->fd, ST_OK, reply, sizeof(reply));
+}
+
+static int do_cont(session_t *s, const unsigned char *req, size_t len)
+{
+    sim_t *sim = s->sim;
+    unsigned backend;
+    unsigned long long limit;
+    halt_t halt;
+    int rc;
+
+    if (len != CONT_REQUEST_SIZE || (backend = req[8]) > BE_THREADED)
+	return send_frame(s->fd, ST_BAD_REQUEST, NULL, 0);
+
+    pthread_mutex_lock(&sim->lock);
+    if (req[9] & CF_RESET)
+	ucpu_reset(&sim->cpu);
+    /* the total since the reset, saturated */
+    limit = sim->cpu.cycles + get_u64(req);
+    if (limit < sim->cpu.cycles)
+	limit = ULLONG_MAX;
+    halt = run(sim, backend, limit);
+    rc = send_state(s, &sim->cpu, halt);
+    pthread_mutex_unlock(&sim->lock);
+
+    return rc;
+}
+
+static void *session(void *arg)
+{
+    session_t *s = arg;
+    unsigned char *req;
+    unsigned cmd;
+    size_t len;
+    int rc;
+
+    while (recv_frame(s->fd, &cmd, &req, &len) == 0) {
+	switch (cmd) {
+	    case CMD_ASSEMBLE:
+		rc = do_assemble(s, req, len);
+		break;
+	    case CMD_RUN:
+		rc = do_run(s, req, len);
+		break;
+	    case CMD_ATTACH:
+		rc = do_attach(s, req, len);
+		break;
+	    case CMD_LOAD:
+		rc = do_load(s, req, len);
+		break;
+	    case CMD_CONT:
+		rc = do_cont(s, req, len);
+		break;
+	    default:
+		rc = send_frame(s->fd, ST_BAD_REQUEST, NULL, 0);
+	}
+	free(req);
+	if (rc != 0)
+	    break;
+    }
+
+    if (verbose)
+	fprintf(stderr, "connection %d closed\n", s->fd);
+
+    close(s->fd);
+    asm_free(&s->a);
+    pthread_mutex_destroy(&s->own.lock);
+    free(s);
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = DEFAULT_SOCKET;
+    struct sockaddr_un addr;
+    pthread_attr_t attr;
+    int c, fd;
+
+    while ((c = getopt(argc, argv, "s:v")) != -1)
+	switch (c) {
+	    case 's':
+		path = optarg;
+		break;
+	    case 'v':
+		verbose = 1;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind != argc || strlen(path) >= sizeof(addr.sun_path)) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    /* a client gone in the middle of a response must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+	perror(path);
+	return 1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (;;) {
+	session_t *s;
+	pthread_t tid;
+	int cfd = accept(fd, NULL, NULL);
+
+	if (cfd < 0) {
+	    perror("accept");
+	    continue;
+	}
+
+	if ((s = calloc(1, sizeof(*s))) == NULL) {
+	    close(cfd);
+	    continue;
+	}
+	asm_init(&s->a, NULL, 0, NULL);
+	pthread_mutex_init(&s->own.lock, NULL);
+	s->sim = &s->own;
+	s->fd = cfd;
+
+	if (verbose)
+	    fprintf(stderr, "connection %d\n", cfd);
+
+	if (pthread_create(&tid, &attr, session, s) != 0) {
+	    close(cfd);
+	    free(s);
+	}
+    }
+
+    return 0;
+}
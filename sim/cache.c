@@ -0,0 +1,208 @@
+/*
+ * Persistent result cache of uCPU runs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+/* the first word of a cache file */
+#define CACHE_MAGIC 0x3130534552435554ULL	/* "TUCRES01" */
+
+#ifndef SIM_ID
+#define SIM_ID 0
+#endif
+
+typedef struct {
+    uint64_t magic, sets, ways;
+    uint64_t clock;		/* of the LRU */
+} header_t;
+
+typedef struct {
+    uint64_t used;		/* clock of the last access, 0 if empty */
+    uint64_t hash, cycles;
+    cov_t cov;
+    unsigned char key[CACHE_KEY_SIZE];
+    unsigned char ram[RAM_SIZE];
+    unsigned char pc, acc, ix, iy, x, cf, zf;
+    unsigned char halt, has_cov;
+} entry_t;
+
+#define FILE_SIZE (sizeof(header_t) + CACHE_SETS * CACHE_WAYS * sizeof(entry_t))
+
+struct cache {
+    int fd;
+    header_t *hdr;
+    entry_t *entry;
+};
+
+cache_t *cache_open(const char *name)
+{
+    cache_t *cache;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(name, O_RDWR | O_CREAT, 0666)) < 0)
+	return NULL;
+
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0 ||
+	(st.st_size == 0 && ftruncate(fd, FILE_SIZE) != 0))
+	goto err;
+    if (st.st_size != 0 && st.st_size != FILE_SIZE) {
+	errno = EINVAL;
+	goto err;
+    }
+
+    map = mmap(NULL, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+	goto err;
+
+    if ((cache = malloc(sizeof(*cache))) == NULL) {
+	munmap(map, FILE_SIZE);
+	goto err;
+    }
+    cache->fd = fd;
+    cache->hdr = map;
+    cache->entry = (entry_t *) (cache->hdr + 1);
+
+    if (cache->hdr->magic == 0) {
+	cache->hdr->magic = CACHE_MAGIC;
+	cache->hdr->sets = CACHE_SETS;
+	cache->hdr->ways = CACHE_WAYS;
+    }
+    if (cache->hdr->magic != CACHE_MAGIC || cache->hdr->sets != CACHE_SETS ||
+	cache->hdr->ways != CACHE_WAYS) {
+	munmap(map, FILE_SIZE);
+	free(cache);
+	errno = EINVAL;
+	goto err;
+    }
+
+    flock(fd, LOCK_UN);
+
+    return cache;
+
+err:
+    close(fd);
+
+    return NULL;
+}
+
+void cache_close(cache_t *cache)
+{
+    munmap(cache->hdr, FILE_SIZE);
+    close(cache->fd);
+    free(cache);
+}
+
+void cache_key(cache_key_t *key, const ucpu_t *cpu, unsigned long max_cycles)
+{
+    unsigned char *p = key->b;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned i;
+
+    for (i = 0; i < ROM_SIZE; ++i) {
+	*p++ = cpu->rom[i];
+	*p++ = cpu->rom[i] >> 8;
+    }
+    memcpy(p, cpu->ram, RAM_SIZE);
+    p += RAM_SIZE;
+    for (i = 0; i < 8; ++i)
+	*p++ = (unsigned long long) max_cycles >> (8 * i);
+    for (i = 0; i < 8; ++i)
+	*p++ = (unsigned long long) SIM_ID >> (8 * i);
+
+    /* FNV-1a, only to pick the set */
+    for (i = 0; i < CACHE_KEY_SIZE; ++i)
+	h = (h ^ key->b[i]) * 0x100000001b3ULL;
+    key->hash = h;
+}
+
+/* the entry of the key in its set, NULL if none */
+static entry_t *find(cache_t *cache, const cache_key_t *key)
+{
+    entry_t *e = &cache->entry[key->hash % CACHE_SETS * CACHE_WAYS];
+    unsigned i;
+
+    for (i = 0; i < CACHE_WAYS; ++i, ++e)
+	if (e->used != 0 && e->hash == key->hash && memcmp(e->key, key->b, CACHE_KEY_SIZE) == 0)
+	    return e;
+
+    return NULL;
+}
+
+halt_t cache_lookup(cache_t *cache, const cache_key_t *key, ucpu_t *cpu, cov_t *cov)
+{
+    halt_t halt = HALT_NONE;
+    entry_t *e;
+    unsigned i;
+
+    flock(cache->fd, LOCK_EX);
+
+    if ((e = find(cache, key)) != NULL && (cov == NULL || e->has_cov)) {
+	e->used = ++cache->hdr->clock;
+
+	cpu->pc = e->pc;
+	cpu->acc = e->acc;
+	cpu->ix = e->ix;
+	cpu->iy = e->iy;
+	cpu->x = e->x;
+	cpu->cf = e->cf;
+	cpu->zf = e->zf;
+	cpu->cycles = e->cycles;
+	memcpy(cpu->ram, e->ram, RAM_SIZE);
+	if (cov != NULL)
+	    for (i = 0; i < COV_WORDS; ++i)
+		cov->w[i] |= e->cov.w[i];
+	halt = e->halt;
+    }
+
+    flock(cache->fd, LOCK_UN);
+
+    return halt;
+}
+
+void cache_store(cache_t *cache, const cache_key_t *key, const ucpu_t *cpu, halt_t halt,
+		 const cov_t *cov)
+{
+    entry_t *e, *set;
+    unsigned i;
+
+    flock(cache->fd, LOCK_EX);
+
+    if ((e = find(cache, key)) == NULL) {
+	/* an empty entry has the oldest clock */
+	e = set = &cache->entry[key->hash % CACHE_SETS * CACHE_WAYS];
+	for (i = 1; i < CACHE_WAYS; ++i)
+	    if (set[i].used < e->used)
+		e = &set[i];
+	e->hash = key->hash;
+	memcpy(e->key, key->b, CACHE_KEY_SIZE);
+    }
+
+    e->used = ++cache->hdr->clock;
+    e->pc = cpu->pc;
+    e->acc = cpu->acc;
+    e->ix = cpu->ix;
+    e->iy = cpu->iy;
+    e->x = cpu->x;
+    e->cf = cpu->cf;
+    e->zf = cpu->zf;
+    e->cycles = cpu->cycles;
+    memcpy(e->ram, cpu->ram, RAM_SIZE);
+    e->halt = halt;
+    e->has_cov = cov != NULL;
+    if (cov != NULL)
+	e->cov = *cov;
+
+    flock(cache->fd, LOCK_UN);
+}
@@ -0,0 +1,55 @@
+/*
+ * Persistent result cache of uCPU runs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * A run from reset is determined by the ROM, the initial RAM and the cycle
+ * limit, and by the simulator: the key has SIM_ID too, a checksum of the
+ * sources of the simulator and the coverage taken by the Makefile, so a
+ * cache shared by builds of different sources keeps their results apart.
+ * The cache maps them to the final state, the halt reason and, if
+ * the run was made with coverage, the coverage bitmap. The cache file is
+ * mapped shared: a set associative table of CACHE_SETS * CACHE_WAYS
+ * entries, each holding its whole key, the least recently used entry of
+ * the set is replaced. Every access is made under flock(2), so parallel
+ * runs can share one cache.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "ucpu.h"
+#include "cov.h"
+
+#define CACHE_SETS 512
+#define CACHE_WAYS 8
+
+/* ROM words (little endian), RAM, cycle limit and SIM_ID (little endian) */
+#define CACHE_KEY_SIZE (ROM_SIZE * 2 + RAM_SIZE + 8 + 8)
+
+typedef struct {
+    unsigned char b[CACHE_KEY_SIZE];
+    uint64_t hash;
+} cache_key_t;
+
+typedef struct cache cache_t;
+
+/* maps the cache file, creating it if needed, returns NULL on error */
+cache_t *cache_open(const char *name);
+void cache_close(cache_t *cache);
+
+/* the key of a run of cpu from reset, before the run */
+void cache_key(cache_key_t *key, const ucpu_t *cpu, unsigned long max_cycles);
+
+/*
+ * Looks the run up, on a hit sets the final state of cpu, ORs the
+ * coverage into cov and returns the halt reason. Returns HALT_NONE on a
+ * miss, which is also when cov is not NULL and the run was cached without
+ * coverage.
+ */
+halt_t cache_lookup(cache_t *cache, const cache_key_t *key, ucpu_t *cpu, cov_t *cov);
+
+/* stores the result of the run, cov is NULL if it was made without coverage */
+void cache_store(cache_t *cache, const cache_key_t *key, const ucpu_t *cpu, halt_t halt,
+		 const cov_t *cov);
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * Control flow graph recovery for uCPU ROM images.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * The abstract machine state is kept per ROM address, the state at the
+ * start of the instruction joined over all paths reaching it. A work list
+ * runs the instructions on their states until nothing changes; the value
+ * sets only grow and are finite, so this terminates. The transfer
+ * functions follow ucpu_step() case by case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+
+insn_t cfg_insn[1 << 12];
+
+/* the operand classes of isa.h */
+enum {C_REG, C_IMM, C_LAB};
+
+__attribute__((constructor))
+static void cfg_init(void)
+{
+#define OP_INFO(name, c0, c1, c2, opcode, operand) [opcode] = {{c0, c1, c2, 0}, C_##operand},
+#define REG_NAME(name, text, code) [code] = text,
+    static const struct {
+	char name[4];
+	unsigned char cls;
+    } op_info[ISA_OPCODES] = {ISA_INSNS(OP_INFO)};
+    static const char *const reg_name[RAM_SIZE] = {ISA_REGS(REG_NAME)};
+#undef OP_INFO
+#undef REG_NAME
+    unsigned w;
+
+    for (w = 0; w < 1 << 12; ++w) {
+	insn_t *i = &cfg_insn[w];
+	const char *name = op_info[w >> 8].name;
+
+	i->op = w >> 8;
+	i->dat = w;
+	i->flow = i->op == OP_BNC || i->op == OP_BNZ ? FLOW_BRANCH :
+		  i->op == OP_JMP ? FLOW_JUMP : i->op == OP_JPR ? FLOW_JPR : FLOW_NEXT;
+
+	switch (op_info[i->op].cls) {
+	    case C_REG:
+		if (reg_name[i->dat] != NULL)
+		    snprintf(i->text, sizeof(i->text), "%s\t%s", name, reg_name[i->dat]);
+		else
+		    snprintf(i->text, sizeof(i->text), "%s\t%%%02X", name, i->dat);
+		break;
+	    case C_IMM:
+		snprintf(i->text, sizeof(i->text), "%s\t%02X", name, i->dat);
+		break;
+	    default:
+		snprintf(i->text, sizeof(i->text), "%s\t", name);
+	}
+    }
+}
+
+typedef struct {
+    vset_t acc, x, ix, iy;
+    vset_t ram[RAM_SIZE];
+} vstate_t;
+
+unsigned vset_count(const vset_t *s)
+{
+    return __builtin_popcountll(s->w[0]) + __builtin_popcountll(s->w[1]) +
+	   __builtin_popcountll(s->w[2]) + __builtin_popcountll(s->w[3]);
+}
+
+static void vset_one(vset_t *s, unsigned v)
+{
+    memset(s, 0, sizeof(*s));
+    VSET_ADD(s, v);
+}
+
+static void vset_fill(vset_t *s)
+{
+    memset(s, 0xff, sizeof(*s));
+}
+
+static int vset_full(const vset_t *s)
+{
+    return (s->w[0] & s->w[1] & s->w[2] & s->w[3]) == ~(uint64_t) 0;
+}
+
+/* d |= s, returns nonzero if d changed */
+static int vset_join(vset_t *d, const vset_t *s)
+{
+    uint64_t changed = 0;
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+	changed |= s->w[i] & ~d->w[i];
+	d->w[i] |= s->w[i];
+    }
+
+    return changed != 0;
+}
+
+/* {v + k | v in s} */
+static void vset_add_const(vset_t *s, unsigned k)
+{
+    vset_t r;
+    unsigned v;
+
+    memset(&r, 0, sizeof(r));
+    for (v = 0; v < 256; ++v)
+	if (VSET_HAS(s, v))
+	    VSET_ADD(&r, (v + k) & 0xff);
+    *s = r;
+}
+
+/* more pairs than this and the result is taken as any value */
+#define MAX_PAIRS 4096
+
+/* {a op b | a in sa, b in sb}, op one of "&^+-" */
+static void vset_op(vset_t *r, const vset_t *sa, const vset_t *sb, int op)
+{
+    vset_t t;
+    unsigned a, b, v = 0;
+
+    if (vset_count(sa) * vset_count(sb) > MAX_PAIRS) {
+	vset_fill(r);
+	return;
+    }
+
+    memset(&t, 0, sizeof(t));
+    for (a = 0; a < 256; ++a)
+	if (VSET_HAS(sa, a))
+	    for (b = 0; b < 256; ++b)
+		if (VSET_HAS(sb, b)) {
+		    switch (op) {
+			case '&': v = a & b; break;
+			case '^': v = a ^ b; break;
+			case '+': v = a + b; break;
+			default:  v = a - b;
+		    }
+		    VSET_ADD(&t, v & 0xff);
+		}
+    *r = t;
+}
+
+/* the RAM cells an operand addresses, updates IX / IY as the indirect modes do */
+static void cells(vstate_t *s, unsigned dat, vset_t *c)
+{
+    vset_t *idx;
+
+    if (dat < ISA_IND) {
+	vset_one(c, dat);
+	return;
+    }
+
+    idx = (dat & 1) ? &s->iy : &s->ix;
+
+    switch (dat & 6) {
+	case 2:			/* (IX), (IY) */
+	    *c = *idx;
+	    break;
+	case 4:			/* (IX)+, (IY)+ */
+	    *c = *idx;
+	    vset_add_const(idx, 1);
+	    break;
+	default:		/* -(IX), -(IY) */
+	    vset_add_const(idx, 0xff);
+	    *c = *idx;
+    }
+}
+
+static void load(vstate_t *s, unsigned dat, vset_t *v)
+{
+    vset_t c;
+    unsigned i;
+
+    cells(s, dat, &c);
+    memset(v, 0, sizeof(*v));
+    for (i = 0; i < RAM_SIZE; ++i)
+	if (VSET_HAS(&c, i))
+	    vset_join(v, &s->ram[i]);
+}
+
+/* a single cell is overwritten, of several any may be */
+static void store(vstate_t *s, unsigned dat, const vset_t *v)
+{
+    vset_t c;
+    unsigned i;
+
+    cells(s, dat, &c);
+    if (vset_count(&c) == 1) {
+	for (i = 0; !VSET_HAS(&c, i); ++i)
+	    ;
+	s->ram[i] = *v;
+	return;
+    }
+
+    for (i = 0; i < RAM_SIZE; ++i)
+	if (VSET_HAS(&c, i))
+	    vset_join(&s->ram[i], v);
+}
+
+/* runs the instruction on the state, the value read is left in v */
+static void step(vstate_t *s, unsigned w, vset_t *v)
+{
+    const insn_t *i = &cfg_insn[w];
+    vset_t imm;
+
+    vset_one(&imm, i->dat);
+
+    switch (i->op) {
+	case OP_ANA:
+	    load(s, i->dat, v);
+	    s->x = *v;
+	    vset_op(&s->acc, &s->acc, v, '&');
+	    break;
+	case OP_ANI:
+	    vset_op(&s->acc, &s->acc, &imm, '&');
+	    break;
+	case OP_XRA:
+	    load(s, i->dat, v);
+	    s->x = *v;
+	    vset_op(&s->acc, &s->acc, v, '^');
+	    break;
+	case OP_XRI:
+	    vset_op(&s->acc, &s->acc, &imm, '^');
+	    break;
+	case OP_ADA:
+	    load(s, i->dat, v);
+	    s->x = *v;
+	    vset_op(&s->acc, &s->acc, v, '+');
+	    break;
+	case OP_ADI:
+	    vset_op(&s->acc, &s->acc, &imm, '+');
+	    break;
+	case OP_SBA:
+	    load(s, i->dat, v);
+	    s->x = *v;
+	    vset_op(&s->acc, &s->acc, v, '-');
+	    break;
+	case OP_JPR:
+	    load(s, i->dat, v);
+	    s->x = *v;
+	    break;
+	case OP_LDA:
+	    load(s, i->dat, v);
+	    s->x = s->acc = *v;
+	    break;
+	case OP_LDI:
+	    s->acc = imm;
+	    break;
+	case OP_STA:
+	    if (i->dat == REG_IX)
+		s->ix = s->acc;
+	    else if (i->dat == REG_IY)
+		s->iy = s->acc;
+	    store(s, i->dat, &s->acc);
+	    break;
+	case OP_STX:
+	    store(s, i->dat, &s->x);
+	    break;
+	default:		/* "CPI" and the branches only change the flags and PC */
+	    break;
+    }
+}
+
+static int state_join(vstate_t *d, const vstate_t *s)
+{
+    const vset_t *p = &s->acc;
+    vset_t *q = &d->acc;
+    unsigned i;
+    int changed = 0;
+
+    for (i = 0; i < sizeof(*s) / sizeof(vset_t); ++i)
+	changed |= vset_join(&q[i], &p[i]);
+
+    return changed;
+}
+
+/* the successors of the instruction at a, given the value it read */
+static void successors(cfg_t *cfg, unsigned a, unsigned w, const vset_t *v, vset_t *succ)
+{
+    const insn_t *i = &cfg_insn[w];
+
+    memset(succ, 0, sizeof(*succ));
+    switch (i->flow) {
+	case FLOW_BRANCH:
+	    VSET_ADD(succ, i->dat);
+	    /* fall through */
+	case FLOW_NEXT:
+	    VSET_ADD(succ, (a + 1) & 0xff);
+	    break;
+	case FLOW_JUMP:
+	    if (i->dat != a)
+		VSET_ADD(succ, i->dat);
+	    break;
+	case FLOW_JPR:
+	    cfg->target[a] = *v;
+	    if (!vset_full(v))
+		*succ = *v;
+	    break;
+    }
+}
+
+int cfg_build(cfg_t *cfg, const unsigned short *rom, const unsigned char *ram)
+{
+    vstate_t *in = malloc(ROM_SIZE * sizeof(*in)), s;
+    unsigned char queue[ROM_SIZE];
+    vset_t queued, succ, v;
+    unsigned head = 0, tail = 0, a, t, w, n;
+
+    if (in == NULL)
+	return -1;
+
+    memset(cfg, 0, sizeof(*cfg));
+    memset(&queued, 0, sizeof(queued));
+
+    /* the state after ucpu_reset() */
+    memset(&s, 0, sizeof(s));
+    vset_one(&s.acc, 0);
+    s.x = s.ix = s.iy = s.acc;
+    for (a = 0; a < RAM_SIZE; ++a)
+	if (ram != NULL)
+	    vset_one(&s.ram[a], ram[a]);
+	else
+	    vset_fill(&s.ram[a]);
+
+    in[0] = s;
+    VSET_ADD(&cfg->reachable, 0);
+    VSET_ADD(&queued, 0);
+    queue[tail++ % ROM_SIZE] = 0;
+
+    while (head != tail) {
+	a = queue[head++ % ROM_SIZE];
+	queued.w[a >> 6] &= ~((uint64_t) 1 << (a & 63));
+
+	s = in[a];
+	w = rom[a] & 0xfff;
+	memset(&v, 0, sizeof(v));
+	step(&s, w, &v);
+	successors(cfg, a, w, &v, &succ);
+
+	for (t = 0; t < ROM_SIZE; ++t) {
+	    if (!VSET_HAS(&succ, t))
+		continue;
+	    if (!VSET_HAS(&cfg->reachable, t)) {
+		in[t] = s;
+		VSET_ADD(&cfg->reachable, t);
+	    } else if (!state_join(&in[t], &s))
+		continue;
+	    if (!VSET_HAS(&queued, t)) {
+		VSET_ADD(&queued, t);
+		queue[tail++ % ROM_SIZE] = t;
+	    }
+	}
+    }
+
+    free(in);
+
+    /* the blocks start at reset and at every place control is passed to */
+    VSET_ADD(&cfg->leader, 0);
+    for (a = 0; a < ROM_SIZE; ++a) {
+	const insn_t *i = &cfg_insn[rom[a] & 0xfff];
+
+	if (i->flow == FLOW_BRANCH || i->flow == FLOW_JUMP)
+	    VSET_ADD(&cfg->label, i->dat);
+	if (!VSET_HAS(&cfg->reachable, a) || i->flow == FLOW_NEXT)
+	    continue;
+	if (i->flow == FLOW_JPR) {
+	    /* an unbounded one would make every instruction a block */
+	    if (!vset_full(&cfg->target[a]))
+		vset_join(&cfg->leader, &cfg->target[a]);
+	} else
+	    VSET_ADD(&cfg->leader, i->dat);
+	if (VSET_HAS(&cfg->reachable, (a + 1) & 0xff))
+	    VSET_ADD(&cfg->leader, (a + 1) & 0xff);
+    }
+
+    for (a = 0, n = 0; a < ROM_SIZE; ++a) {
+	cfg_block_t *b;
+	const insn_t *i;
+
+	if (!VSET_HAS(&cfg->reachable, a))
+	    continue;
+	if (VSET_HAS(&cfg->leader, a))
+	    cfg->block[n++].first = a;
+	b = &cfg->block[n - 1];
+	b->last = a;
+	cfg->block_of[a] = n - 1;
+
+	i = &cfg_insn[rom[a] & 0xfff];
+	memset(&b->succ, 0, sizeof(b->succ));
+	b->flags = 0;
+	if (i->flow == FLOW_JUMP && i->dat == a)
+	    b->flags |= B_HALT;
+	else if (i->flow == FLOW_JPR && vset_full(&cfg->target[a]))
+	    b->flags |= B_UNBOUNDED;
+	successors(cfg, a, rom[a] & 0xfff, &cfg->target[a], &b->succ);
+    }
+    cfg->blocks = n;
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Control flow graph recovery for uCPU ROM images.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * The code reachable from reset is found by an abstract interpretation
+ * of the ROM over value sets: Acc, X, IX, IY and every RAM cell hold a
+ * set of the 256 byte values they may have. "JPR" jumps to any value of
+ * its RAM operand, so its targets are those of the set, e.g. the return
+ * addresses stored by the callers of a subroutine. A "JPR" whose operand
+ * may be anything (the RAM is not initialized, or the value is computed
+ * beyond tracking) is marked unbounded and has no successors.
+ *
+ * The branches are taken both ways, the flags are not tracked.
+ */
+
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdint.h>
+
+#include "ucpu.h"
+
+/* a set of byte values or addresses */
+typedef struct {
+    uint64_t w[4];
+} vset_t;
+
+#define VSET_HAS(s, v) ((s)->w[(v) >> 6] >> ((v) & 63) & 1)
+#define VSET_ADD(s, v) ((s)->w[(v) >> 6] |= (uint64_t) 1 << ((v) & 63))
+
+unsigned vset_count(const vset_t *s);
+
+/* how an instruction passes control */
+enum {FLOW_NEXT, FLOW_BRANCH, FLOW_JUMP, FLOW_JPR};
+
+/* a decoded instruction word */
+typedef struct {
+    unsigned char op, dat, flow;
+    char text[10];		/* mnemonic and operand, a label operand is not included */
+} insn_t;
+
+/* every 12 bit instruction word, filled before main() */
+extern insn_t cfg_insn[1 << 12];
+
+/* block flags */
+#define B_HALT      0x01	/* ends with a "JMP" to itself */
+#define B_UNBOUNDED 0x02	/* ends with a "JPR" of unknown targets */
+
+typedef struct {
+    unsigned char first, last;	/* addresses of the first and the last instruction */
+    unsigned char flags;
+    vset_t succ;		/* first addresses of the successors */
+} cfg_block_t;
+
+typedef struct {
+    vset_t reachable;		/* addresses of the code reachable from reset */
+    vset_t leader;		/* first addresses of the blocks */
+    vset_t label;		/* operands of "BNC", "BNZ", "JMP" anywhere in the ROM */
+    vset_t target[ROM_SIZE];	/* targets of the "JPR" at an address */
+    unsigned blocks;
+    cfg_block_t block[ROM_SIZE];	/* in the order of the addresses */
+    unsigned char block_of[ROM_SIZE];	/* block of a reachable address */
+} cfg_t;
+
+/*
+ * Builds the graph of the ROM. ram is the initial RAM image, NULL if its
+ * contents are unknown. Returns 0 or -1 if out of memory.
+ */
+int cfg_build(cfg_t *cfg, const unsigned short *rom, const unsigned char *ram);
+
+#endif
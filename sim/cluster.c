@@ -0,0 +1,316 @@
+/*
+ * Clusters of uCPU cores sharing RAM.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cluster.h"
+#include "replay.h"
+
+static int push(cl_stores_t *l, const cl_store_t *s)
+{
+    cl_store_t *n;
+
+    if (l->len == l->size) {
+	l->size = l->size ? 2 * l->size : 256;
+	if ((n = realloc(l->s, l->size * sizeof(*n))) == NULL)
+	    return -1;
+	l->s = n;
+    }
+    l->s[l->len++] = *s;
+
+    return 0;
+}
+
+int cluster_init(cluster_t *cl, ucpu_t *core, unsigned cores, unsigned latency,
+		 unsigned shared_lo, unsigned long max_cycles)
+{
+    unsigned i;
+
+    memset(cl, 0, sizeof(*cl));
+    cl->cores = cores;
+    cl->core = core;
+    cl->latency = latency ? latency : 1;
+    cl->shared_lo = shared_lo < REG_IX ? shared_lo : REG_IX;
+    cl->max_cycles = max_cycles;
+    cl->issued = calloc(cores, sizeof(*cl->issued));
+    cl->replay = calloc(cores, sizeof(*cl->replay));
+    if (cl->issued == NULL || cl->replay == NULL) {
+	free(cl->issued);
+	free(cl->replay);
+	return -1;
+    }
+
+    memcpy(cl->shared, core[0].ram, sizeof(cl->shared));
+    for (i = 0; i < cores; ++i)
+	memcpy(core[i].ram + cl->shared_lo, cl->shared + cl->shared_lo,
+	       REG_IX - cl->shared_lo);
+
+    return 0;
+}
+
+void cluster_free(cluster_t *cl)
+{
+    unsigned i;
+
+    for (i = 0; i < cl->cores; ++i)
+	free(cl->issued[i].s);
+    free(cl->issued);
+    free(cl->replay);
+    free(cl->pending.s);
+}
+
+static int running(const cluster_t *cl, const ucpu_t *cpu)
+{
+    return cpu->cycles < cl->max_cycles && !ucpu_halted(cpu);
+}
+
+int cluster_store_addr(const ucpu_t *cpu, unsigned shared_lo)
+{
+    unsigned op = cpu->rom[cpu->pc] >> 8 & 0xf, addr;
+
+    if (op != OP_STA && op != OP_STX)
+	return -1;
+
+    /* the RAM address, before the autoincrement */
+    addr = ucpu_addr(cpu, cpu->rom[cpu->pc] & 0xff);
+
+    return addr >= shared_lo && addr < REG_IX ? (int) addr : -1;
+}
+
+/*
+ * Executes the instruction of core i, a store to the shared memory is
+ * taken back from its copy and put in *out.
+ */
+static int step(cluster_t *cl, unsigned i, cl_stores_t *out)
+{
+    ucpu_t *cpu = &cl->core[i];
+    int addr = cluster_store_addr(cpu, cl->shared_lo);
+    unsigned old;
+    cl_store_t s;
+
+    if (addr < 0) {
+	ucpu_step(cpu);
+	return 0;
+    }
+
+    old = cpu->ram[addr];
+    s.time = cpu->cycles + cl->latency;
+    ucpu_step(cpu);
+    s.core = i;
+    s.addr = addr;
+    s.data = cpu->ram[addr];
+    cpu->ram[addr] = old;
+
+    return push(out, &s);
+}
+
+/* the store in the copy of core i, logged if it changes it */
+static void see(cluster_t *cl, unsigned i, const cl_store_t *s)
+{
+    ucpu_t *cpu = &cl->core[i];
+
+    if (cpu->ram[s->addr] == s->data)
+	return;
+    if (cl->replay[i] != NULL)
+	replay_put(cl->replay[i], s->time, s->addr, s->data);
+    cpu->ram[s->addr] = s->data;
+}
+
+/* the store in the shared memory and the copies */
+static void take_effect(cluster_t *cl, const cl_store_t *s)
+{
+    unsigned i;
+
+    cl->shared[s->addr] = s->data;
+    for (i = 0; i < cl->cores; ++i)
+	see(cl, i, s);
+}
+
+int cluster_run_serial(cluster_t *cl)
+{
+    cl_stores_t *q = &cl->pending;	/* in the order they take effect */
+    size_t head = 0;
+    unsigned long t;
+    unsigned i;
+    int any;
+
+    for (t = 0;; ++t) {
+	for (; head < q->len && q->s[head].time <= t; ++head)
+	    take_effect(cl, &q->s[head]);
+
+	for (i = 0, any = 0; i < cl->cores; ++i)
+	    if (running(cl, &cl->core[i])) {
+		any = 1;
+		if (step(cl, i, q) != 0)
+		    return -1;
+	    }
+	if (!any)
+	    break;
+    }
+
+    for (; head < q->len; ++head)
+	take_effect(cl, &q->s[head]);
+    cl->stores = q->len;
+    cl->windows = 0;
+    q->len = 0;
+
+    return 0;
+}
+
+/* the parallel run */
+
+typedef struct {
+    cluster_t *cl;
+    unsigned id, threads;
+    pthread_mutex_t *gate;	/* held until all are started */
+    pthread_barrier_t *barrier;
+    unsigned long *end;		/* of the window, 0 when done */
+    int *error;
+} worker_t;
+
+/* core i to the end of the window, its copy seeing the pending stores */
+static int run_window(cluster_t *cl, unsigned i, unsigned long end)
+{
+    ucpu_t *cpu = &cl->core[i];
+    const cl_store_t *p = cl->pending.s, *pe = p + cl->pending.len;
+
+    while (cpu->cycles < end && !ucpu_halted(cpu)) {
+	for (; p < pe && p->time <= cpu->cycles; ++p)
+	    see(cl, i, p);
+	if (step(cl, i, &cl->issued[i]) != 0)
+	    return -1;
+    }
+    for (; p < pe; ++p)
+	see(cl, i, p);
+
+    return 0;
+}
+
+static int store_cmp(const void *a, const void *b)
+{
+    const cl_store_t *x = a, *y = b;
+
+    if (x->time != y->time)
+	return x->time < y->time ? -1 : 1;
+
+    return x->core < y->core ? -1 : x->core > y->core;
+}
+
+/* the pending stores in effect, the issued ones pending, *end = 0 if the run is over */
+static int next_window(cluster_t *cl, unsigned long *end)
+{
+    cl_stores_t *q = &cl->pending;
+    unsigned i;
+    size_t j;
+    int any = 0;
+
+    for (j = 0; j < q->len; ++j)
+	cl->shared[q->s[j].addr] = q->s[j].data;
+    cl->stores += q->len;
+    q->len = 0;
+
+    for (i = 0; i < cl->cores; ++i) {
+	for (j = 0; j < cl->issued[i].len; ++j)
+	    if (push(q, &cl->issued[i].s[j]) != 0)
+		return -1;
+	cl->issued[i].len = 0;
+	any |= running(cl, &cl->core[i]);
+    }
+    qsort(q->s, q->len, sizeof(*q->s), store_cmp);
+
+    if (!any) {
+	for (j = 0; j < q->len; ++j)
+	    take_effect(cl, &q->s[j]);
+	cl->stores += q->len;
+	q->len = 0;
+	*end = 0;
+	return 0;
+    }
+
+    ++cl->windows;
+    *end = *end + cl->latency < cl->max_cycles ? *end + cl->latency : cl->max_cycles;
+
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    cluster_t *cl = w->cl;
+    unsigned i;
+
+    pthread_mutex_lock(w->gate);
+    pthread_mutex_unlock(w->gate);
+
+    while (*w->end != 0) {
+	for (i = w->id; i < cl->cores; i += w->threads)
+	    if (run_window(cl, i, *w->end) != 0)
+		*w->error = 1;
+	pthread_barrier_wait(w->barrier);
+	if (w->id == 0 && (*w->error || next_window(cl, w->end) != 0)) {
+	    *w->error = 1;
+	    *w->end = 0;
+	}
+	pthread_barrier_wait(w->barrier);
+    }
+
+    return NULL;
+}
+
+int cluster_run(cluster_t *cl, unsigned threads)
+{
+    pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+    pthread_barrier_t barrier;
+    pthread_t *tid;
+    worker_t *w;
+    unsigned long end = 0;
+    unsigned i, started;
+    int error = 0;
+
+    threads = threads == 0 ? 1 : threads > cl->cores ? cl->cores : threads;
+
+    /* the first window */
+    cl->windows = cl->stores = 0;
+    if (next_window(cl, &end) != 0)
+	return -1;
+    if (end == 0)
+	return 0;
+
+    tid = malloc(threads * sizeof(*tid));
+    w = malloc(threads * sizeof(*w));
+    if (tid == NULL || w == NULL) {
+	free(tid);
+	free(w);
+	return -1;
+    }
+
+    /* the threads that could be started share the cores */
+    pthread_mutex_lock(&gate);
+    for (started = 0; started < threads; ++started) {
+	w[started].cl = cl;
+	w[started].id = started;
+	w[started].gate = &gate;
+	w[started].barrier = &barrier;
+	w[started].end = &end;
+	w[started].error = &error;
+	if (started > 0 && pthread_create(&tid[started], NULL, worker, &w[started]) != 0)
+	    break;
+    }
+    for (i = 0; i < started; ++i)
+	w[i].threads = started;
+    pthread_barrier_init(&barrier, NULL, started);
+    pthread_mutex_unlock(&gate);
+
+    worker(&w[0]);
+    for (i = 1; i < started; ++i)
+	pthread_join(tid[i], NULL);
+    pthread_barrier_destroy(&barrier);
+    free(tid);
+    free(w);
+
+    return error ? -1 : 0;
+}
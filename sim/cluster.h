@@ -0,0 +1,79 @@
+/*
+ * Clusters of uCPU cores sharing RAM.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Every core has its ROM and RAM, except the RAM cells from shared_lo up
+ * to F7 (below IX / IY), which are one memory of the cluster behind an
+ * interconnect of latency cycles: a store there at cycle t takes effect
+ * for every core, the storing one too, at cycle t + latency, stores
+ * taking effect in the same cycle in the order of the cores. A core reads
+ * its copy of the shared cells, kept up to date with the stores taking
+ * effect, so all cores see the same shared memory in a cycle, and a
+ * mailbox is a shared cell one core stores to and another polls. The
+ * cores run in lock step, one instruction a cycle, to a halt or the
+ * cycle limit.
+ *
+ * cluster_run_serial() steps the cores cycle by cycle. cluster_run() is
+ * a conservative parallel simulation of the same: a store issued in a
+ * cycle of a window of latency cycles takes effect after the window, so
+ * the cores run a window each on its own thread without seeing each
+ * other, and synchronize at its end, where the stores issued in it are
+ * ordered by cycle and core to take effect in the next window. The
+ * result is the same whatever the threads.
+ */
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+
+#include "ucpu.h"
+#include "replay.h"
+
+/* a store to the shared memory, by the cycle it takes effect */
+typedef struct {
+    unsigned long time;
+    unsigned core;
+    unsigned char addr, data;
+} cl_store_t;
+
+typedef struct {
+    cl_store_t *s;
+    size_t len, size;
+} cl_stores_t;
+
+typedef struct {
+    unsigned cores;
+    ucpu_t *core;
+    unsigned latency;		/* 1 or more */
+    unsigned shared_lo;		/* the first shared cell */
+    unsigned long max_cycles;
+    unsigned char shared[RAM_SIZE];	/* with the stores in effect */
+    unsigned long stores, windows;
+
+    cl_stores_t pending;	/* taking effect in the window */
+    cl_stores_t *issued;	/* in the window, per core */
+    replay_t **replay;		/* per core, the log of its inputs or NULL */
+} cluster_t;
+
+/*
+ * The cluster of the cores, loaded and reset; the shared memory starts as
+ * the RAM of core 0 has it. Returns 0 or -1 if out of memory. The inputs
+ * of core i are recorded if cl->replay[i] is set to a log (see replay.h)
+ * created with its RAM after this.
+ */
+int cluster_init(cluster_t *cl, ucpu_t *core, unsigned cores, unsigned latency,
+		 unsigned shared_lo, unsigned long max_cycles);
+void cluster_free(cluster_t *cl);
+
+/*
+ * Run the cluster to the end, then every store issued is in cl->shared
+ * and in the copies of the cores. Return 0 or -1 if out of memory.
+ */
+int cluster_run_serial(cluster_t *cl);
+int cluster_run(cluster_t *cl, unsigned threads);
+
+/* the shared cell, from shared_lo on, the instruction at PC stores to, or -1 */
+int cluster_store_addr(const ucpu_t *cpu, unsigned shared_lo);
+
+#endif
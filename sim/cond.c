@@ -0,0 +1,99 @@
+/*
+ * Conditions on the state of uCPU.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cond.h"
+
+const char *cond_parse(cond_t *c, const char *text)
+{
+    static const char *const lhs[] = {"pc", "acc", "ix", "iy", "x", "cf", "zf"};
+    static const char *const op[] = {"==", "!=", "<", "<=", ">", ">="};
+    const char *p = text;
+    char *end;
+    unsigned i, len = 0;
+
+    if (*p == '[') {
+	c->lhs = COND_RAM;
+	c->cell = strtoul(p + 1, &end, 16);
+	if (*end != ']' || c->cell >= RAM_SIZE)
+	    return NULL;
+	p = end + 1;
+    } else {
+	for (i = 0; i < COND_RAM; ++i) {
+	    len = strlen(lhs[i]);
+	    if (strncmp(p, lhs[i], len) == 0 && strchr("=!<>", p[len]) != NULL)
+		break;
+	}
+	if (i == COND_RAM)
+	    return NULL;
+	c->lhs = i;
+	p += len;
+    }
+
+    /* the longest operator matching */
+    for (i = COND_GE + 1; i-- > 0;)
+	if (strncmp(p, op[i], strlen(op[i])) == 0 && (strlen(op[i]) == 2 || p[1] != '='))
+	    break;
+    if (i > COND_GE)
+	return NULL;
+    c->op = i;
+    p += strlen(op[i]);
+    c->value = strtoul(p, &end, 16);
+    if (end == p)
+	return NULL;
+
+    return end;
+}
+
+int cond_holds(const cond_t *c, const ucpu_t *cpu)
+{
+    unsigned v;
+
+    switch (c->lhs) {
+	case COND_TRUE:
+	    return 1;
+	case COND_PC:
+	    v = cpu->pc;
+	    break;
+	case COND_ACC:
+	    v = cpu->acc;
+	    break;
+	case COND_IX:
+	    v = cpu->ix;
+	    break;
+	case COND_IY:
+	    v = cpu->iy;
+	    break;
+	case COND_X:
+	    v = cpu->x;
+	    break;
+	case COND_CF:
+	    v = cpu->cf;
+	    break;
+	case COND_ZF:
+	    v = cpu->zf;
+	    break;
+	default:
+	    v = cpu->ram[c->cell];
+	    break;
+    }
+
+    switch (c->op) {
+	case COND_EQ:
+	    return v == c->value;
+	case COND_NE:
+	    return v != c->value;
+	case COND_LT:
+	    return v < c->value;
+	case COND_LE:
+	    return v <= c->value;
+	case COND_GT:
+	    return v > c->value;
+	default:
+	    return v >= c->value;
+    }
+}
@@ -0,0 +1,30 @@
+/*
+ * Conditions on the state of uCPU, the watches of ucsim and the
+ * assertions of ucmc.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * A condition is <lhs><op><value> in hex, lhs one of pc, acc, ix, iy, x,
+ * cf, zf or [<addr>], a RAM cell, op one of == != < <= > >=.
+ */
+
+#ifndef COND_H
+#define COND_H
+
+#include "ucpu.h"
+
+/* the left hand sides, [addr] is COND_RAM, COND_TRUE always holds */
+enum {COND_PC, COND_ACC, COND_IX, COND_IY, COND_X, COND_CF, COND_ZF, COND_RAM, COND_TRUE};
+
+/* and the operators */
+enum {COND_EQ, COND_NE, COND_LT, COND_LE, COND_GT, COND_GE};
+
+typedef struct {
+    unsigned lhs, cell, op, value;
+} cond_t;
+
+/* parses the condition at text, returns the end of it or NULL if not valid */
+const char *cond_parse(cond_t *c, const char *text);
+
+int cond_holds(const cond_t *c, const ucpu_t *cpu);
+
+#endif
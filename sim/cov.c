@@ -0,0 +1,182 @@
+/*
+ * Functional coverage of uCPU programs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cov.h"
+#include "cfg.h"
+
+#define FILE_SIZE ((1 + COV_WORDS) * sizeof(uint64_t))
+
+/* the instructions latching X: those reading a register operand */
+#define LATCHES_X(op) (ISA_REG_OP(op) && (op) != OP_STA && (op) != OP_STX)
+
+unsigned cov_mode(unsigned ir)
+{
+    unsigned op = ir >> 8 & 0xf, dat = ir & 0xff;
+
+    return COV_MODE + op * COV_MODES + (ISA_REG_OP(op) && dat >= REG_IX ? dat - REG_IX + 1 : 0);
+}
+
+void cov_step(ucpu_t *cpu, cov_t *cov, unsigned *x_src)
+{
+    unsigned pc = cpu->pc, ir = cpu->rom[pc], op = ir >> 8 & 0xf;
+
+    COV_SET(cov, cov_mode(ir));
+    if (op == OP_BNC)
+	COV_SET(cov, COV_BRANCH + 2 * pc + !cpu->cf);
+    else if (op == OP_BNZ)
+	COV_SET(cov, COV_BRANCH + 2 * pc + !cpu->zf);
+    else if (op == OP_STX)
+	COV_SET(cov, COV_STX + *x_src);
+
+    ucpu_step(cpu);
+
+    if (op <= OP_CPI)
+	COV_SET(cov, COV_ZF + 2 * op + cpu->zf);
+    if (op >= OP_ADA && op <= OP_CPI)
+	COV_SET(cov, COV_CF + 2 * (op - OP_ADA) + cpu->cf);
+    if (LATCHES_X(op))
+	*x_src = op >> 1;
+}
+
+halt_t ucpu_run_cov(ucpu_t *cpu, unsigned long max_cycles, cov_t *cov)
+{
+    unsigned x_src = COV_X_NONE;
+
+    while (cpu->cycles < max_cycles) {
+	if (ucpu_halted(cpu))
+	    return HALT_JMP;
+	cov_step(cpu, cov, &x_src);
+    }
+
+    return ucpu_halted(cpu) ? HALT_JMP : HALT_LIMIT;
+}
+
+int cov_merge(const char *name, const cov_t *cov)
+{
+    struct stat st;
+    uint64_t *db;
+    unsigned i;
+    int fd, rc = -1;
+
+    if ((fd = open(name, O_RDWR | O_CREAT, 0666)) < 0)
+	return -1;
+
+    /* a new file is zero filled, racing creators all truncate to the same size */
+    if (fstat(fd, &st) != 0 || (st.st_size == 0 && ftruncate(fd, FILE_SIZE) != 0))
+	goto out;
+    if (st.st_size != 0 && st.st_size != FILE_SIZE) {
+	errno = EINVAL;
+	goto out;
+    }
+
+    db = mmap(NULL, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (db == MAP_FAILED)
+	goto out;
+
+    if ((__atomic_fetch_or(&db[0], COV_MAGIC, __ATOMIC_RELAXED) | COV_MAGIC) == COV_MAGIC) {
+	for (i = 0; i < COV_WORDS; ++i)
+	    if (cov->w[i] != 0)
+		__atomic_fetch_or(&db[1 + i], cov->w[i], __ATOMIC_RELAXED);
+	rc = 0;
+    } else
+	errno = EINVAL;
+
+    munmap(db, FILE_SIZE);
+
+out:
+    close(fd);
+
+    return rc;
+}
+
+int cov_load(const char *name, cov_t *cov)
+{
+    uint64_t w[1 + COV_WORDS];
+    unsigned long long v;
+    unsigned i;
+    FILE *f;
+    int rc = 0;
+
+    if ((f = fopen(name, "rb")) == NULL)
+	return -1;
+
+    if (fread(w, sizeof(w), 1, f) == 1 && w[0] == COV_MAGIC) {
+	for (i = 0; i < COV_WORDS; ++i)
+	    cov->w[i] |= w[1 + i];
+    } else {
+	/* the text of tb/bench.v, a word in hex per line */
+	rewind(f);
+	for (i = 0; i < COV_WORDS && fscanf(f, "%llx", &v) == 1; ++i)
+	    cov->w[i] |= v;
+	if (i != COV_WORDS)
+	    rc = -1;
+    }
+
+    fclose(f);
+
+    return rc;
+}
+
+void cov_goal(cov_t *goal, const unsigned short *rom)
+{
+    static cfg_t cfg;
+    unsigned op, b, a;
+
+    memset(goal, 0, sizeof(*goal));
+
+    for (op = 0; op < ISA_OPCODES; ++op)
+	for (b = 0; b < (ISA_REG_OP(op) ? COV_MODES : 1); ++b)
+	    COV_SET(goal, COV_MODE + op * COV_MODES + b);
+
+    for (b = COV_ZF; b < COV_STX; ++b)
+	COV_SET(goal, b);
+
+    for (op = 0; op < ISA_OPCODES; ++op)
+	if (LATCHES_X(op))
+	    COV_SET(goal, COV_STX + (op >> 1));
+    COV_SET(goal, COV_STX + COV_X_NONE);
+
+    if (rom == NULL || cfg_build(&cfg, rom, NULL) != 0)
+	return;
+
+    for (a = 0; a < ROM_SIZE; ++a)
+	if (VSET_HAS(&cfg.reachable, a) && cfg_insn[rom[a] & 0xfff].flow == FLOW_BRANCH) {
+	    COV_SET(goal, COV_BRANCH + 2 * a);
+	    COV_SET(goal, COV_BRANCH + 2 * a + 1);
+	}
+}
+
+const char *cov_bin_name(unsigned bin, char *buf, unsigned size)
+{
+    static const char *const mode[COV_MODES] = {"", "%IX", "%IY", "@IX", "@IY", "@IX+", "@IY+", "@-IX", "@-IY"};
+    static const char *const x_src[8] = {"ANA", "XRA", "ADA", "SBA", "", "JPR", "LDA", "reset"};
+    const insn_t *i;
+
+    if (bin < COV_ZF) {
+	i = &cfg_insn[(bin / COV_MODES) << 8];
+	snprintf(buf, size, "%.3s %s", i->text, bin % COV_MODES ? mode[bin % COV_MODES] : "direct");
+    } else if (bin < COV_CF) {
+	i = &cfg_insn[((bin - COV_ZF) / 2) << 8];
+	snprintf(buf, size, "%.3s ZF=%u", i->text, (bin - COV_ZF) % 2);
+    } else if (bin < COV_STX) {
+	i = &cfg_insn[(OP_ADA + (bin - COV_CF) / 2) << 8];
+	snprintf(buf, size, "%.3s CF=%u", i->text, (bin - COV_CF) % 2);
+    } else if (bin < COV_BRANCH) {
+	snprintf(buf, size, "STX after %s", x_src[bin - COV_STX]);
+    } else {
+	snprintf(buf, size, "%02X %s", (bin - COV_BRANCH) / 2, (bin - COV_BRANCH) % 2 ? "taken" : "not taken");
+    }
+
+    return buf;
+}
@@ -0,0 +1,77 @@
+/*
+ * Functional coverage of uCPU programs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * A coverage database is a bitmap of COV_BITS bins:
+ *
+ *   COV_MODE   opcode * 9 + mode, the mode is 0 for a direct register, an
+ *              immediate or an address operand and 1 - 8 for the operands
+ *              F8 - FF of the register operand instructions
+ *   COV_ZF     ALU opcode (0 - 7) * 2 + ZF after it
+ *   COV_CF     (ADA, ADI, SBA, CPI) - ADA * 2 + CF after it
+ *   COV_STX    "STX" by the instruction that latched X last, opcode / 2,
+ *              or 7 if none did since reset (X is not reset in the RTL)
+ *   COV_BRANCH ROM address * 2 + taken, for "BNC" and "BNZ"
+ *
+ * Runs add their bins to a database file with cov_merge(): the file is
+ * mapped shared and every word ORed in atomically, so any number of runs
+ * can merge into one database at once without locks. tb/bench.v writes
+ * the same bitmap as text, which uccov merges as well.
+ */
+
+#ifndef COV_H
+#define COV_H
+
+#include <stdint.h>
+
+#include "ucpu.h"
+
+#define COV_MODE   0
+#define COV_ZF     144
+#define COV_CF     160
+#define COV_STX    168
+#define COV_BRANCH 176
+#define COV_BITS   (COV_BRANCH + 2 * ROM_SIZE)
+
+#define COV_WORDS  ((COV_BITS + 63) / 64)
+#define COV_MODES  9
+#define COV_X_NONE 7
+
+/* the first word of a database file */
+#define COV_MAGIC  0x3130564f43435554ULL	/* "TUCCOV01" */
+
+typedef struct {
+    uint64_t w[COV_WORDS];
+} cov_t;
+
+#define COV_HAS(c, b) ((c)->w[(b) >> 6] >> ((b) & 63) & 1)
+#define COV_SET(c, b) ((c)->w[(b) >> 6] |= (uint64_t) 1 << ((b) & 63))
+
+/* COV_MODE bin of an instruction word */
+unsigned cov_mode(unsigned ir);
+
+/*
+ * ucpu_step() recording the bins of the instruction, x_src is the
+ * instruction that latched X last as in COV_STX, COV_X_NONE after reset
+ */
+void cov_step(ucpu_t *cpu, cov_t *cov, unsigned *x_src);
+
+/* ucpu_run() recording the bins of every instruction executed */
+halt_t ucpu_run_cov(ucpu_t *cpu, unsigned long max_cycles, cov_t *cov);
+
+/* ORs cov into the database file, creating it if needed, returns 0 or -1 */
+int cov_merge(const char *name, const cov_t *cov);
+
+/* ORs a database or a bitmap written by tb/bench.v into cov, returns 0 or -1 */
+int cov_load(const char *name, cov_t *cov);
+
+/*
+ * The bins a complete regression hits. With a ROM the branch bins are
+ * those of the reachable branches in it, otherwise there are none.
+ */
+void cov_goal(cov_t *goal, const unsigned short *rom);
+
+/* name of the bin, for the reports */
+const char *cov_bin_name(unsigned bin, char *buf, unsigned size);
+
+#endif
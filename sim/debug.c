@@ -0,0 +1,127 @@
+/*
+ * Breakpoints and watchpoints for the uCPU simulator.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+
+#define WRITES(op) ((op) == OP_STA || (op) == OP_STX)
+#define READS(op)  (ISA_REG_OP(op) && !WRITES(op))
+
+int debug_add(debug_t *dbg, watch_kind_t kind, const char *text)
+{
+    watch_t *w = &dbg->watch[dbg->watches];
+    const char *p;
+    char *end;
+
+    if (dbg->watches == MAX_WATCHES)
+	return -1;
+
+    w->kind = kind;
+    w->text = text;
+    w->addr = strtoul(text, &end, 16);
+    if (end == text || w->addr > 0xff)
+	return -1;
+
+    p = end;
+    w->cond.lhs = COND_TRUE;
+    if (*p == ':' && (p = cond_parse(&w->cond, p + 1)) == NULL)
+	return -1;
+    if (*p != '\0')
+	return -1;
+
+    WATCH_SET(dbg->map[kind], w->addr);
+    ++dbg->watches;
+
+    return 0;
+}
+
+/* the first watch of the kind at the address whose condition holds */
+static const watch_t *check(const debug_t *dbg, watch_kind_t kind, unsigned addr,
+			    const ucpu_t *cpu)
+{
+    const watch_t *w;
+
+    if (!WATCH_HAS(dbg->map[kind], addr))
+	return NULL;
+
+    for (w = dbg->watch; w < dbg->watch + dbg->watches; ++w)
+	if (w->kind == kind && w->addr == addr && cond_holds(&w->cond, cpu))
+	    return w;
+
+    return NULL;
+}
+
+static int any(const uint64_t *map)
+{
+    return (map[0] | map[1] | map[2] | map[3]) != 0;
+}
+
+/* the ROM addresses where a watch may be hit */
+static void hot_map(uint64_t *hot, const debug_t *dbg, const ucpu_t *cpu)
+{
+    int any_read = any(dbg->map[WATCH_READ]), any_write = any(dbg->map[WATCH_WRITE]);
+    unsigned pc, op, dat;
+
+    memcpy(hot, dbg->map[WATCH_PC], 4 * sizeof(*hot));
+
+    for (pc = 0; pc < ROM_SIZE; ++pc) {
+	op = cpu->rom[pc] >> 8 & 0xf;
+	dat = cpu->rom[pc] & 0xff;
+	if (!ISA_REG_OP(op))
+	    continue;
+	if (dat >= ISA_IND ? (READS(op) ? any_read : any_write) :
+	    WATCH_HAS(dbg->map[READS(op) ? WATCH_READ : WATCH_WRITE], dat))
+	    WATCH_SET(hot, pc);
+    }
+}
+
+halt_t ucpu_run_debug(ucpu_t *cpu, const debug_t *dbg, unsigned long max_cycles,
+		      const watch_t **hit)
+{
+    uint64_t hot[4];
+    unsigned op, addr;
+    unsigned long start = cpu->cycles;
+    const watch_t *resume = *hit;
+
+    hot_map(hot, dbg, cpu);
+    *hit = NULL;
+
+    while (cpu->cycles < max_cycles) {
+	if (!WATCH_HAS(hot, cpu->pc)) {
+	    if (ucpu_halted(cpu))
+		return HALT_JMP;
+	    ucpu_step(cpu);
+	    continue;
+	}
+
+	/* the breakpoint stopped at is passed over, a halt may be one */
+	if ((cpu->cycles != start || resume == NULL || resume->kind != WATCH_PC) &&
+	    (*hit = check(dbg, WATCH_PC, cpu->pc, cpu)) != NULL)
+	    return HALT_WATCH;
+	if (ucpu_halted(cpu))
+	    return HALT_JMP;
+
+	/* the RAM address, before the autoincrement */
+	op = cpu->rom[cpu->pc] >> 8 & 0xf;
+	addr = ucpu_addr(cpu, cpu->rom[cpu->pc] & 0xff);
+
+	ucpu_step(cpu);
+
+	if (ISA_REG_OP(op) &&
+	    (*hit = check(dbg, READS(op) ? WATCH_READ : WATCH_WRITE, addr, cpu)) != NULL)
+	    return HALT_WATCH;
+    }
+
+    return ucpu_halted(cpu) ? HALT_JMP : HALT_LIMIT;
+}
+
+const char *watch_kind_name(watch_kind_t kind)
+{
+    static const char *name[] = {"break", "read", "write"};
+
+    return name[kind];
+}
@@ -0,0 +1,62 @@
+/*
+ * Breakpoints and watchpoints for the uCPU simulator.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * A watch stops a run at a ROM address (WATCH_PC, before the instruction
+ * there executes) or after an instruction reading (WATCH_READ) or writing
+ * (WATCH_WRITE) a RAM cell, if its condition on the state then holds.
+ * The watched addresses are a 256 bit map per address space. From them
+ * ucpu_run_debug() marks the ROM addresses whose instruction may hit a
+ * watch, a direct operand by its address, an indirect one if any RAM
+ * watch of its direction is set, so its loop tests a single bit per
+ * instruction and decodes the rest only where it is set. A run without
+ * watches is ucpu_run(), which tests nothing.
+ */
+
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+
+#include "ucpu.h"
+#include "cond.h"
+
+typedef enum {WATCH_PC, WATCH_READ, WATCH_WRITE, WATCH_KINDS} watch_kind_t;
+
+typedef struct {
+    watch_kind_t kind;
+    unsigned addr;
+    cond_t cond;
+    const char *text;
+} watch_t;
+
+#define MAX_WATCHES 64
+
+typedef struct {
+    uint64_t map[WATCH_KINDS][4];
+    watch_t watch[MAX_WATCHES];
+    unsigned watches;
+} debug_t;
+
+#define WATCH_HAS(m, a) ((m)[(a) >> 6] >> ((a) & 63) & 1)
+#define WATCH_SET(m, a) ((m)[(a) >> 6] |= (uint64_t) 1 << ((a) & 63))
+
+/*
+ * Adds a watch given as <addr>[:<condition>] in hex, see cond.h.
+ * Returns 0 or -1 if the text is not valid or there are too many.
+ */
+int debug_add(debug_t *dbg, watch_kind_t kind, const char *text);
+
+/*
+ * ucpu_run() stopping with HALT_WATCH at the first watch hit, which is
+ * stored in *hit, NULL if none. A breakpoint stops the run before the
+ * instruction, at the start PC and at a halt, too. *hit is NULL for a new
+ * run; a stopped one is continued by calling it again with the watch hit
+ * in *hit, a breakpoint at the PC it stopped at is then passed over.
+ */
+halt_t ucpu_run_debug(ucpu_t *cpu, const debug_t *dbg, unsigned long max_cycles,
+		      const watch_t **hit);
+
+const char *watch_kind_name(watch_kind_t kind);
+
+#endif
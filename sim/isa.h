@@ -0,0 +1,86 @@
+/*
+ * Instruction set of uCPU, the one description of it.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * ISA_INSNS(X) calls X(name, c0, c1, c2, opcode, operand) for every
+ * instruction in the order of the opcodes: the name used by the simulator
+ * (OP_<name>, the handler kinds), the three characters of the assembler
+ * mnemonic, the opcode and the operand class, one of REG (a RAM address,
+ * %IX / %IY or an indirect mode), IMM (a constant) or LAB (an address).
+ * ISA_DIRECTIVES(X) are the assembler directives in the same form, and
+ * ISA_REGS(X) calls X(name, text, code) for the operands with names.
+ *
+ * The opcodes, the token table and the mnemonic hash of the assembler,
+ * and the handler kinds and dispatch table of the threaded interpreter
+ * are expanded from these lists by the preprocessor, so an instruction
+ * is added here and in the handlers of the simulators only. The RTL has
+ * a decoder of its own.
+ */
+
+#ifndef ISA_H
+#define ISA_H
+
+#define ISA_INSNS(X) \
+    X(ANA, 'A', 'N', 'A', 0x0, REG) \
+    X(ANI, 'A', 'N', 'I', 0x1, IMM) \
+    X(XRA, 'X', 'R', 'A', 0x2, REG) \
+    X(XRI, 'X', 'R', 'I', 0x3, IMM) \
+    X(ADA, 'A', 'D', 'A', 0x4, REG) \
+    X(ADI, 'A', 'D', 'I', 0x5, IMM) \
+    X(SBA, 'S', 'B', 'A', 0x6, REG) \
+    X(CPI, 'S', 'B', 'I', 0x7, IMM)	/* Acc is not written */ \
+    X(BNC, 'B', 'N', 'C', 0x8, LAB) \
+    X(BNZ, 'B', 'N', 'Z', 0x9, LAB) \
+    X(JPR, 'J', 'P', 'R', 0xA, REG) \
+    X(JMP, 'J', 'M', 'P', 0xB, LAB) \
+    X(LDA, 'L', 'D', 'A', 0xC, REG) \
+    X(LDI, 'L', 'D', 'I', 0xD, IMM) \
+    X(STA, 'S', 'T', 'A', 0xE, REG) \
+    X(STX, 'S', 'T', 'X', 0xF, REG)
+
+#define ISA_DIRECTIVES(X) \
+    X(ORG, 'O', 'R', 'G', 0x10, IMM)
+
+#define ISA_REGS(X) \
+    X(IX,     "%IX",  0xf8) \
+    X(IY,     "%IY",  0xf9) \
+    X(AT_IX,  "@IX",  0xfa) \
+    X(AT_IY,  "@IY",  0xfb) \
+    X(IX_INC, "@IX+", 0xfc) \
+    X(IY_INC, "@IY+", 0xfd) \
+    X(DEC_IX, "@-IX", 0xfe) \
+    X(DEC_IY, "@-IY", 0xff)
+
+#define ISA_OPCODES 16
+
+/* first operand of the indirect modes */
+#define ISA_IND 0xfa
+
+/* ISA_IF(want, operand, ...) expands to ... if the operand class is want */
+#define ISA_IF(want, operand, ...) ISA_IF_##want##_##operand(__VA_ARGS__)
+#define ISA_IF_REG_REG(...) __VA_ARGS__
+#define ISA_IF_REG_IMM(...)
+#define ISA_IF_REG_LAB(...)
+#define ISA_IF_IMM_REG(...)
+#define ISA_IF_IMM_IMM(...) __VA_ARGS__
+#define ISA_IF_IMM_LAB(...)
+#define ISA_IF_LAB_REG(...)
+#define ISA_IF_LAB_IMM(...)
+#define ISA_IF_LAB_LAB(...) __VA_ARGS__
+
+/* ISA_REG_OP(op) is true if the operand class of opcode op is REG */
+#define ISA_REG_BIT(name, c0, c1, c2, opcode, operand) ISA_IF(REG, operand, | 1 << (opcode))
+#define ISA_REG_OP(op) ((0 ISA_INSNS(ISA_REG_BIT)) >> (op) & 1)
+
+/* ISA_COUNT(list) is the length of the list */
+#define ISA_ONE(...) 1 +
+#define ISA_COUNT(list) (list(ISA_ONE) 0)
+
+/*
+ * A perfect hash of the mnemonics into 32 slots. Checked by the compiler:
+ * the assembler switches on it with a case per mnemonic, a collision is a
+ * duplicate case value.
+ */
+#define ISA_HASH(c0, c1, c2) (((c0) * 3 + (c1) * 9 + (c2)) & 31)
+
+#endif
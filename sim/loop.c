@@ -0,0 +1,497 @@
+/*
+ * Loop summarization for the uCPU simulator.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * ucpu_run_loops() is ucpu_run() skipping the iterations of simple loops:
+ * a straight line body closed by a "BNZ" back to its first instruction.
+ * When the branch is taken the body is executed symbolically with every
+ * value an affine function b + s * i of the iteration i, the steps s of
+ * the registers and the RAM cells carried from one iteration to the next
+ * found by repeating the execution until they are consistent (the counter
+ * plus a constant, IX / IY walking with the autoincrement modes). The
+ * value ZF is taken from then gives the number of iterations before the
+ * loop exits. All of them but the last are applied at once: the carried
+ * values are advanced, the stores through IX / IY (fills of a constant
+ * or an affine value and copies of the values read) are replayed in order,
+ * as memset() / memcpy() where possible, and the cycles are added; the
+ * last iteration is executed normally and leaves the flags and X exact.
+ *
+ * A loop is executed normally if the body reads a value that is not
+ * affine into anything carried or into ZF, stores it, or accesses the
+ * cells it uses directly through IX / IY.
+ */
+
+#include <string.h>
+
+#include "ucpu.h"
+
+#define MIN_SKIP 2		/* iterations worth summarizing */
+#define PASSES   4		/* to find the steps */
+
+enum {AFF, LOAD, TOP};
+
+typedef struct {
+    unsigned char kind, b, s, k;	/* b + s * i, or the k-th value read */
+} val_t;
+
+/* the registers */
+enum {ACC, IX, IY, X, REGS};
+
+/* a store through IX / IY, or a read whose value is stored */
+typedef struct {
+    unsigned char write, k;
+    val_t addr, v;
+} mem_op_t;
+
+/*
+ * The cells accessed directly are listed in cell_list[] as they are met,
+ * in_cell[] is valid for the cells stamped with the current loop and
+ * cell[] and used[] for those stamped with the current pass.
+ */
+typedef struct {
+    val_t reg[REGS], in_reg[REGS];
+    unsigned char live_reg[REGS], written_reg[REGS];
+    const unsigned char *ram;
+    val_t cell[RAM_SIZE], in_cell[RAM_SIZE];
+    unsigned char used[RAM_SIZE], cell_list[RAM_SIZE];
+    unsigned long in_stamp[RAM_SIZE], stamp[RAM_SIZE], loop, pass;
+    unsigned cells;
+    val_t zf;
+    mem_op_t op[ROM_SIZE * 2];
+    unsigned ops, reads;
+} sym_t;
+
+#define U_READ    1
+#define U_WRITTEN 2
+#define U_LIVE    4		/* read before written */
+
+static val_t aff(unsigned b, unsigned s)
+{
+    val_t v = {AFF, b, s, 0};
+
+    return v;
+}
+
+static val_t top(void)
+{
+    val_t v = {TOP, 0, 0, 0};
+
+    return v;
+}
+
+static val_t alu(unsigned op, val_t a, val_t b)
+{
+    if (a.kind != AFF || b.kind != AFF)
+	return top();
+
+    switch (op >> 1) {
+	case OP_ANA >> 1:
+	    return a.s == 0 && b.s == 0 ? aff(a.b & b.b, 0) : top();
+	case OP_XRA >> 1:
+	    return a.s == 0 && b.s == 0 ? aff(a.b ^ b.b, 0) : top();
+	case OP_ADA >> 1:
+	    return aff(a.b + b.b, a.s + b.s);
+	default:
+	    return aff(a.b - b.b, a.s - b.s);
+    }
+}
+
+static void touch(sym_t *y, unsigned a)
+{
+    if (y->in_stamp[a] != y->loop) {
+	y->in_stamp[a] = y->loop;
+	y->in_cell[a] = aff(y->ram[a], 0);
+	y->cell_list[y->cells++] = a;
+    }
+    if (y->stamp[a] != y->pass) {
+	y->stamp[a] = y->pass;
+	y->cell[a] = y->in_cell[a];
+	y->used[a] = 0;
+    }
+}
+
+/* U_ flags of a cell in the last pass */
+static unsigned used(const sym_t *y, unsigned a)
+{
+    return y->stamp[a] == y->pass ? y->used[a] : 0;
+}
+
+static val_t reg(sym_t *y, unsigned r)
+{
+    if (!y->written_reg[r])
+	y->live_reg[r] = 1;
+
+    return y->reg[r];
+}
+
+static void set_reg(sym_t *y, unsigned r, val_t v)
+{
+    y->written_reg[r] = 1;
+    y->reg[r] = v;
+}
+
+/* the address of a register operand, -1 if not affine */
+static int address(sym_t *y, unsigned dat, val_t *a)
+{
+    unsigned r = dat & 1 ? IY : IX;
+    val_t idx;
+
+    if (dat < ISA_IND) {
+	*a = aff(dat, 0);
+	return 0;
+    }
+
+    idx = reg(y, r);
+    if (idx.kind != AFF)
+	return -1;
+
+    switch (dat & 6) {
+	case 2:			/* (IX), (IY) */
+	    *a = idx;
+	    break;
+	case 4:			/* (IX)+, (IY)+ */
+	    *a = idx;
+	    set_reg(y, r, aff(idx.b + 1, idx.s));
+	    break;
+	default:		/* -(IX), -(IY) */
+	    *a = aff(idx.b - 1, idx.s);
+	    set_reg(y, r, *a);
+	    break;
+    }
+
+    return 0;
+}
+
+static int load(sym_t *y, unsigned dat, val_t *v)
+{
+    val_t a;
+    mem_op_t *m;
+
+    if (address(y, dat, &a) != 0)
+	return -1;
+
+    if (a.s == 0) {
+	touch(y, a.b);
+	if (!(y->used[a.b] & U_WRITTEN))
+	    y->used[a.b] |= U_LIVE;
+	y->used[a.b] |= U_READ;
+	*v = y->cell[a.b];
+	return 0;
+    }
+
+    m = &y->op[y->ops++];
+    m->write = 0;
+    m->k = y->reads;
+    m->addr = a;
+    v->kind = LOAD;
+    v->k = y->reads++;
+
+    return 0;
+}
+
+static int store(sym_t *y, unsigned dat, val_t v)
+{
+    val_t a;
+    mem_op_t *m;
+
+    if (address(y, dat, &a) != 0)
+	return -1;
+
+    if (a.s == 0) {
+	touch(y, a.b);
+	y->used[a.b] |= U_WRITTEN;
+	y->cell[a.b] = v;
+	return 0;
+    }
+
+    if (v.kind == TOP)
+	return -1;
+    m = &y->op[y->ops++];
+    m->write = 1;
+    m->addr = a;
+    m->v = v;
+
+    return 0;
+}
+
+/* one symbolic pass over the body, returns -1 if it cannot be summarized */
+static int body(sym_t *y, const ucpu_t *cpu, unsigned head, unsigned branch, unsigned long pass)
+{
+    unsigned a, r, op, dat;
+    val_t v;
+
+    for (r = 0; r < REGS; ++r) {
+	y->reg[r] = y->in_reg[r];
+	y->live_reg[r] = y->written_reg[r] = 0;
+    }
+    y->pass = pass;
+    y->zf = top();
+    y->ops = y->reads = 0;
+
+    for (a = head; a < branch; ++a) {
+	op = cpu->rom[a] >> 8 & 0xf;
+	dat = cpu->rom[a] & 0xff;
+
+	switch (op) {
+	    case OP_ANA:
+	    case OP_XRA:
+	    case OP_ADA:
+	    case OP_SBA:
+		if (load(y, dat, &v) != 0)
+		    return -1;
+		set_reg(y, X, v);
+		y->zf = alu(op, reg(y, ACC), v);
+		set_reg(y, ACC, y->zf);
+		break;
+	    case OP_ANI:
+	    case OP_XRI:
+	    case OP_ADI:
+		y->zf = alu(op, reg(y, ACC), aff(dat, 0));
+		set_reg(y, ACC, y->zf);
+		break;
+	    case OP_CPI:
+		y->zf = alu(op, reg(y, ACC), aff(dat, 0));
+		break;
+	    case OP_LDA:
+		if (load(y, dat, &v) != 0)
+		    return -1;
+		set_reg(y, X, v);
+		set_reg(y, ACC, v);
+		break;
+	    case OP_LDI:
+		set_reg(y, ACC, aff(dat, 0));
+		break;
+	    case OP_STA:
+		v = reg(y, ACC);
+		if (dat == REG_IX || dat == REG_IY)
+		    set_reg(y, dat == REG_IX ? IX : IY, v);
+		if (store(y, dat, v) != 0)
+		    return -1;
+		break;
+	    case OP_STX:
+		if (store(y, dat, reg(y, X)) != 0)
+		    return -1;
+		break;
+	    default:		/* control flow, see straight() */
+		return -1;
+	}
+    }
+
+    return 0;
+}
+
+/*
+ * Updates the steps of the carried values from the pass, returns 1 if
+ * they are consistent, 0 if another pass is needed, -1 if a carried value
+ * is not affine.
+ */
+static int carried(sym_t *y)
+{
+    unsigned r, i, a;
+    int ok = 1;
+    val_t *in, *out;
+
+    for (r = 0; r < REGS; ++r) {
+	if (!y->live_reg[r] || !y->written_reg[r])
+	    continue;
+	in = &y->in_reg[r];
+	out = &y->reg[r];
+	if (out->kind != AFF)
+	    return -1;
+	if (out->s != in->s || (unsigned char) (out->b - in->b) != in->s) {
+	    in->s = out->b - in->b;
+	    ok = 0;
+	}
+    }
+
+    for (i = 0; i < y->cells; ++i) {
+	a = y->cell_list[i];
+	if ((used(y, a) & (U_LIVE | U_WRITTEN)) != (U_LIVE | U_WRITTEN))
+	    continue;
+	in = &y->in_cell[a];
+	out = &y->cell[a];
+	if (out->kind != AFF)
+	    return -1;
+	if (out->s != in->s || (unsigned char) (out->b - in->b) != in->s) {
+	    in->s = out->b - in->b;
+	    ok = 0;
+	}
+    }
+
+    return ok;
+}
+
+static void mark(unsigned char *set, const val_t *addr, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; ++i)
+	set[(unsigned char) (addr->b + addr->s * i)] = 1;
+}
+
+/* the stores through IX / IY of n iterations */
+static void replay(const sym_t *y, unsigned char *ram, unsigned n)
+{
+    const mem_op_t *m = &y->op[0];
+    unsigned char loaded[ROM_SIZE * 2];
+    unsigned i, j, a, b;
+
+    /* a fill or a copy, forward and not wrapping around */
+    if (y->ops == 1 && m->write && m->v.kind == AFF && m->v.s == 0 && m->addr.s == 1 &&
+	m->addr.b + n <= RAM_SIZE) {
+	memset(&ram[m->addr.b], m->v.b, n);
+	return;
+    }
+    if (y->ops == 2 && !m[0].write && m[1].write && m[1].v.kind == LOAD && m[0].addr.s == 1 &&
+	m[1].addr.s == 1) {
+	a = m[0].addr.b;
+	b = m[1].addr.b;
+	if (a + n <= RAM_SIZE && b + n <= RAM_SIZE && (a + n <= b || b + n <= a || a == b)) {
+	    memmove(&ram[b], &ram[a], n);
+	    return;
+	}
+    }
+
+    for (i = 0; i < n; ++i)
+	for (j = 0, m = &y->op[0]; j < y->ops; ++j, ++m) {
+	    a = (unsigned char) (m->addr.b + m->addr.s * i);
+	    if (!m->write)
+		loaded[m->k] = ram[a];
+	    else if (m->v.kind == LOAD)
+		ram[a] = loaded[m->v.k];
+	    else
+		ram[a] = m->v.b + m->v.s * i;
+	}
+}
+
+/*
+ * At the head of a loop whose "BNZ" at branch was just taken: skips the
+ * iterations but the last if the loop can be summarized, returns the
+ * number skipped.
+ */
+static unsigned skip(ucpu_t *cpu, unsigned head, unsigned branch, unsigned long max_cycles)
+{
+    static sym_t y;
+    static unsigned long stamp;
+    unsigned char stream_rd[RAM_SIZE], stream_wr[RAM_SIZE];
+    unsigned long len = branch - head + 1, limit, n;
+    unsigned pass, r, i, a;
+    int ok = 0;
+
+    y.ram = cpu->ram;
+    y.loop = ++stamp;
+    y.cells = 0;
+    y.in_reg[ACC] = aff(cpu->acc, 0);
+    y.in_reg[IX] = aff(cpu->ix, 0);
+    y.in_reg[IY] = aff(cpu->iy, 0);
+    y.in_reg[X] = aff(cpu->x, 0);
+
+    for (pass = 0; pass < PASSES && ok == 0; ++pass) {
+	if (body(&y, cpu, head, branch, ++stamp) != 0)
+	    return 0;
+	ok = carried(&y);
+    }
+    if (ok != 1 || y.zf.kind != AFF)
+	return 0;
+
+    /* the branch is taken in iteration i while zf(i) != 0 */
+    for (n = 0; n < RAM_SIZE && (unsigned char) (y.zf.b + y.zf.s * n) != 0; ++n)
+	;
+    if (n == RAM_SIZE)
+	return 0;
+
+    /* at least one iteration is left to be executed for the flags and X */
+    limit = (max_cycles - cpu->cycles) / len;
+    if (n >= limit)
+	n = limit ? limit - 1 : 0;
+    if (n < MIN_SKIP)
+	return 0;
+
+    /*
+     * The accesses through IX / IY must not touch the cells used directly,
+     * in the last iteration either: it may read a cell written, but not
+     * live, before the body writes it again, which is not written back.
+     */
+    if (y.ops != 0 && y.cells != 0) {
+	memset(stream_rd, 0, sizeof(stream_rd));
+	memset(stream_wr, 0, sizeof(stream_wr));
+	for (r = 0; r < y.ops; ++r)
+	    mark(y.op[r].write ? stream_wr : stream_rd, &y.op[r].addr, n + 1);
+	for (i = 0; i < y.cells; ++i) {
+	    a = y.cell_list[i];
+	    if ((stream_wr[a] && used(&y, a)) || (stream_rd[a] && (used(&y, a) & U_WRITTEN)))
+		return 0;
+	}
+    }
+
+    replay(&y, cpu->ram, n);
+
+    /* the carried values, the others are written before read in the last iteration */
+    cpu->acc = y.in_reg[ACC].b + y.in_reg[ACC].s * n;
+    cpu->ix = y.in_reg[IX].b + y.in_reg[IX].s * n;
+    cpu->iy = y.in_reg[IY].b + y.in_reg[IY].s * n;
+    cpu->x = y.in_reg[X].b + y.in_reg[X].s * n;
+    for (i = 0; i < y.cells; ++i) {
+	a = y.cell_list[i];
+	if ((used(&y, a) & (U_LIVE | U_WRITTEN)) == (U_LIVE | U_WRITTEN))
+	    cpu->ram[a] = y.in_cell[a].b + y.in_cell[a].s * n;
+    }
+
+    cpu->zf = 0;
+    cpu->cycles += n * len;
+
+    return n;
+}
+
+/* true if the body has no control flow */
+static int straight(const ucpu_t *cpu, unsigned head, unsigned branch)
+{
+    unsigned a, op;
+
+    for (a = head; a < branch; ++a) {
+	op = cpu->rom[a] >> 8 & 0xf;
+	if (op == OP_BNC || op == OP_BNZ || op == OP_JPR || op == OP_JMP)
+	    return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * A loop is tried once when it is entered: tried[] is set at the branch
+ * on the first taken "BNZ" and cleared when it falls through, unless the
+ * body is not straight line code.
+ */
+enum {UNTRIED, TRIED, NEVER};
+
+halt_t ucpu_run_loops(ucpu_t *cpu, unsigned long max_cycles)
+{
+    unsigned char tried[ROM_SIZE];
+    unsigned pc, ir;
+
+    memset(tried, UNTRIED, sizeof(tried));
+
+    while (cpu->cycles < max_cycles) {
+	if (ucpu_halted(cpu))
+	    return HALT_JMP;
+
+	pc = cpu->pc;
+	ir = cpu->rom[pc];
+	ucpu_step(cpu);
+
+	if ((ir >> 8 & 0xf) != OP_BNZ || (ir & 0xff) > pc || tried[pc] == NEVER)
+	    continue;
+	if (cpu->pc != (ir & 0xff))
+	    tried[pc] = UNTRIED;
+	else if (tried[pc] == UNTRIED) {
+	    if (!straight(cpu, cpu->pc, pc))
+		tried[pc] = NEVER;
+	    else {
+		tried[pc] = TRIED;
+		skip(cpu, cpu->pc, pc, max_cycles);
+	    }
+	}
+    }
+
+    return ucpu_halted(cpu) ? HALT_JMP : HALT_LIMIT;
+}
@@ -0,0 +1,143 @@
+/*
+ * Record and replay of the inputs of a uCPU core.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+#include "cluster.h"
+
+struct replay {
+    FILE *f;
+    unsigned long time;		/* of the last event */
+    unsigned shared_lo;
+};
+
+static replay_t *replay_new(const char *name, const char *mode)
+{
+    replay_t *r;
+
+    if ((r = calloc(1, sizeof(*r))) == NULL)
+	return NULL;
+    if ((r->f = fopen(name, mode)) == NULL) {
+	free(r);
+	return NULL;
+    }
+
+    return r;
+}
+
+replay_t *replay_create(const char *name, unsigned shared_lo, const unsigned char *ram)
+{
+    replay_hdr_t hdr;
+    replay_t *r;
+
+    if ((r = replay_new(name, "wb")) == NULL)
+	return NULL;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = REPLAY_MAGIC;
+    hdr.shared_lo = r->shared_lo = shared_lo;
+    memcpy(hdr.ram, ram, sizeof(hdr.ram));
+    fwrite(&hdr, sizeof(hdr), 1, r->f);
+
+    return r;
+}
+
+void replay_put(replay_t *r, unsigned long time, unsigned addr, unsigned data)
+{
+    unsigned long delta = time - r->time;
+
+    r->time = time;
+    for (; delta >= 0x80; delta >>= 7)
+	putc((delta & 0x7f) | 0x80, r->f);
+    putc(delta, r->f);
+    putc(addr, r->f);
+    putc(data, r->f);
+}
+
+replay_t *replay_open(const char *name, replay_hdr_t *hdr)
+{
+    replay_t *r;
+
+    if ((r = replay_new(name, "rb")) == NULL)
+	return NULL;
+
+    if (fread(hdr, sizeof(*hdr), 1, r->f) != 1 || hdr->magic != REPLAY_MAGIC) {
+	fclose(r->f);
+	free(r);
+	errno = EINVAL;
+	return NULL;
+    }
+    r->shared_lo = hdr->shared_lo;
+
+    return r;
+}
+
+int replay_get(replay_t *r, unsigned long *time, unsigned *addr, unsigned *data)
+{
+    unsigned long delta = 0;
+    unsigned shift = 0;
+    int c;
+
+    do {
+	if ((c = getc(r->f)) == EOF)
+	    return 0;
+	delta |= (unsigned long) (c & 0x7f) << shift;
+	shift += 7;
+    } while (c & 0x80);
+
+    if ((c = getc(r->f)) == EOF)
+	return 0;
+    *addr = c;
+    if ((c = getc(r->f)) == EOF)
+	return 0;
+    *data = c;
+    *time = r->time += delta;
+
+    return 1;
+}
+
+int replay_close(replay_t *r)
+{
+    int rc = ferror(r->f) ? -1 : 0;
+
+    if (fclose(r->f) != 0)
+	rc = -1;
+    free(r);
+
+    return rc;
+}
+
+halt_t ucpu_run_replay(ucpu_t *cpu, replay_t *r, unsigned long max_cycles)
+{
+    unsigned long time;
+    unsigned addr, data, old;
+    int more, store;
+    halt_t halt;
+
+    more = replay_get(r, &time, &addr, &data);
+
+    while (cpu->cycles < max_cycles && !ucpu_halted(cpu)) {
+	for (; more && time <= cpu->cycles; more = replay_get(r, &time, &addr, &data))
+	    cpu->ram[addr] = data;
+
+	if ((store = cluster_store_addr(cpu, r->shared_lo)) < 0) {
+	    ucpu_step(cpu);
+	    continue;
+	}
+	old = cpu->ram[store];
+	ucpu_step(cpu);
+	cpu->ram[store] = old;
+    }
+    halt = ucpu_halted(cpu) ? HALT_JMP : HALT_LIMIT;
+
+    for (; more; more = replay_get(r, &time, &addr, &data))
+	cpu->ram[addr] = data;
+
+    return halt;
+}
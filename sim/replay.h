@@ -0,0 +1,58 @@
+/*
+ * Record and replay of the inputs of a uCPU core.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * uCPU has no I/O ports or interrupts: besides its ROM, a core reads from
+ * outside of its own stores only the RAM image it starts with and, in a
+ * cluster (cluster.h), the shared cells the stores of the cluster take
+ * effect in. A replay log has the image and every change of a shared cell
+ * as the core sees it, by cycle, so the core runs alone as it ran in the
+ * cluster: ucpu_run_replay() undoes its stores to the shared cells, they
+ * take effect as logged, like the stores of the other cores.
+ *
+ * A log is the header followed by an event per change: the cycles since
+ * the previous event as a LEB128 number, the address and the value,
+ * 3 bytes for most events. tb/tb.v replays it in the RTL with +replay.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+#include "ucpu.h"
+
+/* the first word of a replay log */
+#define REPLAY_MAGIC 0x31304C5052435554ULL	/* "TUCRPL01" */
+
+typedef struct {
+    uint64_t magic;
+    unsigned char shared_lo, pad[7];	/* the shared cells are shared_lo - F7 */
+    unsigned char ram[RAM_SIZE];	/* at reset */
+} replay_hdr_t;
+
+typedef struct replay replay_t;
+
+/* a log of the core with its RAM image now, NULL on errors */
+replay_t *replay_create(const char *name, unsigned shared_lo, const unsigned char *ram);
+
+/* the shared cell changes to data at the cycle, not before the last one */
+void replay_put(replay_t *r, unsigned long time, unsigned addr, unsigned data);
+
+/* a log to replay, its header in *hdr, NULL on errors (EINVAL if not a log) */
+replay_t *replay_open(const char *name, replay_hdr_t *hdr);
+
+/* the next event, returns 1, 0 at the end of the log */
+int replay_get(replay_t *r, unsigned long *time, unsigned *addr, unsigned *data);
+
+/* returns 0 or -1 if the log could not be written */
+int replay_close(replay_t *r);
+
+/*
+ * ucpu_run() of a core reset with the RAM image of the log, the shared
+ * cells changing as logged. The changes logged after the last cycle run
+ * are made at the end, so the RAM is that of the core in the cluster.
+ */
+halt_t ucpu_run_replay(ucpu_t *cpu, replay_t *r, unsigned long max_cycles);
+
+#endif
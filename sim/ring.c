@@ -0,0 +1,267 @@
+/*
+ * Live event ring of uCPU runs in POSIX shared memory.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "ring.h"
+
+#define RING_MAGIC 0x3130474e52435554ULL	/* "TUCRNG01" */
+#define MASK       (RING_SLOTS - 1)
+#define SPINS      64
+
+/* the slot of a reader: 0 free, 1 attached, 2 being attached */
+typedef struct {
+    uint64_t pos;		/* the next record it reads */
+    uint32_t state;
+    char pad[64 - 12];
+} reader_t;
+
+typedef struct {
+    uint64_t seq;		/* record + 1, 0 while written */
+    union {
+	trace_rec_t rec;
+	uint64_t word;
+    };
+} slot_t;
+
+typedef struct {
+    uint64_t magic;
+    uint32_t readers;		/* a lossless run waits for, 0 if lossy */
+    uint32_t done;
+    char pad0[64 - 16];
+    uint64_t head;		/* the records published */
+    char pad1[64 - 8];
+    reader_t reader[RING_READERS];
+    trace_hdr_t hdr;
+    slot_t slot[RING_SLOTS];
+} ring_map_t;
+
+struct ring {
+    ring_map_t *map;
+    uint64_t pos;		/* the writer: records, a reader: its next one */
+    uint64_t limit;		/* the writer waits when pos reaches it */
+    reader_t *reader;
+    char name[FILENAME_MAX];
+};
+
+static void wait_a_bit(unsigned *spins)
+{
+    if (++*spins >= SPINS) {
+	sched_yield();
+	*spins = 0;
+    }
+}
+
+/* shm_open() wants a name starting with a slash */
+static ring_t *ring_new(const char *name)
+{
+    ring_t *ring = calloc(1, sizeof(*ring));
+
+    if (ring != NULL)
+	snprintf(ring->name, sizeof(ring->name), "%s%s", *name == '/' ? "" : "/", name);
+
+    return ring;
+}
+
+ring_t *ring_create(const char *name, unsigned readers, const ucpu_t *cpu)
+{
+    ring_t *ring = ring_new(name);
+    int fd;
+
+    if (ring == NULL)
+	return NULL;
+
+    shm_unlink(ring->name);
+    if ((fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL, 0666)) < 0) {
+	free(ring);
+	return NULL;
+    }
+    if (ftruncate(fd, sizeof(ring_map_t)) != 0 ||
+	(ring->map = mmap(NULL, sizeof(ring_map_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			  0)) == MAP_FAILED) {
+	close(fd);
+	shm_unlink(ring->name);
+	free(ring);
+	return NULL;
+    }
+    close(fd);
+
+    ring->map->readers = readers;
+    trace_header(&ring->map->hdr, cpu);
+    ring->limit = RING_SLOTS;
+    __atomic_store_n(&ring->map->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+void ring_close(ring_t *ring)
+{
+    __atomic_store_n(&ring->map->done, 1, __ATOMIC_RELEASE);
+    munmap(ring->map, sizeof(ring_map_t));
+    shm_unlink(ring->name);
+    free(ring);
+}
+
+/* the oldest record an attached reader still needs, the writer's own if none */
+static uint64_t slowest(const ring_map_t *map, uint64_t pos)
+{
+    const reader_t *r;
+    uint64_t p, min = pos;
+
+    for (r = map->reader; r < map->reader + RING_READERS; ++r)
+	if (__atomic_load_n(&r->state, __ATOMIC_ACQUIRE) == 1 &&
+	    (p = __atomic_load_n(&r->pos, __ATOMIC_ACQUIRE)) < min)
+	    min = p;
+
+    return min;
+}
+
+static void put(ring_t *ring, const trace_rec_t *rec)
+{
+    ring_map_t *map = ring->map;
+    slot_t *s = &map->slot[ring->pos & MASK];
+    uint64_t word;
+    unsigned spins = 0;
+
+    if (ring->pos == ring->limit)
+	while ((ring->limit = slowest(map, ring->pos) + RING_SLOTS) == ring->pos)
+	    wait_a_bit(&spins);
+
+    memcpy(&word, rec, sizeof(word));
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&s->word, word, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, ++ring->pos, __ATOMIC_RELEASE);
+    __atomic_store_n(&map->head, ring->pos, __ATOMIC_RELEASE);
+}
+
+halt_t ucpu_run_ring(ucpu_t *cpu, unsigned long max_cycles, ring_t *ring)
+{
+    trace_rec_t r;
+    unsigned spins = 0;
+    unsigned i, attached;
+
+    /* a lossless run waits for its readers to start */
+    for (;;) {
+	for (i = attached = 0; i < RING_READERS; ++i)
+	    attached += __atomic_load_n(&ring->map->reader[i].state, __ATOMIC_ACQUIRE) == 1;
+	if (attached >= ring->map->readers)
+	    break;
+	wait_a_bit(&spins);
+    }
+
+    /* a lossy one never waits */
+    if (ring->map->readers == 0)
+	ring->limit = UINT64_MAX;
+
+    while (cpu->cycles < max_cycles) {
+	if (ucpu_halted(cpu))
+	    break;
+
+	trace_step(cpu, &r);
+	put(ring, &r);
+    }
+
+    return ucpu_halted(cpu) ? HALT_JMP : HALT_LIMIT;
+}
+
+ring_t *ring_attach(const char *name)
+{
+    ring_t *ring = ring_new(name);
+    reader_t *r;
+    uint32_t free_state;
+    int fd;
+
+    if (ring == NULL)
+	return NULL;
+
+    if ((fd = shm_open(ring->name, O_RDWR, 0)) < 0) {
+	free(ring);
+	return NULL;
+    }
+    ring->map = mmap(NULL, sizeof(ring_map_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring->map == MAP_FAILED) {
+	free(ring);
+	return NULL;
+    }
+    if (__atomic_load_n(&ring->map->magic, __ATOMIC_ACQUIRE) != RING_MAGIC) {
+	ring_detach(ring);
+	return NULL;
+    }
+
+    /* the position is set before the writer may see the reader */
+    for (r = ring->map->reader; r < ring->map->reader + RING_READERS; ++r) {
+	free_state = 0;
+	if (__atomic_compare_exchange_n(&r->state, &free_state, 2, 0, __ATOMIC_ACQ_REL,
+					__ATOMIC_RELAXED))
+	    break;
+    }
+    if (r == ring->map->reader + RING_READERS) {
+	ring_detach(ring);
+	return NULL;
+    }
+    ring->reader = r;
+    ring->pos = __atomic_load_n(&ring->map->head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&r->pos, ring->pos, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->state, 1, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+void ring_detach(ring_t *ring)
+{
+    if (ring->reader != NULL)
+	__atomic_store_n(&ring->reader->state, 0, __ATOMIC_RELEASE);
+    munmap(ring->map, sizeof(ring_map_t));
+    free(ring);
+}
+
+const trace_hdr_t *ring_header(const ring_t *ring)
+{
+    return &ring->map->hdr;
+}
+
+int ring_get(ring_t *ring, trace_rec_t *r, uint64_t *cycle, uint64_t *lost)
+{
+    ring_map_t *map = ring->map;
+    uint64_t seq, word, head;
+    unsigned spins = 0;
+    slot_t *s;
+    int done;
+
+    for (;;) {
+	s = &map->slot[ring->pos & MASK];
+	if ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) == ring->pos + 1) {
+	    word = __atomic_load_n(&s->word, __ATOMIC_RELAXED);
+	    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) {
+		memcpy(r, &word, sizeof(*r));
+		*cycle = map->hdr.start_cycle + ring->pos++;
+		__atomic_store_n(&ring->reader->pos, ring->pos, __ATOMIC_RELEASE);
+		return 1;
+	    }
+	}
+
+	done = __atomic_load_n(&map->done, __ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&map->head, __ATOMIC_ACQUIRE);
+	if (head <= ring->pos) {
+	    /* not published yet */
+	    if (done)
+		return 0;
+	    wait_a_bit(&spins);
+	} else if (head - ring->pos >= RING_SLOTS) {
+	    /* refilled, skip to half a ring behind the writer */
+	    *lost += head - RING_SLOTS / 2 - ring->pos;
+	    ring->pos = head - RING_SLOTS / 2;
+	}
+    }
+}
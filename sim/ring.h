@@ -0,0 +1,60 @@
+/*
+ * Live event ring of uCPU runs in POSIX shared memory.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * A run publishes the record of every instruction (see trace.h) into a
+ * ring of RING_SLOTS slots in a shared memory object, where up to
+ * RING_READERS analyzers read it while it runs. There is one writer and
+ * no lock: the writer fills a slot, then stores its sequence number with
+ * release order; a reader takes a slot when its number is the one it
+ * waits for, and checks again after the copy that it was not refilled
+ * meanwhile. Every reader has its own position.
+ *
+ * A lossy ring never waits: a reader falling a ring behind skips to half
+ * a ring behind the writer and counts the records lost. A lossless ring
+ * makes the writer wait for the slowest reader attached, it rereads their
+ * positions only once it has filled a ring since the last time, and the
+ * run starts once a given number of readers are attached. Others attach
+ * to a live run and start at its newest record. A reader that dies
+ * attached stalls a lossless run.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+#include "trace.h"
+
+#define RING_SLOTS   (1U << 16)	/* a power of 2 */
+#define RING_READERS 16
+
+typedef struct ring ring_t;
+
+/*
+ * The writer, creating the object for a run of cpu from its state now,
+ * readers is 0 for a lossy ring or the number of them a lossless run waits
+ * for. Returns NULL on error.
+ */
+ring_t *ring_create(const char *name, unsigned readers, const ucpu_t *cpu);
+
+/* ends the run for the readers and removes the object name */
+void ring_close(ring_t *ring);
+
+/* ucpu_run() publishing the records */
+halt_t ucpu_run_ring(ucpu_t *cpu, unsigned long max_cycles, ring_t *ring);
+
+/* a reader, NULL on error or if all readers are attached */
+ring_t *ring_attach(const char *name);
+void ring_detach(ring_t *ring);
+
+/* the header of the run: the ROM and the state it started from */
+const trace_hdr_t *ring_header(const ring_t *ring);
+
+/*
+ * Waits for the next record, stores it and its cycle, adds the records
+ * lost before it to *lost. Returns 0 at the end of the run.
+ */
+int ring_get(ring_t *ring, trace_rec_t *r, uint64_t *cycle, uint64_t *lost);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Timing model of a uCPU fetching through a ROM cache.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <string.h>
+
+#include "romcache.h"
+
+#define POW2(n) ((n) != 0 && ((n) & ((n) - 1)) == 0)
+
+int rom_cache_init(rom_cache_t *c, unsigned sets, unsigned ways, unsigned line,
+		   unsigned penalty)
+{
+    if (!POW2(sets) || !POW2(ways) || !POW2(line) || sets * ways > ROM_SIZE ||
+	sets * line > ROM_SIZE)
+	return -1;
+
+    memset(c, 0, sizeof(*c));
+    c->sets = sets;
+    c->ways = ways;
+    c->line = line;
+    c->penalty = penalty;
+    memset(c->tag, -1, sizeof(c->tag));
+
+    return 0;
+}
+
+/* the cycles of the fetch from pc */
+static unsigned fetch(rom_cache_t *c, unsigned pc)
+{
+    unsigned block = pc / c->line, set = block & (c->sets - 1), w, lru;
+    int tag = block / c->sets;
+    int *t = &c->tag[set * c->ways];
+    uint64_t *u = &c->used[set * c->ways];
+
+    ++c->clock;
+    for (w = lru = 0; w < c->ways; ++w) {
+	if (t[w] == tag) {
+	    u[w] = c->clock;
+	    return 1;
+	}
+	if (u[w] < u[lru])
+	    lru = w;
+    }
+
+    t[lru] = tag;
+    u[lru] = c->clock;
+    ++c->misses;
+
+    return 1 + c->penalty;
+}
+
+uint64_t rom_cache_run(rom_cache_t *c, ucpu_t *cpu, uint64_t n)
+{
+    uint64_t i;
+
+    for (i = 0; i < n && !ucpu_halted(cpu); ++i) {
+	c->cycles += fetch(c, cpu->pc);
+	ucpu_step(cpu);
+    }
+
+    return i;
+}
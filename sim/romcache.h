@@ -0,0 +1,37 @@
+/*
+ * Timing model of a uCPU fetching through a ROM cache.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * rtl/ucpu.v reads its ROM in the cycle of the instruction. With a slow
+ * ROM behind a set associative instruction cache of sets * ways lines of
+ * line words, LRU replaced, a hit still takes one cycle and a miss adds
+ * the penalty. The functional state is that of ucpu_step(), the model
+ * only counts the cycles, so cpu->cycles stays the instruction count.
+ */
+
+#ifndef ROMCACHE_H
+#define ROMCACHE_H
+
+#include <stdint.h>
+
+#include "ucpu.h"
+
+typedef struct {
+    unsigned sets, ways, line, penalty;
+    int tag[ROM_SIZE];		/* by set * ways + way, -1 if invalid */
+    uint64_t used[ROM_SIZE];	/* LRU stamps */
+    uint64_t clock;
+    uint64_t cycles, misses;
+} rom_cache_t;
+
+/* an empty cache, returns -1 if sets, ways or line are not powers of 2 or too many */
+int rom_cache_init(rom_cache_t *c, unsigned sets, unsigned ways, unsigned line,
+		   unsigned penalty);
+
+/*
+ * Runs up to n instructions, stopping at a halt, adding their cycles to
+ * c->cycles. Returns the instructions run.
+ */
+uint64_t rom_cache_run(rom_cache_t *c, ucpu_t *cpu, uint64_t n);
+
+#endif
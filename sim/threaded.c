@@ -0,0 +1,135 @@
+/*
+ * Threaded interpreter for uCPU.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * The ROM is pre-decoded into handler kinds once (the uCPU cannot write
+ * its ROM), resolving what ucpu_step() decides per instruction: the
+ * direct or indirect operand, "STA" to IX / IY and the halting "JMP".
+ * The handlers are dispatched with computed gotos and keep the machine
+ * state in locals. Results are identical to ucpu_run().
+ */
+
+#include <stdio.h>
+
+#include "ucpu.h"
+
+unsigned char ucpu_decode_word(unsigned ir, unsigned addr)
+{
+    unsigned op = ir >> 8 & 0xf, dat = ir & 0xff;
+
+    if (ir == (OP_JMP << 8 | addr))
+	return K_HALT;
+
+    if (op == OP_STA && dat == REG_IX)
+	return K_STA_IX;
+    if (op == OP_STA && dat == REG_IY)
+	return K_STA_IY;
+
+#define IND_CASE(name, c0, c1, c2, opcode, operand) ISA_IF(REG, operand, case OP_##name: return K_##name##_IND;)
+    if (dat >= ISA_IND)
+	switch (op) {
+	    ISA_INSNS(IND_CASE)
+	}
+#undef IND_CASE
+
+    return op;
+}
+
+void ucpu_decode(decode_t *dec, const ucpu_t *cpu, unsigned from, unsigned to)
+{
+    unsigned i;
+
+    for (i = from; i < to && i < ROM_SIZE; ++i)
+	dec->kind[i] = ucpu_decode_word(cpu->rom[i], i);
+}
+
+/* a handler <name> per opcode and <name>_IND per indirect mode kind */
+#define HANDLER(name, c0, c1, c2, opcode, operand) [OP_##name] = &&name,
+#define HANDLER_IND(name, c0, c1, c2, opcode, operand) ISA_IF(REG, operand, [K_##name##_IND] = &&name##_IND,)
+
+halt_t ucpu_run_threaded(ucpu_t *cpu, const decode_t *dec, unsigned long max_cycles)
+{
+    static const void *const handler[K_KINDS] = {
+	ISA_INSNS(HANDLER)
+	ISA_INSNS(HANDLER_IND)
+	[K_STA_IX] = &&sta_ix, [K_STA_IY] = &&sta_iy, [K_HALT] = &&halt
+    };
+    const void *code[ROM_SIZE];
+    const unsigned short *rom = cpu->rom;
+    unsigned char *ram = cpu->ram;
+    unsigned char pc = cpu->pc, acc = cpu->acc, ix = cpu->ix, iy = cpu->iy, x = cpu->x;
+    unsigned char cf = cpu->cf, zf = cpu->zf, dat;
+    unsigned long left = cpu->cycles < max_cycles ? max_cycles - cpu->cycles : 0;
+    halt_t result;
+    unsigned r, i;
+
+    for (i = 0; i < ROM_SIZE; ++i)
+	code[i] = handler[dec->kind[i]];
+
+/* every handler but halt starts with FETCH and ends with NEXT */
+#define FETCH() do { if (!left) goto limit; --left; dat = rom[pc++]; } while (0)
+#define NEXT() goto *code[pc]
+
+/* RAM address of an indirect mode operand FA - FF */
+#define EA_IND(dat) \
+    (((dat) & 6) == 2 ? (((dat) & 1) ? iy : ix) : \
+     ((dat) & 6) == 4 ? (((dat) & 1) ? iy++ : ix++) : \
+			(((dat) & 1) ? --iy : --ix))
+
+    NEXT();
+
+ANA:	FETCH(); acc &= x = ram[dat]; zf = !acc; NEXT();
+ANI:	FETCH(); acc &= dat; zf = !acc; NEXT();
+XRA:	FETCH(); acc ^= x = ram[dat]; zf = !acc; NEXT();
+XRI:	FETCH(); acc ^= dat; zf = !acc; NEXT();
+ADA:	FETCH(); r = acc + (x = ram[dat]); acc = r; cf = r >> 8 & 1; zf = !acc; NEXT();
+ADI:	FETCH(); r = acc + dat; acc = r; cf = r >> 8 & 1; zf = !acc; NEXT();
+SBA:	FETCH(); r = acc - (x = ram[dat]); acc = r; cf = r >> 8 & 1; zf = !acc; NEXT();
+CPI:	FETCH(); r = acc - dat; cf = r >> 8 & 1; zf = !(r & 0xff); NEXT();
+BNC:	FETCH(); if (!cf) pc = dat; NEXT();
+BNZ:	FETCH(); if (!zf) pc = dat; NEXT();
+JPR:	FETCH(); pc = x = ram[dat]; NEXT();
+JMP:	FETCH(); pc = dat; NEXT();
+LDA:	FETCH(); acc = x = ram[dat]; NEXT();
+LDI:	FETCH(); acc = dat; NEXT();
+STA:	FETCH(); ram[dat] = acc; NEXT();
+STX:	FETCH(); ram[dat] = x; NEXT();
+
+ANA_IND: FETCH(); acc &= x = ram[EA_IND(dat)]; zf = !acc; NEXT();
+XRA_IND: FETCH(); acc ^= x = ram[EA_IND(dat)]; zf = !acc; NEXT();
+ADA_IND: FETCH(); r = acc + (x = ram[EA_IND(dat)]); acc = r; cf = r >> 8 & 1; zf = !acc; NEXT();
+SBA_IND: FETCH(); r = acc - (x = ram[EA_IND(dat)]); acc = r; cf = r >> 8 & 1; zf = !acc; NEXT();
+JPR_IND: FETCH(); pc = x = ram[EA_IND(dat)]; NEXT();
+LDA_IND: FETCH(); acc = x = ram[EA_IND(dat)]; NEXT();
+STA_IND: FETCH(); ram[EA_IND(dat)] = acc; NEXT();
+STX_IND: FETCH(); ram[EA_IND(dat)] = x; NEXT();
+
+sta_ix:	FETCH(); ram[REG_IX] = ix = acc; NEXT();
+sta_iy:	FETCH(); ram[REG_IY] = iy = acc; NEXT();
+
+halt:
+    result = HALT_JMP;
+    goto done;
+
+limit:
+    /* the cycle limit is checked after the halt, as in ucpu_run() */
+    result = dec->kind[pc] == K_HALT ? HALT_JMP : HALT_LIMIT;
+
+done:
+    cpu->cycles = max_cycles > cpu->cycles ? max_cycles - left : cpu->cycles;
+    cpu->pc = pc;
+    cpu->acc = acc;
+    cpu->ix = ix;
+    cpu->iy = iy;
+    cpu->x = x;
+    cpu->cf = cf;
+    cpu->zf = zf;
+
+#undef FETCH
+#undef NEXT
+#undef EA_IND
+#undef HANDLER
+#undef HANDLER_IND
+
+    return result;
+}
@@ -0,0 +1,86 @@
+/*
+ * Binary execution traces of uCPU runs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#include <string.h>
+
+#include "trace.h"
+
+#define REC_BUF 4096
+
+void trace_header(trace_hdr_t *hdr, const ucpu_t *cpu)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = TRACE_MAGIC;
+    hdr->start_cycle = cpu->cycles;
+    memcpy(hdr->rom, cpu->rom, sizeof(hdr->rom));
+    memcpy(hdr->ram, cpu->ram, sizeof(hdr->ram));
+    hdr->pc = cpu->pc;
+    hdr->acc = cpu->acc;
+    hdr->ix = cpu->ix;
+    hdr->iy = cpu->iy;
+    hdr->x = cpu->x;
+    hdr->cf = cpu->cf;
+    hdr->zf = cpu->zf;
+}
+
+void trace_step(ucpu_t *cpu, trace_rec_t *r)
+{
+    unsigned op, addr;
+
+    /* the RAM address, before the autoincrement */
+    op = cpu->rom[cpu->pc] >> 8 & 0xf;
+    addr = ucpu_addr(cpu, cpu->rom[cpu->pc] & 0xff);
+
+    r->pc = cpu->pc;
+    ucpu_step(cpu);
+    r->acc = cpu->acc;
+    r->ix = cpu->ix;
+    r->iy = cpu->iy;
+    r->x = cpu->x;
+    r->flags = (cpu->cf ? TR_CF : 0) | (cpu->zf ? TR_ZF : 0);
+    r->addr = r->data = 0;
+    if (ISA_REG_OP(op)) {
+	r->flags |= op == OP_STA || op == OP_STX ? TR_WRITE : TR_READ;
+	r->addr = addr;
+	r->data = cpu->ram[addr];
+    }
+}
+
+void trace_print(FILE *f, const trace_hdr_t *hdr, uint64_t cycle, const trace_rec_t *r)
+{
+    fprintf(f, "%llu: PC = %02X %03X, Acc = %02X, IX = %02X, IY = %02X, X = %02X, CF = %u, ZF = %u",
+	    (unsigned long long) cycle, r->pc, hdr->rom[r->pc], r->acc, r->ix, r->iy, r->x,
+	    !!(r->flags & TR_CF), !!(r->flags & TR_ZF));
+    if (r->flags & TR_WRITE)
+	fprintf(f, ", [%02X] <- %02X", r->addr, r->data);
+    if (r->flags & TR_READ)
+	fprintf(f, ", [%02X] -> %02X", r->addr, r->data);
+    fprintf(f, "\n");
+}
+
+halt_t ucpu_run_trace(ucpu_t *cpu, unsigned long max_cycles, FILE *f)
+{
+    static trace_rec_t buf[REC_BUF];
+    trace_hdr_t hdr;
+    unsigned n = 0;
+
+    trace_header(&hdr, cpu);
+    fwrite(&hdr, sizeof(hdr), 1, f);
+
+    while (cpu->cycles < max_cycles) {
+	if (ucpu_halted(cpu))
+	    break;
+
+	trace_step(cpu, &buf[n]);
+	if (++n == REC_BUF) {
+	    fwrite(buf, sizeof(*buf), n, f);
+	    n = 0;
+	}
+    }
+
+    fwrite(buf, sizeof(*buf), n, f);
+
+    return ucpu_halted(cpu) ? HALT_JMP : HALT_LIMIT;
+}
@@ -0,0 +1,53 @@
+/*
+ * Binary execution traces of uCPU runs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * A trace file is a header with the ROM and the state at the start of
+ * the run followed by a record per instruction executed, record n being
+ * that of cycle n counted from the start: the PC of the instruction, the
+ * registers and the flags after it and its RAM access, if any. Records
+ * have a fixed size, so a trace is mapped and indexed by cycle.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ucpu.h"
+
+/* the first word of a trace file */
+#define TRACE_MAGIC 0x3130435254435554ULL	/* "TUCTRC01" */
+
+/* flags of a record */
+#define TR_CF    1
+#define TR_ZF    2
+#define TR_READ  4		/* addr was read, data is the value */
+#define TR_WRITE 8		/* addr was written, data is the value */
+
+typedef struct {
+    unsigned char pc, acc, ix, iy, x, flags, addr, data;
+} trace_rec_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t start_cycle;	/* of record 0 */
+    unsigned short rom[ROM_SIZE];
+    unsigned char ram[RAM_SIZE];
+    unsigned char pc, acc, ix, iy, x, cf, zf, pad;
+} trace_hdr_t;
+
+/* the header of a trace of cpu from its state now */
+void trace_header(trace_hdr_t *hdr, const ucpu_t *cpu);
+
+/* ucpu_step() filling the record of the instruction */
+void trace_step(ucpu_t *cpu, trace_rec_t *r);
+
+/* the record as a line of text */
+void trace_print(FILE *f, const trace_hdr_t *hdr, uint64_t cycle, const trace_rec_t *r);
+
+/* ucpu_run() writing the header and a record per instruction to f */
+halt_t ucpu_run_trace(ucpu_t *cpu, unsigned long max_cycles, FILE *f);
+
+#endif
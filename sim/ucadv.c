@@ -0,0 +1,486 @@
+/*
+ * Addressing mode advisor for uCPU programs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Runs a ROM image as ucsim does, keeping for every instruction with a
+ * RAM operand the stream of its addresses: the first one, the step
+ * between the passes and whether the step is constant. Then suggests the
+ * autoincrement modes where the code steps a pointer by hand:
+ *
+ *  - "@IX" / "@IY" whose address moves by one per pass is "@IX+" or
+ *    "@-IX"; if several of them move together by k per pass and their
+ *    offsets are 0 .. k-1 in the program order (a 16 bit array read
+ *    byte by byte), each becomes "@IX+". Of those at the same offset
+ *    only the last one steps, a read-modify-write keeps "@IX" first.
+ *    The index must be stepped by hand: by "STA %IX" / "STA %IY" adding
+ *    constants to it every pass that sum up to k, which are reported as
+ *    going away, and by no autoincrement mode in the same loop, the
+ *    innermost one around the access closed by a backward jump taken.
+ *    Nothing else, a subroutine called from the loop, may write it;
+ *  - runs of three or more "STA" to consecutive addresses in a straight
+ *    line of code are a loop over "@IX+" or "@-IX" (or "@IY") if they
+ *    fill, store what one "LDI" or "LDA" loaded or the immediates of
+ *    "LDI" moving by a constant, or copy, store what "LDA" loaded from
+ *    consecutive addresses, and an index register (two for a copy) is
+ *    not used in that code.
+ *
+ * The suggestions are printed as "<lst>:<line>: ...", by the lines of
+ * the ucasm listing file, in their order, or by ROM address when no
+ * listing is given. Code that never ran gets no suggestions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "trace.h"
+
+#define DEFAULT_LIMIT 1000000UL
+#define MIN_PASSES    3		/* of an access before its step counts */
+#define MIN_RUN       3		/* direct operands */
+#define MAX_NOTES     (4 * ROM_SIZE)
+
+/* the address stream of an instruction */
+typedef struct {
+    unsigned long passes;
+    unsigned first, last;
+    int step;			/* from the first pass to the second */
+    int steady;			/* every step so far was that one */
+    unsigned long writes;	/* of its index, at the last pass */
+    unsigned long writes_step;	/* between the passes, ~0 if not constant */
+} stream_t;
+
+/* an index load, the step is the index after it minus that before */
+typedef struct {
+    unsigned long passes;
+    int step, steady;
+} index_step_t;
+
+typedef struct {
+    unsigned line;		/* of the listing, or the ROM address */
+    char text[160];
+} note_t;
+
+static unsigned char ran[ROM_SIZE];
+static int back[ROM_SIZE];		/* the target of a backward jump taken, -1 if none */
+static unsigned long index_writes[2];	/* loads and autoincrements of IX, IY */
+static stream_t stream[ROM_SIZE];
+static index_step_t index_step[ROM_SIZE];
+static int lst_line[ROM_SIZE];	/* -1 if none */
+static note_t note[MAX_NOTES];
+static unsigned notes;
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-c <max-cycles>] [-r <ram-init>] <rom> [<lst>]\n", prog);
+}
+
+/* the lines of the listing file with the instruction words, "  16:   06  CFC  ..." */
+static int load_lst(const char *name)
+{
+    char buf[512];
+    unsigned line, pc, word, n = 0;
+    FILE *f;
+
+    if ((f = fopen(name, "r")) == NULL)
+	return -1;
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+	++n;
+	if (sscanf(buf, "%u: %x %3x", &line, &pc, &word) == 3 && pc < ROM_SIZE &&
+	    lst_line[pc] < 0)
+	    lst_line[pc] = n;
+    }
+    fclose(f);
+
+    return 0;
+}
+
+static unsigned line_of(unsigned pc)
+{
+    return lst_line[pc] >= 0 ? (unsigned) lst_line[pc] : pc;
+}
+
+static void add_note(unsigned pc, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (notes == MAX_NOTES)
+	return;
+    note[notes].line = line_of(pc);
+    va_start(ap, fmt);
+    vsnprintf(note[notes].text, sizeof(note[notes].text), fmt, ap);
+    va_end(ap);
+    ++notes;
+}
+
+static int note_cmp(const void *a, const void *b)
+{
+    const note_t *x = a, *y = b;
+
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+/* the instruction as in the source, the tab of cfg_insn made a space */
+static const char *insn_text(const unsigned short *rom, unsigned pc)
+{
+    static char buf[sizeof(cfg_insn[0].text)];
+    char *p;
+
+    strcpy(buf, cfg_insn[rom[pc]].text);
+    if ((p = strchr(buf, '\t')) != NULL)
+	*p = ' ';
+
+    return buf;
+}
+
+static void run(ucpu_t *cpu, unsigned long max_cycles)
+{
+    unsigned pc, dat, old_ix, old_iy, v, reg;
+    unsigned long w;
+    trace_rec_t r;
+    stream_t *s;
+    index_step_t *x;
+    int step;
+
+    while (cpu->cycles < max_cycles && !ucpu_halted(cpu)) {
+	pc = cpu->pc;
+	old_ix = cpu->ix;
+	old_iy = cpu->iy;
+	trace_step(cpu, &r);
+	ran[pc] = 1;
+	if (cpu->pc <= pc && cfg_insn[cpu->rom[pc]].flow != FLOW_NEXT)
+	    back[pc] = cpu->pc;
+	if (!(r.flags & (TR_READ | TR_WRITE)))
+	    continue;
+
+	s = &stream[pc];
+	if (s->passes == 0)
+	    s->first = r.addr;
+	else {
+	    step = (signed char) (r.addr - s->last);
+	    if (s->passes == 1) {
+		s->step = step;
+		s->steady = 1;
+	    } else if (step != s->step)
+		s->steady = 0;
+	}
+	s->last = r.addr;
+
+	/* "STA %IX" / "STA %IY" and the autoincrements write the index */
+	dat = cpu->rom[pc] & 0xff;
+	reg = dat & 1;
+	if (dat >= ISA_IND && (dat & 6) != 2)
+	    ++index_writes[reg];
+	if (cpu->rom[pc] >> 8 == OP_STA && (dat == REG_IX || dat == REG_IY))
+	    ++index_writes[reg];
+	if (dat >= ISA_IND) {
+	    w = index_writes[reg] - s->writes;
+	    if (s->passes == 1)
+		s->writes_step = w;
+	    else if (s->passes > 1 && w != s->writes_step)
+		s->writes_step = ~0UL;
+	    s->writes = index_writes[reg];
+	}
+	++s->passes;
+
+
+	if (cpu->rom[pc] >> 8 == OP_STA && (dat == REG_IX || dat == REG_IY)) {
+	    x = &index_step[pc];
+	    v = dat == REG_IX ? cpu->ix : cpu->iy;
+	    step = (signed char) (v - (dat == REG_IX ? old_ix : old_iy));
+	    if (x->passes == 1) {
+		x->step = step;
+		x->steady = 1;
+	    } else if (x->passes > 1 && step != x->step)
+		x->steady = 0;
+	    ++x->passes;
+	}
+    }
+}
+
+/* the innermost loop around pc that ran, [*first, *last], 0 if none */
+static int loop_of(unsigned pc, unsigned *first, unsigned *last)
+{
+    unsigned b;
+    int found = 0;
+
+    for (b = pc; b < ROM_SIZE; ++b)
+	if (back[b] >= 0 && (unsigned) back[b] <= pc &&
+	    (!found || b - back[b] < *last - *first)) {
+	    *first = back[b];
+	    *last = b;
+	    found = 1;
+	}
+
+    return found;
+}
+
+/* the passes of two instructions of one loop */
+static int same_loop(unsigned long a, unsigned long b)
+{
+    return a + 1 >= b && b + 1 >= a;
+}
+
+static int steady(const stream_t *s)
+{
+    return s->passes >= MIN_PASSES && s->steady && s->step != 0;
+}
+
+/* an access through the index of reg in the mode, 2 "@IX", 4 "@IX+", 6 "@-IX" */
+static int indirect(unsigned word, unsigned reg, unsigned mode)
+{
+    return (word >> 8) != OP_BNC && (word & 0xff) >= ISA_IND && (word & 1) == reg &&
+	(mode == 0 ? (word & 6) != 2 : (word & 6) == mode);
+}
+
+/* the accesses through an index stepped by hand, by register and step */
+static void advise_indirect(const unsigned short *rom)
+{
+    static unsigned char done[ROM_SIZE];
+    unsigned pc, q, reg, members, member[ROM_SIZE], m, steps, step_pc[ROM_SIZE];
+    unsigned first = 0, last = 0;
+    int k, sum, off, prev, sign;
+    char mode[8], lines[96];
+    size_t len;
+
+    for (pc = 0; pc < ROM_SIZE; ++pc) {
+	if (done[pc] || !steady(&stream[pc]) || !indirect(rom[pc], rom[pc] & 1, 2))
+	    continue;
+	if (!loop_of(pc, &first, &last))
+	    continue;
+
+	/* "@IX" or "@IY" at pc and the others of its loop moving with it */
+	reg = rom[pc] & 1;
+	k = stream[pc].step;
+	sign = k > 0 ? 1 : -1;
+	members = 0;
+	for (q = pc; q <= last; ++q)
+	    if (!done[q] && steady(&stream[q]) && indirect(rom[q], reg, 2) &&
+		stream[q].step == k && same_loop(stream[q].passes, stream[pc].passes)) {
+		done[q] = 1;
+		member[members++] = q;
+	    }
+
+	/* offsets 0, 0, 1, 2, 2 ... k - 1 */
+	prev = 0;
+	for (m = 1; m < members; ++m) {
+	    off = (signed char) (stream[member[m]].first - stream[pc].first);
+	    if (off != prev && off != prev + sign)
+		break;
+	    prev = off;
+	}
+	if (m < members || prev != k - sign)
+	    continue;
+
+	/* stepped by hand, and only so */
+	steps = sum = 0;
+	for (q = first; q <= last; ++q) {
+	    if (stream[q].passes != 0 && indirect(rom[q], reg, 0))
+		break;
+	    if ((rom[q] >> 8) == OP_STA && (rom[q] & 0xff) == (reg ? REG_IY : REG_IX) &&
+		index_step[q].passes >= MIN_PASSES && index_step[q].steady &&
+		same_loop(index_step[q].passes, stream[pc].passes)) {
+		step_pc[steps++] = q;
+		sum += index_step[q].step;
+	    }
+	}
+	if (q <= last || sum != k || stream[pc].writes_step != steps)
+	    continue;
+
+	snprintf(mode, sizeof(mode), k > 0 ? "@%s+" : "@-%s", reg ? "IY" : "IX");
+
+	/* the last access at every offset steps */
+	len = 0;
+	lines[0] = 0;
+	for (m = 0; m < members; ++m) {
+	    q = member[m];
+	    if (m + 1 < members && stream[member[m + 1]].first == stream[q].first)
+		continue;
+	    add_note(q, "%s: %%%02X, %%%02X, %%%02X ... (%+d per pass, %lu passes), use %s%s",
+		     insn_text(rom, q), stream[q].first, (stream[q].first + k) & 0xff,
+		     (stream[q].first + 2 * k) & 0xff, k, stream[q].passes, mode,
+		     k < 0 ? " from the index one higher" : "");
+	    if (len < sizeof(lines))
+		len += snprintf(lines + len, sizeof(lines) - len, "%s%u", len ? ", " : "",
+				line_of(q));
+	}
+
+	for (m = 0; m < steps; ++m)
+	    add_note(step_pc[m], "%s: %s %+d per pass by hand, not needed with %s at %s",
+		     insn_text(rom, step_pc[m]), reg ? "IY" : "IX", index_step[step_pc[m]].step,
+		     mode, lines);
+    }
+}
+
+/*
+ * What the "STA" at pc, not the first instruction of its straight code,
+ * stores: 1 and the immediate of an "LDI" before it, 2 and the direct
+ * operand of an "LDA", or -1, what the store before it at prev stored;
+ * 0 if anything else.
+ */
+static int store_src(const unsigned short *rom, unsigned pc, int prev, int *val)
+{
+    unsigned w = rom[pc - 1];
+
+    if (w >> 8 == OP_LDI) {
+	*val = w & 0xff;
+	return 1;
+    }
+    if (w >> 8 == OP_LDA && (w & 0xff) < REG_IX) {
+	*val = w & 0xff;
+	return 2;
+    }
+    if (prev >= 0 && (unsigned) prev == pc - 1 && rom[prev] >> 8 == OP_STA)
+	return -1;		/* that of prev */
+
+    return 0;
+}
+
+/* the index registers used in [start, end), bit 0 IX, bit 1 IY */
+static unsigned index_used(const unsigned short *rom, unsigned start, unsigned end)
+{
+    unsigned pc, used = 0;
+
+    for (pc = start; pc < end; ++pc)
+	if (cfg_insn[rom[pc]].flow == FLOW_NEXT && (rom[pc] & 0xff) >= REG_IX)
+	    used |= 1 << (rom[pc] & 1);
+
+    return used;
+}
+
+/* runs of stores to consecutive addresses in straight code that ran */
+static void advise_direct(const unsigned short *rom)
+{
+    static unsigned char label[ROM_SIZE];
+    unsigned pc, start, end, list[ROM_SIZE], n, i, j, used, dst, src;
+    int d, kind[ROM_SIZE], val[ROM_SIZE], dv;
+    static const char *const reg_name[] = {"IX", "IY"};
+
+    for (pc = 0; pc < ROM_SIZE; ++pc)
+	if (cfg_insn[rom[pc]].flow == FLOW_BRANCH || cfg_insn[rom[pc]].flow == FLOW_JUMP)
+	    label[cfg_insn[rom[pc]].dat] = 1;
+
+    for (start = 0; start < ROM_SIZE; start = end) {
+	/* [start, end) */
+	for (end = start + 1; end < ROM_SIZE && !label[end] && ran[end] == ran[start] &&
+	     cfg_insn[rom[end - 1]].flow == FLOW_NEXT; ++end)
+	    ;
+	if (!ran[start])
+	    continue;
+	used = index_used(rom, start, end);
+
+	for (pc = start, n = 0; pc < end; ++pc)
+	    if (rom[pc] >> 8 == OP_STA && stream[pc].passes != 0 && (rom[pc] & 0xff) < REG_IX) {
+		kind[n] = pc == start ? 0 : store_src(rom, pc, n ? (int) list[n - 1] : -1, &val[n]);
+		if (kind[n] < 0) {
+		    kind[n] = kind[n - 1];
+		    val[n] = val[n - 1];
+		}
+		list[n++] = pc;
+	    }
+
+	for (i = 0; i + 1 < n; i = j) {
+	    d = (signed char) (rom[list[i + 1]] - rom[list[i]]);
+	    dv = (signed char) (val[i + 1] - val[i]);
+	    if ((d != 1 && d != -1) || kind[i] == 0 || kind[i + 1] != kind[i] ||
+		(kind[i] == 2 && dv != 0 && dv != 1 && dv != -1)) {
+		j = i + 1;
+		continue;
+	    }
+	    for (j = i + 1; j < n && (signed char) (rom[list[j]] - rom[list[j - 1]]) == d &&
+		 kind[j] == kind[i] && (signed char) (val[j] - val[j - 1]) == dv; ++j)
+		;
+	    if (j - i < MIN_RUN)
+		continue;
+
+	    /* a fill needs a free index, a copy two */
+	    if (kind[i] == 2 && dv != 0) {
+		if (used != 0)
+		    continue;
+		dst = 0;
+		src = 1;
+	    } else if ((used & 1) == 0)
+		dst = 0;
+	    else if ((used & 2) == 0)
+		dst = 1;
+	    else
+		continue;
+
+	    if (kind[i] == 2 && dv != 0)
+		add_note(list[i], "%s .. %%%02X (%u operands, to line %u): a copy from %%%02X, "
+			 "a loop over %s%s%s from %02X and %s%s%s from %02X",
+			 insn_text(rom, list[i]), rom[list[j - 1]] & 0xff, j - i,
+			 line_of(list[j - 1]), val[i], dv > 0 ? "@" : "@-", reg_name[src],
+			 dv > 0 ? "+" : "", (val[i] + (dv < 0)) & 0xff, d > 0 ? "@" : "@-",
+			 reg_name[dst], d > 0 ? "+" : "", (rom[list[i]] + (d < 0)) & 0xff);
+	    else
+		add_note(list[i], "%s .. %%%02X (%u operands, to line %u): a fill%s, "
+			 "a loop over %s%s%s from %02X", insn_text(rom, list[i]),
+			 rom[list[j - 1]] & 0xff, j - i, line_of(list[j - 1]),
+			 dv != 0 ? " with a step" : "", d > 0 ? "@" : "@-", reg_name[dst],
+			 d > 0 ? "+" : "", (rom[list[i]] + (d < 0)) & 0xff);
+	}
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static ucpu_t cpu;
+    const char *ram_name = NULL, *lst_name = NULL;
+    unsigned long limit = DEFAULT_LIMIT;
+    unsigned i;
+    int c;
+
+    while ((c = getopt(argc, argv, "c:r:")) != -1)
+	switch (c) {
+	    case 'c':
+		limit = strtoul(optarg, NULL, 0);
+		break;
+	    case 'r':
+		ram_name = optarg;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind != argc - 1 && optind != argc - 2) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    if (load_hex(argv[optind], cpu.rom, ROM_SIZE, 1) < 0) {
+	perror(argv[optind]);
+	return 1;
+    }
+
+    if (ram_name != NULL && load_hex(ram_name, cpu.ram, RAM_SIZE, 0) < 0) {
+	perror(ram_name);
+	return 1;
+    }
+
+    memset(lst_line, -1, sizeof(lst_line));
+    memset(back, -1, sizeof(back));
+    if (optind == argc - 2 && load_lst(lst_name = argv[optind + 1]) != 0) {
+	perror(lst_name);
+	return 1;
+    }
+
+    ucpu_reset(&cpu);
+    run(&cpu, limit);
+
+    advise_indirect(cpu.rom);
+    advise_direct(cpu.rom);
+
+    qsort(note, notes, sizeof(*note), note_cmp);
+    for (i = 0; i < notes; ++i)
+	if (lst_name != NULL)
+	    printf("%s:%u: %s\n", lst_name, note[i].line, note[i].text);
+	else
+	    printf("%02X: %s\n", note[i].line, note[i].text);
+
+    return 0;
+}
@@ -0,0 +1,396 @@
+/*
+ * Execution backend benchmark for uCPU.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Runs programs (ROM images, the RAM image is <name>.ram next to
+ * <name>.hex, if present) repeatedly on every selected backend and reports
+ * guest MIPS, host cycles and cache misses per guest instruction. Host
+ * counters come from perf_event_open(2) and are shown as "-" where it is
+ * not permitted. Every measurement is appended to a tab separated history
+ * file.
+ *
+ * Backends:
+ *
+ *   switch    - ucpu_run(), the reference interpreter
+ *   threaded  - ucpu_run_threaded(), pre-decoded with computed gotos
+ *   loops     - ucpu_run_loops(), the reference with counted loops skipped
+ *   icarus    - tb/bench.v on vvp, $VVP_BENCH (default "vvp -n ../bench/bench.vvp")
+ *   verilator - tb/bench.v verilated, $VERILATED_BENCH (default "../bench/obj_dir/Vbench")
+ *
+ * The in-process backends are checked against the switch interpreter. The
+ * RTL backends are whole processes running the program +repeat times, so
+ * their figures include the simulator start-up.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "ucpu.h"
+
+#define LIMIT 1000000UL
+
+#define NELEM(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct {
+    unsigned long runs, cycles;	/* cycles of a single run */
+    double seconds;
+    long long host_cycles, cache_misses;	/* -1 if not available */
+} result_t;
+
+typedef int (*backend_fn)(const ucpu_t *prog, const char *rom_name, const char *ram_name,
+			  double min_time, result_t *res);
+
+static int bench_switch(const ucpu_t *, const char *, const char *, double, result_t *);
+static int bench_threaded(const ucpu_t *, const char *, const char *, double, result_t *);
+static int bench_loops(const ucpu_t *, const char *, const char *, double, result_t *);
+static int bench_icarus(const ucpu_t *, const char *, const char *, double, result_t *);
+static int bench_verilator(const ucpu_t *, const char *, const char *, double, result_t *);
+
+static const struct {
+    const char *name;
+    backend_fn run;
+} backend[] = {
+    {"switch", bench_switch},
+    {"threaded", bench_threaded},
+    {"loops", bench_loops},
+    {"icarus", bench_icarus},
+    {"verilator", bench_verilator},
+    {NULL, NULL}
+};
+
+/* host counters */
+
+static int perf_fd[2] = {-1, -1};
+
+static int perf_open(unsigned long long config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;		/* count the RTL simulator processes, too */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_start(void)
+{
+    int i;
+
+    for (i = 0; i < 2; ++i)
+	if (perf_fd[i] >= 0) {
+	    ioctl(perf_fd[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(perf_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+static void perf_stop(result_t *res)
+{
+    long long count[2] = {-1, -1};
+    int i;
+
+    for (i = 0; i < 2; ++i)
+	if (perf_fd[i] >= 0) {
+	    ioctl(perf_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	    if (read(perf_fd[i], &count[i], sizeof(count[i])) != sizeof(count[i]))
+		count[i] = -1;
+	}
+
+    res->host_cycles = count[0];
+    res->cache_misses = count[1];
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* in-process backends */
+
+static ucpu_t reference;
+
+static int check_state(const ucpu_t *cpu, const char *backend_name)
+{
+    if (cpu->pc != reference.pc || cpu->acc != reference.acc || cpu->ix != reference.ix ||
+	cpu->iy != reference.iy || cpu->x != reference.x || cpu->cf != reference.cf ||
+	cpu->zf != reference.zf || cpu->cycles != reference.cycles || memcmp(cpu->ram, reference.ram, RAM_SIZE) != 0) {
+	fprintf(stderr, "%s: final state differs from the switch interpreter\n", backend_name);
+	return -1;
+    }
+
+    return 0;
+}
+
+/* repeats batches of runs until min_time has passed */
+#define BENCH_LOOP(res, min_time, run) \
+    do { \
+	unsigned long batch = 1, k; \
+	double start = now(); \
+	perf_start(); \
+	do { \
+	    for (k = 0; k < batch; ++k) { \
+		run; \
+	    } \
+	    (res)->runs += batch; \
+	    batch *= 2; \
+	} while (((res)->seconds = now() - start) < (min_time)); \
+	perf_stop(res); \
+    } while (0)
+
+static int bench_switch(const ucpu_t *prog, const char *rom_name, const char *ram_name,
+			double min_time, result_t *res)
+{
+    static ucpu_t cpu;
+
+    cpu = *prog;
+    ucpu_reset(&cpu);
+    ucpu_run(&cpu, LIMIT);
+    reference = cpu;
+    res->cycles = cpu.cycles;
+
+    BENCH_LOOP(res, min_time, cpu = *prog; ucpu_reset(&cpu); ucpu_run(&cpu, LIMIT));
+
+    return 0;
+}
+
+static int bench_threaded(const ucpu_t *prog, const char *rom_name, const char *ram_name,
+			  double min_time, result_t *res)
+{
+    static ucpu_t cpu;
+    static decode_t dec;
+
+    ucpu_decode(&dec, prog, 0, ROM_SIZE);
+
+    cpu = *prog;
+    ucpu_reset(&cpu);
+    ucpu_run_threaded(&cpu, &dec, LIMIT);
+    if (check_state(&cpu, "threaded") < 0)
+	return -1;
+    res->cycles = cpu.cycles;
+
+    BENCH_LOOP(res, min_time, cpu = *prog; ucpu_reset(&cpu); ucpu_run_threaded(&cpu, &dec, LIMIT));
+
+    return 0;
+}
+
+static int bench_loops(const ucpu_t *prog, const char *rom_name, const char *ram_name,
+		       double min_time, result_t *res)
+{
+    static ucpu_t cpu;
+
+    cpu = *prog;
+    ucpu_reset(&cpu);
+    ucpu_run_loops(&cpu, LIMIT);
+    if (check_state(&cpu, "loops") < 0)
+	return -1;
+    res->cycles = cpu.cycles;
+
+    BENCH_LOOP(res, min_time, cpu = *prog; ucpu_reset(&cpu); ucpu_run_loops(&cpu, LIMIT));
+
+    return 0;
+}
+
+/* RTL backends, tb/bench.v run as a child process */
+
+static int bench_rtl(const char *cmd, const char *rom_name, const char *ram_name,
+		     double min_time, result_t *res)
+{
+    char line[4096];
+    unsigned long repeat;
+    double start;
+    FILE *p;
+
+    /* size +repeat from the reference run so that the run takes about min_time */
+    repeat = reference.cycles ? (unsigned long) (min_time * 2e6 / reference.cycles) + 1 : 1;
+
+    snprintf(line, sizeof(line), "%s +rom=%s +ram=%s +dump=/dev/null +limit=%lu +repeat=%lu",
+	     cmd, rom_name, ram_name != NULL ? ram_name : "../rtl/null.hex", LIMIT, repeat);
+
+    start = now();
+    perf_start();
+
+    if ((p = popen(line, "r")) == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), p) != NULL)
+	sscanf(line, "cycles: %lu", &res->cycles);
+    if (pclose(p) != 0 || res->cycles == 0)
+	return -1;
+
+    perf_stop(res);
+    res->seconds = now() - start;
+    res->runs = repeat;
+
+    return 0;
+}
+
+static int bench_icarus(const ucpu_t *prog, const char *rom_name, const char *ram_name,
+			double min_time, result_t *res)
+{
+    const char *cmd = getenv("VVP_BENCH");
+
+    return bench_rtl(cmd ? cmd : "vvp -n ../bench/bench.vvp", rom_name, ram_name, min_time, res);
+}
+
+static int bench_verilator(const ucpu_t *prog, const char *rom_name, const char *ram_name,
+			   double min_time, result_t *res)
+{
+    const char *cmd = getenv("VERILATED_BENCH");
+
+    return bench_rtl(cmd ? cmd : "../bench/obj_dir/Vbench", rom_name, ram_name, min_time, res);
+}
+
+/* reporting */
+
+static void per_instr(char *buf, long long count, double instr, double scale)
+{
+    if (count < 0)
+	strcpy(buf, "-");
+    else
+	sprintf(buf, "%.3f", count * scale / instr);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-b <backend>[,<backend>...]] [-t <seconds>] [-c <cpu>] [-l <label>] [-H <history>] <rom>...\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    static ucpu_t prog;
+    char backends[256] = "switch,threaded", ram_name[FILENAME_MAX], *name;
+    const char *label = "-", *history_name = NULL;
+    int selected[NELEM(backend)] = {0};
+    double min_time = 1.0;
+    FILE *history = NULL;
+    cpu_set_t cpus;
+    int c, i, j, failed = 0;
+
+    while ((c = getopt(argc, argv, "b:t:c:l:H:")) != -1)
+	switch (c) {
+	    case 'b':
+		snprintf(backends, sizeof(backends), "%s", optarg);
+		break;
+	    case 't':
+		min_time = strtod(optarg, NULL);
+		break;
+	    case 'c':
+		/* pin to one host CPU for reproducible numbers */
+		CPU_ZERO(&cpus);
+		CPU_SET(atoi(optarg), &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+		    perror("sched_setaffinity");
+		break;
+	    case 'l':
+		label = optarg;
+		break;
+	    case 'H':
+		history_name = optarg;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind == argc) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    for (name = strtok(backends, ","); name != NULL; name = strtok(NULL, ",")) {
+	for (i = 0; backend[i].name != NULL && strcmp(name, backend[i].name) != 0; ++i)
+	    ;
+	if (backend[i].name == NULL) {
+	    fprintf(stderr, "Unknown backend \"%s\".\n", name);
+	    return -1;
+	}
+	selected[i] = 1;
+    }
+
+    perf_fd[0] = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+    perf_fd[1] = perf_open(PERF_COUNT_HW_CACHE_MISSES);
+
+    if (history_name != NULL) {
+	if ((history = fopen(history_name, "a")) == NULL) {
+	    perror(history_name);
+	    return 1;
+	}
+	if (ftell(history) == 0)
+	    fprintf(history, "time\tlabel\tbackend\tprogram\tcycles\truns\tseconds\tmips\thost_cycles_per_instr\tcache_misses_per_kinstr\n");
+    }
+
+    printf("%-10s %-12s %8s %10s %8s %10s %10s %12s\n",
+	   "backend", "program", "cycles", "runs", "seconds", "MIPS", "cyc/instr", "miss/kinstr");
+
+    for (j = optind; j < argc; ++j) {
+	const char *rom_name = argv[j], *ram = NULL, *base, *dot;
+	int prog_len;
+
+	base = strrchr(rom_name, '/') != NULL ? strrchr(rom_name, '/') + 1 : rom_name;
+	dot = strrchr(base, '.');
+	prog_len = dot != NULL ? dot - base : (int) strlen(base);
+	snprintf(ram_name, sizeof(ram_name), "%.*s.ram",
+		 (int) (dot != NULL ? dot - rom_name : (int) strlen(rom_name)), rom_name);
+
+	if (load_hex(rom_name, prog.rom, ROM_SIZE, 1) < 0) {
+	    perror(rom_name);
+	    return 1;
+	}
+	memset(prog.ram, 0, RAM_SIZE);
+	if (load_hex(ram_name, prog.ram, RAM_SIZE, 0) >= 0)
+	    ram = ram_name;
+
+	for (i = 0; backend[i].name != NULL; ++i) {
+	    result_t res;
+	    char cyc[32], miss[32];
+	    double instr, mips;
+
+	    /* the switch interpreter always runs first, it provides the reference */
+	    if (!selected[i] && i != 0)
+		continue;
+
+	    memset(&res, 0, sizeof(res));
+	    if (backend[i].run(&prog, rom_name, ram, selected[i] ? min_time : 0, &res) < 0) {
+		fprintf(stderr, "%s: %s backend failed\n", rom_name, backend[i].name);
+		failed = 1;
+		continue;
+	    }
+	    if (!selected[i])
+		continue;
+
+	    instr = (double) res.cycles * res.runs;
+	    mips = instr / res.seconds * 1e-6;
+	    per_instr(cyc, res.host_cycles, instr, 1);
+	    per_instr(miss, res.cache_misses, instr, 1000);
+
+	    printf("%-10s %-12.*s %8lu %10lu %8.3f %10.2f %10s %12s\n",
+		   backend[i].name, prog_len, base, res.cycles, res.runs, res.seconds, mips, cyc, miss);
+
+	    if (history != NULL)
+		fprintf(history, "%ld\t%s\t%s\t%.*s\t%lu\t%lu\t%.6f\t%.3f\t%s\t%s\n",
+			(long) time(NULL), label, backend[i].name, prog_len, base, res.cycles, res.runs,
+			res.seconds, mips, cyc, miss);
+	}
+    }
+
+    if (history != NULL)
+	fclose(history);
+
+    return failed;
+}
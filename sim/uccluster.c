@@ -0,0 +1,179 @@
+/*
+ * Simulator for clusters of uCPU cores.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Runs n cores sharing the RAM cells from the shared address up to F7
+ * (see cluster.h), core i with ROM image i modulo the images given, every
+ * core reset with the same RAM image and its number in the id cell. Prints
+ * the final state of every core like ucsim, the stores to the shared
+ * memory and the windows synchronized, and optionally dumps the shared
+ * memory. The run is parallel on the given threads, or serial with -s;
+ * both print the same. The host time goes to stderr.
+ *
+ * With -w the inputs of core i are recorded to <log>.<i> (see replay.h)
+ * for "ucsim -P" or tb/tb.v to replay the core alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "cluster.h"
+
+#define DEFAULT_LIMIT   1000000UL
+#define DEFAULT_LATENCY 16
+#define DEFAULT_SHARED  0xe0
+#define DEFAULT_ID      0xdf
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-s] [-j <threads>] [-n <cores>] [-l <latency>] [-S <shared>] [-I <id>]\n"
+	   "       [-c <max-cycles>] [-r <ram-init>] [-o <shared-dump>] [-w <log>] <rom>...\n", prog);
+    printf("       shared, id: RAM addresses in hex, the id cell below the shared ones\n");
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char ram[RAM_SIZE];
+    const char *ram_name = NULL, *dump_name = NULL, *log_name = NULL;
+    char name[FILENAME_MAX];
+    unsigned long limit = DEFAULT_LIMIT;
+    unsigned cores = 0, threads = sysconf(_SC_NPROCESSORS_ONLN), latency = DEFAULT_LATENCY;
+    unsigned shared = DEFAULT_SHARED, id = DEFAULT_ID, roms, i;
+    int c, serial = 0, rc, all_halted = 1;
+    cluster_t cl;
+    ucpu_t *core;
+    FILE *dump_file;
+    double t;
+
+    while ((c = getopt(argc, argv, "sj:n:l:S:I:c:r:o:w:")) != -1)
+	switch (c) {
+	    case 's':
+		serial = 1;
+		break;
+	    case 'j':
+		threads = strtoul(optarg, NULL, 0);
+		break;
+	    case 'n':
+		cores = strtoul(optarg, NULL, 0);
+		break;
+	    case 'l':
+		latency = strtoul(optarg, NULL, 0);
+		break;
+	    case 'S':
+		shared = strtoul(optarg, NULL, 16);
+		break;
+	    case 'I':
+		id = strtoul(optarg, NULL, 16);
+		break;
+	    case 'c':
+		limit = strtoul(optarg, NULL, 0);
+		break;
+	    case 'r':
+		ram_name = optarg;
+		break;
+	    case 'o':
+		dump_name = optarg;
+		break;
+	    case 'w':
+		log_name = optarg;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    roms = argc - optind;
+    if (cores == 0)
+	cores = roms;
+    if (roms == 0 || latency == 0 || shared > REG_IX || id >= shared) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    if ((core = calloc(cores, sizeof(*core))) == NULL) {
+	perror("calloc");
+	return 1;
+    }
+
+    if (ram_name != NULL && load_hex(ram_name, ram, RAM_SIZE, 0) < 0) {
+	perror(ram_name);
+	return 1;
+    }
+
+    for (i = 0; i < cores; ++i) {
+	if (i < roms && load_hex(argv[optind + i], core[i].rom, ROM_SIZE, 1) < 0) {
+	    perror(argv[optind + i]);
+	    return 1;
+	}
+	if (i >= roms)
+	    memcpy(core[i].rom, core[i % roms].rom, sizeof(core[i].rom));
+	memcpy(core[i].ram, ram, sizeof(ram));
+	core[i].ram[id] = i;
+	ucpu_reset(&core[i]);
+    }
+
+    if (cluster_init(&cl, core, cores, latency, shared, limit) != 0) {
+	perror("cluster_init");
+	return 1;
+    }
+
+    for (i = 0; log_name != NULL && i < cores; ++i) {
+	snprintf(name, sizeof(name), "%s.%u", log_name, i);
+	if ((cl.replay[i] = replay_create(name, cl.shared_lo, core[i].ram)) == NULL) {
+	    perror(name);
+	    return 1;
+	}
+    }
+
+    t = now();
+    rc = serial ? cluster_run_serial(&cl) : cluster_run(&cl, threads);
+    t = now() - t;
+    if (rc != 0) {
+	perror("cluster_run");
+	return 1;
+    }
+
+    for (i = 0; log_name != NULL && i < cores; ++i)
+	if (replay_close(cl.replay[i]) != 0) {
+	    fprintf(stderr, "%s.%u: write error\n", log_name, i);
+	    return 1;
+	}
+
+    for (i = 0; i < cores; ++i) {
+	all_halted &= ucpu_halted(&core[i]);
+	printf("core %u: halt: %s, cycles: %lu, PC = %02X, Acc = %02X, IX = %02X, IY = %02X, "
+	       "CF = %u, ZF = %u, X = %02X\n", i, halt_name(ucpu_halted(&core[i]) ? HALT_JMP :
+							    HALT_LIMIT), core[i].cycles,
+	       core[i].pc, core[i].acc, core[i].ix, core[i].iy, core[i].cf, core[i].zf,
+	       core[i].x);
+    }
+    printf("shared stores: %lu\n", cl.stores);
+    fprintf(stderr, "%s: %u cores, %.3f s, %lu windows\n", serial ? "serial" : "parallel",
+	    cores, t, cl.windows);
+
+    if (dump_name != NULL) {
+	if ((dump_file = fopen(dump_name, "w")) == NULL) {
+	    perror(dump_name);
+	    return 1;
+	}
+	dump_hex(dump_file, cl.shared, RAM_SIZE);
+	fclose(dump_file);
+    }
+
+    cluster_free(&cl);
+    free(core);
+
+    return all_halted ? 0 : 2;
+}
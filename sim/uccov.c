@@ -0,0 +1,104 @@
+/*
+ * Coverage report for uCPU regressions.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * ORs the coverage databases of ucsim -C and the bitmaps of tb/bench.v
+ * +cov, prints the covered bins per category against the goal (see
+ * cov_goal() in cov.h) and lists the missing ones. With -R the branch
+ * goal is that of the ROM, the branch bins of other programs are not
+ * counted. Exits with 1 if the coverage is incomplete.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cov.h"
+
+static const struct {
+    const char *name;
+    unsigned first, last;
+} category[] = {
+    {"modes",    COV_MODE,   COV_ZF},
+    {"ZF",       COV_ZF,     COV_CF},
+    {"CF",       COV_CF,     COV_STX},
+    {"STX",      COV_STX,    COV_BRANCH},
+    {"branches", COV_BRANCH, COV_BITS},
+};
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-q] [-R <rom>] [-o <cov-db>] <cov>...\n", prog);
+    printf("       -q  do not list the missing bins\n");
+    printf("       -o  merge the inputs into the database\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned short rom[ROM_SIZE];
+    const char *rom_name = NULL, *out_name = NULL;
+    cov_t cov = {{0}}, goal;
+    unsigned i, b, hit, total, missing = 0;
+    int c, quiet = 0;
+    char buf[32];
+
+    while ((c = getopt(argc, argv, "qR:o:")) != -1)
+	switch (c) {
+	    case 'q':
+		quiet = 1;
+		break;
+	    case 'R':
+		rom_name = optarg;
+		break;
+	    case 'o':
+		out_name = optarg;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind == argc) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    for (; optind < argc; ++optind)
+	if (cov_load(argv[optind], &cov) != 0) {
+	    perror(argv[optind]);
+	    return 2;
+	}
+
+    if (out_name != NULL && cov_merge(out_name, &cov) != 0) {
+	perror(out_name);
+	return 2;
+    }
+
+    if (rom_name != NULL && load_hex(rom_name, rom, ROM_SIZE, 1) < 0) {
+	perror(rom_name);
+	return 2;
+    }
+
+    cov_goal(&goal, rom_name != NULL ? rom : NULL);
+
+    for (i = 0; i < sizeof(category) / sizeof(category[0]); ++i) {
+	hit = total = 0;
+	for (b = category[i].first; b < category[i].last; ++b) {
+	    if (!COV_HAS(&goal, b))
+		continue;
+	    ++total;
+	    hit += COV_HAS(&cov, b);
+	}
+	if (total == 0)
+	    continue;
+	printf("%-9s %4u / %-4u %5.1f%%\n", category[i].name, hit, total, 100.0 * hit / total);
+	missing += total - hit;
+    }
+
+    if (!quiet)
+	for (b = 0; b < COV_BITS; ++b)
+	    if (COV_HAS(&goal, b) && !COV_HAS(&cov, b))
+		printf("missing: %s\n", cov_bin_name(b, buf, sizeof(buf)));
+
+    return missing != 0;
+}
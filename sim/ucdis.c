@@ -0,0 +1,238 @@
+/*
+ * Disassembler for uCPU.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Turns a ROM image into a source that ucasm assembles back into the same
+ * image, the basic blocks and the targets of every "JPR" marked in the
+ * comments, and optionally writes the control flow graph for Graphviz
+ * (see cfg.h). The operands of "BNC", "BNZ" and "JMP" become labels $<n>
+ * with n the decimal address. Runs of unreachable zero words are left
+ * out and skipped with "ORG", other unreachable words are kept.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfg.h"
+
+/* JPR targets per comment line */
+#define TARGETS_PER_LINE 16
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-b] [-r <ram-init>] [-o <source>] [-g <graph>] <rom>\n", prog);
+    printf("       -b  the ROM is binary, 16 bit little endian words\n");
+}
+
+/* reads a binary ROM image, returns the number of words read or -1 */
+static int load_bin(const char *name, unsigned short *rom)
+{
+    unsigned char buf[2 * ROM_SIZE];
+    size_t n, i;
+    FILE *f;
+
+    if ((f = fopen(name, "rb")) == NULL)
+	return -1;
+    n = fread(buf, 2, ROM_SIZE, f);
+    fclose(f);
+
+    memset(rom, 0, ROM_SIZE * sizeof(*rom));
+    for (i = 0; i < n; ++i)
+	rom[i] = (buf[2 * i] | buf[2 * i + 1] << 8) & 0xfff;
+
+    return n;
+}
+
+/* the instruction at a with the label operand, if any */
+static void format_insn(char *buf, size_t size, const unsigned short *rom, unsigned a)
+{
+    const insn_t *i = &cfg_insn[rom[a]];
+
+    if (i->flow == FLOW_BRANCH || i->flow == FLOW_JUMP)
+	snprintf(buf, size, "%s$%u", i->text, i->dat);
+    else
+	snprintf(buf, size, "%s", i->text);
+}
+
+static void print_targets(FILE *f, const cfg_t *cfg, unsigned a)
+{
+    const vset_t *t = &cfg->target[a];
+    unsigned v, n = 0;
+
+    if (vset_count(t) == ROM_SIZE) {
+	fprintf(f, "; JPR targets: unbounded\n");
+	return;
+    }
+
+    fprintf(f, "; JPR targets:");
+    for (v = 0; v < ROM_SIZE; ++v)
+	if (VSET_HAS(t, v))
+	    fprintf(f, ++n % TARGETS_PER_LINE == 0 ? " %02X\n;" : " %02X", v);
+    fprintf(f, n == 0 ? " none\n" : "\n");
+}
+
+static void write_source(FILE *f, const char *rom_name, const cfg_t *cfg, const unsigned short *rom)
+{
+    char buf[32];
+    unsigned a, v, next = 0, unreachable = 0;
+
+    fprintf(f, "; %s, %u block(s)\n", rom_name, cfg->blocks);
+
+    for (a = 0; a < ROM_SIZE; ++a) {
+	int reachable = VSET_HAS(&cfg->reachable, a);
+
+	if (!reachable && rom[a] == 0 && !VSET_HAS(&cfg->label, a))
+	    continue;
+
+	if (reachable && VSET_HAS(&cfg->leader, a)) {
+	    const cfg_block_t *b = &cfg->block[cfg->block_of[a]];
+
+	    fprintf(f, ";\n; block %u: %02X - %02X ->", cfg->block_of[a], b->first, b->last);
+	    for (v = 0; v < ROM_SIZE; ++v)
+		if (VSET_HAS(&b->succ, v))
+		    fprintf(f, " %02X", v);
+	    fprintf(f, b->flags & B_HALT ? " halt\n" : b->flags & B_UNBOUNDED ? " ?\n" : "\n");
+	    unreachable = 0;
+	} else if (!reachable && !unreachable) {
+	    fprintf(f, ";\n; unreachable\n");
+	    unreachable = 1;
+	}
+
+	if (a != next)
+	    fprintf(f, "\tORG\t%02X\n", a);
+	next = a + 1;
+
+	if (reachable && cfg_insn[rom[a]].flow == FLOW_JPR)
+	    print_targets(f, cfg, a);
+
+	format_insn(buf, sizeof(buf), rom, a);
+	if (VSET_HAS(&cfg->label, a))
+	    fprintf(f, "$%u\t%s\n", a, buf);
+	else
+	    fprintf(f, "\t%s\n", buf);
+    }
+}
+
+static void write_graph(FILE *f, const char *rom_name, const cfg_t *cfg, const unsigned short *rom)
+{
+    char buf[32];
+    unsigned i, a, v, unbounded = 0;
+
+    fprintf(f, "digraph \"%s\" {\n", rom_name);
+    fprintf(f, "\tnode [shape=box, fontname=\"monospace\"];\n");
+
+    for (i = 0; i < cfg->blocks; ++i) {
+	const cfg_block_t *b = &cfg->block[i];
+
+	fprintf(f, "\tb%02X [label=\"", b->first);
+	for (a = b->first; ; ++a) {
+	    format_insn(buf, sizeof(buf), rom, a);
+	    *strchr(buf, '\t') = ' ';
+	    fprintf(f, "%02X: %s\\l", a, buf);
+	    if (a == b->last)
+		break;
+	}
+	fprintf(f, "\"%s];\n", b->flags & B_HALT ? ", peripheries=2" : "");
+
+	for (v = 0; v < ROM_SIZE; ++v) {
+	    const insn_t *in = &cfg_insn[rom[b->last]];
+
+	    if (!VSET_HAS(&b->succ, v))
+		continue;
+	    fprintf(f, "\tb%02X -> b%02X", b->first, v);
+	    if (in->flow == FLOW_JPR)
+		fprintf(f, " [style=dotted]");
+	    else if (in->flow != FLOW_JUMP && v == ((b->last + 1) & 0xff))
+		fprintf(f, " [style=dashed]");
+	    fprintf(f, ";\n");
+	}
+
+	if (b->flags & B_UNBOUNDED) {
+	    fprintf(f, "\tb%02X -> unbounded [style=dotted];\n", b->first);
+	    unbounded = 1;
+	}
+    }
+
+    if (unbounded)
+	fprintf(f, "\tunbounded [shape=plaintext, label=\"?\"];\n");
+    fprintf(f, "}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static cfg_t cfg;
+    unsigned short rom[ROM_SIZE];
+    unsigned char ram[RAM_SIZE];
+    const char *ram_name = NULL, *src_name = NULL, *graph_name = NULL;
+    FILE *f;
+    int c, binary = 0, rc;
+
+    while ((c = getopt(argc, argv, "br:o:g:")) != -1)
+	switch (c) {
+	    case 'b':
+		binary = 1;
+		break;
+	    case 'r':
+		ram_name = optarg;
+		break;
+	    case 'o':
+		src_name = optarg;
+		break;
+	    case 'g':
+		graph_name = optarg;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind != argc - 1) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    rc = binary ? load_bin(argv[optind], rom) : load_hex(argv[optind], rom, ROM_SIZE, 1);
+    if (rc < 0) {
+	perror(argv[optind]);
+	return 1;
+    }
+
+    if (ram_name != NULL && load_hex(ram_name, ram, RAM_SIZE, 0) < 0) {
+	perror(ram_name);
+	return 1;
+    }
+
+    if (cfg_build(&cfg, rom, ram_name != NULL ? ram : NULL) != 0) {
+	perror("cfg_build");
+	return 1;
+    }
+
+    if (src_name == NULL)
+	write_source(stdout, argv[optind], &cfg, rom);
+    else if ((f = fopen(src_name, "w")) == NULL) {
+	perror(src_name);
+	return 1;
+    } else {
+	write_source(f, argv[optind], &cfg, rom);
+	if (fclose(f) != 0) {
+	    perror(src_name);
+	    return 1;
+	}
+    }
+
+    if (graph_name != NULL) {
+	if ((f = fopen(graph_name, "w")) == NULL) {
+	    perror(graph_name);
+	    return 1;
+	}
+	write_graph(f, argv[optind], &cfg, rom);
+	if (fclose(f) != 0) {
+	    perror(graph_name);
+	    return 1;
+	}
+    }
+
+    return 0;
+}
@@ -0,0 +1,614 @@
+/*
+ * Coverage guided differential fuzzer for uCPU.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Generates random ROM and RAM images and runs every one on the reference
+ * simulator and on a device under test in lockstep, comparing the whole
+ * architectural state (PC, Acc, IX, IY, X, the flags, the cycle count and
+ * the RAM) after every window of cycles. A mismatch is located to the
+ * cycle by replaying the program with a window of one, the program is
+ * minimized by clearing ROM words and RAM bytes while it still fails, and
+ * written to <prefix>.hex and <prefix>.ram for ucsim / ucdis.
+ *
+ * A few seed programs the generator hardly makes are run first: going
+ * through the top of the ROM, and a loop that ucpu_run_loops() may skip
+ * reading in its last iteration a cell written before. A quarter of the
+ * generated programs are such counted loops of a straight line body.
+ *
+ * The images kept in the corpus and mutated are those reaching new bins
+ * of cov.h or new pairs of consecutive instruction modes with the flags
+ * in between. Several instances with different seeds can share one
+ * coverage database with -C.
+ *
+ * Devices under test:
+ *
+ *   threaded - ucpu_run_threaded(), always built
+ *   loops    - ucpu_run_loops(), always built
+ *   rtl      - rtl/ucpu.v verilated with tb/fuzz.v and tb/fuzz.cpp, in
+ *              ucfuzz-rtl built by "make ucfuzz-rtl" in bench/, stepped
+ *              one cycle at a time. X is not reset in the RTL, the
+ *              reference takes it from the model after reset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ucpu.h"
+#include "cov.h"
+#include "cfg.h"
+#ifdef UCFUZZ_RTL
+#include "fuzz.h"
+#endif
+
+#define DEFAULT_LIMIT 10000UL
+#define CORPUS_MAX    4096
+#define MAX_LEN       64	/* words of a generated program, but see gen() */
+
+/* mode pairs with CF and ZF, the other guidance of the corpus */
+#define MODE_BINS  COV_ZF
+#define PAIR_BITS  (MODE_BINS * MODE_BINS * 4)
+
+typedef struct {
+    unsigned short rom[ROM_SIZE];
+    unsigned char ram[RAM_SIZE];
+    unsigned len;		/* words before the halt of a generated program */
+} image_t;
+
+typedef struct {
+    unsigned long cycle;	/* of the first differing state */
+    unsigned char pc;		/* of the instruction executed last */
+    const char *what;
+    unsigned ref, dut;
+} mismatch_t;
+
+typedef struct {
+    const char *name;
+    void (*reset)(ucpu_t *cpu);
+    halt_t (*run)(ucpu_t *cpu, unsigned long max_cycles);
+    unsigned long window;	/* default cycles between the comparisons */
+} dut_t;
+
+/* operand classes */
+enum {REG, IMM, LAB};
+#define OPERAND(name, c0, c1, c2, opcode, operand) [opcode] = operand,
+static const unsigned char operand[ISA_OPCODES] = {ISA_INSNS(OPERAND)};
+#undef OPERAND
+
+static uint64_t rng_state;
+
+static unsigned rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+
+    return (rng_state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* devices under test */
+
+static decode_t decoded;
+
+static void threaded_reset(ucpu_t *cpu)
+{
+    ucpu_reset(cpu);
+    ucpu_decode(&decoded, cpu, 0, ROM_SIZE);
+}
+
+static halt_t threaded_run(ucpu_t *cpu, unsigned long max_cycles)
+{
+    return ucpu_run_threaded(cpu, &decoded, max_cycles);
+}
+
+#ifdef UCFUZZ_RTL
+static rtl_t *rtl;
+
+static void verilated_reset(ucpu_t *cpu)
+{
+    rtl_reset(rtl, cpu);
+}
+
+static halt_t verilated_run(ucpu_t *cpu, unsigned long max_cycles)
+{
+    return rtl_run(rtl, cpu, max_cycles);
+}
+#endif
+
+static const dut_t duts[] = {
+#ifdef UCFUZZ_RTL
+    {"rtl", verilated_reset, verilated_run, 1},
+#endif
+    {"threaded", threaded_reset, threaded_run, 4096},
+    {"loops", ucpu_reset, ucpu_run_loops, 4096},
+    {NULL, NULL, NULL, 0}
+};
+
+/* guidance */
+
+static cov_t total_cov;
+static unsigned long total_cycles;
+static uint64_t pairs[(PAIR_BITS + 63) / 64];
+
+/* new bins in cov, added to the totals */
+static unsigned new_bins(const cov_t *cov)
+{
+    unsigned i, n = 0;
+
+    for (i = 0; i < COV_WORDS; ++i) {
+	n += __builtin_popcountll(cov->w[i] & ~total_cov.w[i]);
+	total_cov.w[i] |= cov->w[i];
+    }
+
+    return n;
+}
+
+static int differs(const ucpu_t *ref, const ucpu_t *dut, mismatch_t *m)
+{
+    unsigned a;
+
+#define CHECK(field, name) \
+    if (ref->field != dut->field) { \
+	m->what = name; \
+	m->ref = ref->field; \
+	m->dut = dut->field; \
+	return 1; \
+    }
+    CHECK(pc, "PC");
+    CHECK(acc, "Acc");
+    CHECK(ix, "IX");
+    CHECK(iy, "IY");
+    CHECK(cf, "CF");
+    CHECK(zf, "ZF");
+    CHECK(x, "X");
+    CHECK(cycles, "cycles");
+#undef CHECK
+
+    for (a = 0; a < RAM_SIZE; ++a)
+	if (ref->ram[a] != dut->ram[a]) {
+	    static char name[16];
+
+	    snprintf(name, sizeof(name), "RAM[%02X]", a);
+	    m->what = name;
+	    m->ref = ref->ram[a];
+	    m->dut = dut->ram[a];
+	    return 1;
+	}
+
+    return 0;
+}
+
+/*
+ * Runs the image on the reference and on the device, comparing them every
+ * window cycles. Returns 1 with the first differing cycle in m, otherwise
+ * 0. With fresh non-NULL the new guidance bins reached are counted there.
+ */
+static int lockstep(const dut_t *d, const image_t *img, unsigned long limit, unsigned long window,
+		    unsigned *fresh, mismatch_t *m)
+{
+    static ucpu_t ref, dut;
+    cov_t cov = {{0}};
+    unsigned x_src = COV_X_NONE, prev = 0, bin, pair;
+    unsigned char last_pc = 0;
+
+    memcpy(ref.rom, img->rom, sizeof(ref.rom));
+    memcpy(ref.ram, img->ram, sizeof(ref.ram));
+    memcpy(dut.rom, img->rom, sizeof(dut.rom));
+    memcpy(dut.ram, img->ram, sizeof(dut.ram));
+    ucpu_reset(&ref);
+    d->reset(&dut);
+    ref.x = dut.x;
+
+    for (;;) {
+	unsigned long until = limit - ref.cycles < window ? limit : ref.cycles + window;
+
+	while (ref.cycles < until && !ucpu_halted(&ref)) {
+	    last_pc = ref.pc;
+	    if (fresh != NULL) {
+		bin = cov_mode(ref.rom[ref.pc]);
+		pair = (prev * MODE_BINS + bin) * 4 + ref.cf * 2 + ref.zf;
+		if (!(pairs[pair >> 6] >> (pair & 63) & 1)) {
+		    pairs[pair >> 6] |= (uint64_t) 1 << (pair & 63);
+		    ++*fresh;
+		}
+		prev = bin;
+	    }
+	    cov_step(&ref, &cov, &x_src);
+	}
+	/* a DUT not halting where the reference does runs on to the limit */
+	d->run(&dut, ucpu_halted(&ref) ? limit : until);
+
+	if (differs(&ref, &dut, m)) {
+	    mismatch_t at_window = *m;
+
+	    /* a DUT skipping cycles, as loops does, may agree cycle by cycle */
+	    at_window.cycle = ref.cycles;
+	    at_window.pc = last_pc;
+	    if (window == 1 || !lockstep(d, img, limit, 1, NULL, m))
+		*m = at_window;
+	    return 1;
+	}
+
+	if (ucpu_halted(&ref) || ref.cycles >= limit)
+	    break;
+    }
+
+    if (fresh != NULL) {
+	*fresh += new_bins(&cov);
+	total_cycles += ref.cycles;
+    }
+
+    return 0;
+}
+
+/* images */
+
+static unsigned gen_word(unsigned len)
+{
+    unsigned op = rnd() & 15, r = rnd(), dat;
+
+    switch (operand[op]) {
+	case REG:
+	    /* the special registers and a few cells shared by the program */
+	    dat = r % 4 == 0 ? REG_IX + (r >> 2) % 8 : r % 8 == 1 ? r >> 8 & 0xff : (r >> 8) % 16;
+	    break;
+	case IMM:
+	    dat = r % 4 == 0 ? (r >> 2) % 2 * 0xff : r % 4 == 1 ? 1 : r >> 8 & 0xff;
+	    break;
+	default:
+	    dat = r % len;
+	    break;
+    }
+
+    return op << 8 | dat;
+}
+
+static void gen(image_t *img)
+{
+    unsigned a, r = rnd(), w, op;
+
+    memset(img, 0, sizeof(*img));
+    if (r % 4 == 1) {
+	/*
+	 * A straight line body counted by a cell, the loops ucpu_run_loops()
+	 * skips, a few iterations with IX and IY near the cells it uses.
+	 */
+	unsigned cell = (r >> 8) % 16, k = 1 + (r >> 12) % 32, up = r >> 17 & 1, head;
+
+	a = 0;
+	img->rom[a++] = OP_LDI << 8 | rnd() % 32;
+	img->rom[a++] = OP_STA << 8 | REG_IX;
+	img->rom[a++] = OP_LDI << 8 | rnd() % 32;
+	img->rom[a++] = OP_STA << 8 | REG_IY;
+	img->rom[a++] = OP_LDI << 8 | (up ? -k & 0xff : k);
+	img->rom[a++] = OP_STA << 8 | cell;
+	for (head = a; a < head + 1 + (r >> 4) % 8; ) {
+	    w = gen_word(MAX_LEN);
+	    op = w >> 8;
+	    if (op != OP_BNC && op != OP_BNZ && op != OP_JPR && op != OP_JMP)
+		img->rom[a++] = w;
+	}
+	img->rom[a++] = OP_LDA << 8 | cell;
+	img->rom[a++] = OP_ADI << 8 | (up ? 0x01 : 0xff);
+	img->rom[a++] = OP_STA << 8 | cell;
+	img->rom[a++] = OP_BNZ << 8 | head;
+	img->len = a + 1;
+    } else {
+	img->len = r % 16 == 0 ? 2 + (r >> 4) % (ROM_SIZE - 1) : 2 + (r >> 4) % (MAX_LEN - 1);
+	for (a = 0; a + 1 < img->len; ++a)
+	    img->rom[a] = gen_word(img->len);
+    }
+    img->rom[a] = OP_JMP << 8 | a;
+
+    /* addresses in the program for "JPR" half of the time */
+    for (a = 0; a < RAM_SIZE; ++a)
+	img->ram[a] = rnd() % 2 ? rnd() % img->len : rnd();
+}
+
+/*
+ * Programs the generator hardly makes, run first: one at the top of the
+ * ROM halting at FF, one going through FF and wrapping around to 0, and
+ * a loop whose stream through -(IX) reaches the cell %0B it stores to
+ * directly in the last iteration.
+ */
+#define W(op, dat) (OP_##op << 8 | (dat))
+static const struct {
+    unsigned char addr;
+    unsigned short word;
+} seeds[][16] = {
+    {{0x00, W(JMP, 0xfc)}, {0xfc, W(LDI, 0x03)}, {0xfd, W(ADI, 0xff)}, {0xfe, W(BNZ, 0xfd)},
+     {0xff, W(JMP, 0xff)}},
+    {{0x00, W(LDA, 0x10)}, {0x01, W(ADI, 0x01)}, {0x02, W(STA, 0x10)}, {0x03, W(XRI, 0x03)},
+     {0x04, W(BNZ, 0xfe)}, {0x05, W(JMP, 0x05)}, {0xfe, W(LDI, 0x00)}, {0xff, W(XRI, 0x00)}},
+    {{0x00, W(LDI, 0x10)}, {0x01, W(STA, REG_IX)}, {0x02, W(LDI, 0x55)}, {0x03, W(STA, 0x0c)},
+     {0x04, W(LDI, 0xfb)}, {0x05, W(STA, 0x20)}, {0x06, W(LDA, 0xfe)}, {0x07, W(STX, 0x0b)},
+     {0x08, W(LDA, 0x20)}, {0x09, W(ADI, 0x01)}, {0x0a, W(STA, 0x20)}, {0x0b, W(BNZ, 0x06)},
+     {0x0c, W(JMP, 0x0c)}},
+};
+#undef W
+#define SEEDS (sizeof(seeds) / sizeof(seeds[0]))
+
+static void seed(image_t *img, unsigned i)
+{
+    unsigned k;
+
+    memset(img, 0, sizeof(*img));
+    img->len = ROM_SIZE;
+    for (k = 0; k < 16 && seeds[i][k].word != 0; ++k)
+	img->rom[seeds[i][k].addr] = seeds[i][k].word;
+}
+
+static void mutate(image_t *img, const image_t *corpus, unsigned count)
+{
+    unsigned n = 1 + rnd() % 4, a, b, k;
+
+    while (n--) {
+	a = rnd() % img->len;
+	switch (rnd() % 8) {
+	    case 0:
+		img->rom[a] = gen_word(img->len);
+		break;
+	    case 1:		/* the opcode only */
+		img->rom[a] = (img->rom[a] & 0xff) | (rnd() & 15) << 8;
+		break;
+	    case 2:		/* a special register operand */
+		img->rom[a] = (img->rom[a] & 0xf00) | (REG_IX + rnd() % 8);
+		break;
+	    case 3:
+		img->ram[rnd() % RAM_SIZE] = rnd();
+		break;
+	    case 4:
+		img->ram[rnd() % 16] = rnd() % img->len;
+		break;
+	    case 5:		/* a piece of another program */
+		if (count == 0)
+		    break;
+		b = rnd() % ROM_SIZE;
+		k = 1 + rnd() % 16;
+		if (a + k > ROM_SIZE)
+		    k = ROM_SIZE - a;
+		if (b + k > ROM_SIZE)
+		    k = ROM_SIZE - b;
+		memcpy(&img->rom[a], &corpus[rnd() % count].rom[b], k * sizeof(img->rom[0]));
+		break;
+	    case 6:		/* insert a word */
+		if (img->len == ROM_SIZE)
+		    break;
+		memmove(&img->rom[a + 1], &img->rom[a], (img->len - a) * sizeof(img->rom[0]));
+		img->rom[a] = gen_word(++img->len);
+		break;
+	    default:		/* delete a word */
+		if (img->len < 2)
+		    break;
+		memmove(&img->rom[a], &img->rom[a + 1], (img->len - a - 1) * sizeof(img->rom[0]));
+		img->rom[--img->len] = 0;
+		break;
+	}
+    }
+}
+
+/* clears ROM words and RAM bytes while the image still fails */
+static void minimize(const dut_t *d, image_t *img, unsigned long *limit, unsigned long window,
+		     mismatch_t *m)
+{
+    unsigned short *w;
+    unsigned char *b;
+    unsigned a, v, changed = 1;
+
+    *limit = m->cycle;
+
+    while (changed) {
+	changed = 0;
+	for (a = ROM_SIZE; a-- > 0;) {
+	    w = &img->rom[a];
+	    if ((v = *w) == 0)
+		continue;
+	    *w = 0;
+	    if (lockstep(d, img, *limit, window, NULL, m))
+		changed = 1;
+	    else
+		*w = v;
+	}
+	for (a = 0; a < RAM_SIZE; ++a) {
+	    b = &img->ram[a];
+	    if ((v = *b) == 0)
+		continue;
+	    *b = 0;
+	    if (lockstep(d, img, *limit, window, NULL, m))
+		changed = 1;
+	    else
+		*b = v;
+	}
+    }
+
+    lockstep(d, img, *limit, window, NULL, m);
+    *limit = m->cycle;
+}
+
+static int write_image(const char *prefix, const image_t *img)
+{
+    char name[FILENAME_MAX];
+    unsigned i;
+    FILE *f;
+
+    snprintf(name, sizeof(name), "%s.hex", prefix);
+    if ((f = fopen(name, "w")) == NULL) {
+	perror(name);
+	return -1;
+    }
+    for (i = 0; i < ROM_SIZE; ++i)
+	fprintf(f, (i & 15) == 15 ? " %03X\n" : " %03X", img->rom[i]);
+    if (fclose(f) != 0) {
+	perror(name);
+	return -1;
+    }
+
+    snprintf(name, sizeof(name), "%s.ram", prefix);
+    if ((f = fopen(name, "w")) == NULL) {
+	perror(name);
+	return -1;
+    }
+    dump_hex(f, img->ram, RAM_SIZE);
+    if (fclose(f) != 0) {
+	perror(name);
+	return -1;
+    }
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    unsigned i;
+
+    printf("Usage: %s [-d <dut>] [-n <runs>] [-t <seconds>] [-c <max-cycles>] [-s <seed>]\n"
+	   "       [-w <window>] [-C <cov-db>] [-o <prefix>]\n", prog);
+    printf("       dut:");
+    for (i = 0; duts[i].name != NULL; ++i)
+	printf(" %s", duts[i].name);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static image_t corpus[CORPUS_MAX], img;
+    const char *cov_name = NULL, *prefix = "fuzz-fail";
+    const dut_t *d = &duts[0];
+    unsigned long runs = 0, max_runs = 0, limit = DEFAULT_LIMIT, window = 0;
+    unsigned count = 0, fresh, hit, bins, i;
+    double seconds = 0, start, report;
+    cov_t goal;
+    mismatch_t m;
+    char buf[32];
+    int c;
+
+    rng_state = time(NULL) ^ (uint64_t) getpid() << 32;
+
+    while ((c = getopt(argc, argv, "d:n:t:c:s:w:C:o:")) != -1)
+	switch (c) {
+	    case 'd':
+		for (d = duts; d->name != NULL && strcmp(d->name, optarg) != 0; ++d)
+		    ;
+		if (d->name == NULL) {
+		    usage(argv[0]);
+		    return -1;
+		}
+		break;
+	    case 'n':
+		max_runs = strtoul(optarg, NULL, 0);
+		break;
+	    case 't':
+		seconds = atof(optarg);
+		break;
+	    case 'c':
+		limit = strtoul(optarg, NULL, 0);
+		break;
+	    case 's':
+		rng_state = strtoull(optarg, NULL, 0);
+		break;
+	    case 'w':
+		window = strtoul(optarg, NULL, 0);
+		break;
+	    case 'C':
+		cov_name = optarg;
+		break;
+	    case 'o':
+		prefix = optarg;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind != argc || limit == 0) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    if (window == 0)
+	window = d->window;
+    if (rng_state == 0)
+	rng_state = 1;
+
+#ifdef UCFUZZ_RTL
+    rtl = rtl_open();
+#endif
+
+    cov_goal(&goal, NULL);
+    start = report = now();
+
+    while (max_runs == 0 || runs < max_runs) {
+	if (runs < SEEDS)
+	    seed(&img, runs);
+	else if (count == 0 || rnd() % 8 == 0)
+	    gen(&img);
+	else {
+	    img = corpus[rnd() % count];
+	    mutate(&img, corpus, count);
+	}
+
+	fresh = 0;
+	if (lockstep(d, &img, limit, window, &fresh, &m)) {
+	    printf("mismatch after %lu runs at cycle %lu, PC %02X: %s\n", runs, m.cycle, m.pc,
+		   cfg_insn[img.rom[m.pc]].text);
+	    minimize(d, &img, &limit, window, &m);
+	    printf("minimized to %lu cycles, PC %02X: %s\n", m.cycle, m.pc, cfg_insn[img.rom[m.pc]].text);
+	    printf("%s: simulator %02X, %s %02X\n", m.what, m.ref, d->name, m.dut);
+	    if (write_image(prefix, &img) == 0)
+		printf("written to %s.hex and %s.ram, run with -c %lu\n", prefix, prefix, limit);
+	    return 1;
+	}
+
+	if (fresh != 0) {
+	    if (count < CORPUS_MAX)
+		corpus[count++] = img;
+	    else
+		corpus[rnd() % CORPUS_MAX] = img;
+	}
+
+	++runs;
+	if ((runs & 1023) == 0) {
+	    double t = now();
+
+	    if (t - report >= 1) {
+		fprintf(stderr, "%lu runs, %.2f Mcycles/s, corpus %u\n", runs,
+			total_cycles / (t - start) * 1e-6, count);
+		report = t;
+	    }
+	    if (seconds > 0 && t - start >= seconds)
+		break;
+	}
+    }
+
+    for (i = hit = bins = 0; i < COV_WORDS; ++i) {
+	hit += __builtin_popcountll(total_cov.w[i] & goal.w[i]);
+	bins += __builtin_popcountll(goal.w[i]);
+    }
+    printf("%lu runs, %lu cycles in %.1f s, corpus %u, coverage %u / %u bins, no mismatch\n",
+	   runs, total_cycles, now() - start, count, hit, bins);
+    for (i = 0; i < COV_BRANCH; ++i)
+	if (COV_HAS(&goal, i) && !COV_HAS(&total_cov, i))
+	    printf("missing: %s\n", cov_bin_name(i, buf, sizeof(buf)));
+
+    if (cov_name != NULL && cov_merge(cov_name, &total_cov) != 0) {
+	perror(cov_name);
+	return 2;
+    }
+
+#ifdef UCFUZZ_RTL
+    rtl_close(rtl);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,768 @@
+/*
+ * Explicit state model checker for uCPU programs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Explores every state a program reaches from reset for all the values of
+ * the input RAM cells (-i), breadth first, level by level in parallel, and
+ * checks the assertions in every state:
+ *
+ *   -a <lhs><op><value>  an invariant, lhs is pc, acc, ix, iy, x, cf, zf or
+ *                        [<address>] of RAM, op one of == != < <= > >=,
+ *                        the numbers in hex
+ *   -w                   IX and IY never wrap around in (IX)+ / -(IX) ...
+ *   -H <address>         every run halts, and on the "JMP" at the address
+ *
+ * A violation is reported with the shortest run leading to it, a run not
+ * halting at the address with the run up to the loop or the other halt.
+ *
+ * A state is the registers and the RAM cells that may be written, the
+ * other cells keep their initial values. The cells are the inputs, those
+ * of the assertions and those written in concrete runs of a sample of the
+ * inputs; a write anywhere else restarts the exploration with the cell
+ * added, after a few restarts with all the cells. X
+ * is left out of the state unless the program has "STX", IX and IY unless
+ * it uses the indirect modes. The states are packed into 64 bit words and
+ * kept in an open addressing hash set that the threads insert into with
+ * compare and swap, without locks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ucpu.h"
+#include "cfg.h"
+#include "cond.h"
+
+#define REGS        6		/* PC, Acc, IX, IY, X, CF | ZF << 1 */
+#define MAX_CELLS   RAM_SIZE
+#define MAX_WORDS   ((REGS + MAX_CELLS + 7) / 8)
+#define MAX_ASSERTS 16
+#define CHUNK       64		/* states taken by a thread at a time */
+#define MAX_RESTARTS 8		/* then all of RAM is in the state */
+#define SEED_RUNS   4096	/* concrete runs finding the cells written */
+#define SEED_STEPS  65536
+
+/* tags of the hash set slots, others are hashes */
+#define EMPTY  0
+#define BUSY   1
+
+/* successors of the states, or slot indices */
+#define NONE   UINT32_MAX	/* not expanded */
+#define HALTED (UINT32_MAX - 1)
+
+typedef struct {
+    cond_t cond;
+    const char *text;
+} assertion_t;
+
+typedef struct {
+    unsigned addr, lo, hi;
+} input_t;
+
+/* the program and the properties */
+
+static ucpu_t prog;
+static input_t input[MAX_CELLS];
+static unsigned inputs;
+static assertion_t assertion[MAX_ASSERTS];
+static unsigned assertions;
+static int check_wrap, halt_addr = -1, keep_x, keep_idx;
+
+/* the cells in the state */
+
+static unsigned char cell[MAX_CELLS];
+static unsigned cells;
+static unsigned char tracked[RAM_SIZE];
+static unsigned words;
+
+/* the hash set */
+
+static unsigned log_slots = 22;
+static size_t slots, mask;
+static uint64_t *tag, *state;
+static uint32_t *parent, *succ;
+static size_t used;
+
+/* the levels */
+
+static uint32_t *frontier[2];
+static size_t cur_n, next_n, cursor;
+static unsigned level, max_level, jobs;
+static pthread_barrier_t barrier;
+static int done, full;
+
+/* the findings */
+
+static uint32_t bad = NONE;
+static const char *bad_what;
+static uint64_t grow[RAM_SIZE / 64];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* states */
+
+static void track(unsigned a)
+{
+    if (!tracked[a]) {
+	tracked[a] = 1;
+	cell[cells++] = a;
+    }
+}
+
+static void encode(const ucpu_t *cpu, uint64_t *s)
+{
+    unsigned char b[MAX_WORDS * 8];
+    unsigned k;
+
+    memset(b, 0, words * 8);
+    b[0] = cpu->pc;
+    b[1] = cpu->acc;
+    if (keep_idx) {
+	b[2] = cpu->ix;
+	b[3] = cpu->iy;
+    }
+    if (keep_x)
+	b[4] = cpu->x;
+    b[5] = cpu->cf | cpu->zf << 1;
+    for (k = 0; k < cells; ++k)
+	b[REGS + k] = cpu->ram[cell[k]];
+
+    memcpy(s, b, words * 8);
+}
+
+static void decode(const uint64_t *s, ucpu_t *cpu)
+{
+    unsigned char b[MAX_WORDS * 8];
+    unsigned k;
+
+    memcpy(b, s, words * 8);
+    cpu->pc = b[0];
+    cpu->acc = b[1];
+    cpu->ix = b[2];
+    cpu->iy = b[3];
+    cpu->x = b[4];
+    cpu->cf = b[5] & 1;
+    cpu->zf = b[5] >> 1;
+    for (k = 0; k < cells; ++k)
+	cpu->ram[cell[k]] = b[REGS + k];
+}
+
+static uint64_t hash(const uint64_t *s)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    unsigned i;
+
+    for (i = 0; i < words; ++i) {
+	h ^= s[i];
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 32;
+    }
+
+    return h;
+}
+
+/*
+ * Adds the state to the set, returns 1 if it is new, 0 if it was there
+ * and -1 if the set is full. The slot is in *slot.
+ */
+static int insert(const uint64_t *s, uint32_t *slot)
+{
+    uint64_t h = hash(s), t, want = h < 2 ? h + 2 : h;
+    size_t i = h & mask;
+
+    for (;;) {
+	t = __atomic_load_n(&tag[i], __ATOMIC_ACQUIRE);
+	if (t == EMPTY) {
+	    if (__atomic_fetch_add(&used, 1, __ATOMIC_RELAXED) >= slots - slots / 4) {
+		__atomic_fetch_sub(&used, 1, __ATOMIC_RELAXED);
+		return -1;
+	    }
+	    t = EMPTY;
+	    if (__atomic_compare_exchange_n(&tag[i], &t, BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		memcpy(&state[i * words], s, words * 8);
+		parent[i] = succ[i] = NONE;
+		__atomic_store_n(&tag[i], want, __ATOMIC_RELEASE);
+		*slot = i;
+		return 1;
+	    }
+	    __atomic_fetch_sub(&used, 1, __ATOMIC_RELAXED);
+	    continue;
+	}
+	if (t == BUSY)
+	    continue;
+	if (t == want && memcmp(&state[i * words], s, words * 8) == 0) {
+	    *slot = i;
+	    return 0;
+	}
+	i = (i + 1) & mask;
+    }
+}
+
+/* properties */
+
+static void violation(uint32_t slot, const char *what)
+{
+    uint32_t none = NONE;
+
+    if (__atomic_compare_exchange_n(&bad, &none, slot, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	bad_what = what;
+}
+
+static void check(uint32_t slot, const ucpu_t *cpu)
+{
+    unsigned i;
+
+    for (i = 0; i < assertions; ++i)
+	if (!cond_holds(&assertion[i].cond, cpu)) {
+	    violation(slot, assertion[i].text);
+	    return;
+	}
+}
+
+/* the index register the instruction at PC increments or decrements, or NULL */
+static const unsigned char *inc_dec(const ucpu_t *cpu, int *dec)
+{
+    unsigned ir = cpu->rom[cpu->pc], op = ir >> 8, dat = ir & 0xff;
+
+    if ((op & 1) != 0 && op != OP_STX)
+	return NULL;
+    if (op == OP_BNC || dat < REG_IX_INC)
+	return NULL;
+    *dec = dat >= REG_DEC_IX;
+
+    return dat & 1 ? &cpu->iy : &cpu->ix;
+}
+
+/* RAM address the instruction at PC writes, or -1 */
+static int write_addr(const ucpu_t *cpu)
+{
+    unsigned ir = cpu->rom[cpu->pc], op = ir >> 8;
+
+    if (op != OP_STA && op != OP_STX)
+	return -1;
+
+    return ucpu_addr(cpu, ir & 0xff);
+}
+
+/* the exploration */
+
+static void expand(ucpu_t *cpu, uint32_t slot)
+{
+    uint64_t s[MAX_WORDS];
+    const unsigned char *idx;
+    uint32_t t;
+    int a, dec, r;
+
+    decode(&state[slot * words], cpu);
+
+    if (ucpu_halted(cpu)) {
+	succ[slot] = HALTED;
+	return;
+    }
+
+    if (check_wrap && (idx = inc_dec(cpu, &dec)) != NULL && *idx == (dec ? 0x00 : 0xff))
+	violation(slot, idx == &cpu->ix ? "IX wraps" : "IY wraps");
+
+    if ((a = write_addr(cpu)) >= 0 && !tracked[a]) {
+	__atomic_fetch_or(&grow[a >> 6], (uint64_t) 1 << (a & 63), __ATOMIC_RELAXED);
+	return;
+    }
+
+    ucpu_step(cpu);
+    encode(cpu, s);
+
+    if ((r = insert(s, &t)) < 0) {
+	full = 1;
+	return;
+    }
+    succ[slot] = t;
+    if (r) {
+	parent[t] = slot;
+	frontier[(level + 1) & 1][__atomic_fetch_add(&next_n, 1, __ATOMIC_RELAXED)] = t;
+	check(t, cpu);
+    }
+}
+
+static int stopped(void)
+{
+    unsigned i;
+
+    if (bad != NONE || full)
+	return 1;
+    for (i = 0; i < RAM_SIZE / 64; ++i)
+	if (grow[i] != 0)
+	    return 1;
+
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    ucpu_t cpu = prog;
+    size_t i, j, n;
+
+    for (;;) {
+	pthread_barrier_wait(&barrier);
+	if (done)
+	    break;
+
+	n = cur_n;
+	while ((i = __atomic_fetch_add(&cursor, CHUNK, __ATOMIC_RELAXED)) < n && !stopped())
+	    for (j = i; j < i + CHUNK && j < n; ++j)
+		expand(&cpu, frontier[level & 1][j]);
+
+	pthread_barrier_wait(&barrier);
+	if (*(unsigned *) arg == 0) {
+	    /* the first thread advances the level */
+	    ++level;
+	    cur_n = next_n;
+	    next_n = cursor = 0;
+	    done = stopped() || cur_n == 0 || (max_level != 0 && level >= max_level);
+	}
+    }
+
+    return NULL;
+}
+
+/* the next input values into the RAM, returns 0 after the last */
+static int next_inputs(unsigned char *ram)
+{
+    unsigned k;
+
+    for (k = 0; k < inputs && ram[input[k].addr] == input[k].hi; ++k)
+	ram[input[k].addr] = input[k].lo;
+    if (k == inputs)
+	return 0;
+    ++ram[input[k].addr];
+
+    return 1;
+}
+
+static void first_inputs(unsigned char *ram)
+{
+    unsigned k;
+
+    for (k = 0; k < inputs; ++k)
+	ram[input[k].addr] = input[k].lo;
+}
+
+static double combinations(void)
+{
+    double n = 1;
+    unsigned k;
+
+    for (k = 0; k < inputs; ++k)
+	n *= input[k].hi - input[k].lo + 1;
+
+    return n;
+}
+
+/* tracks the cells written in runs of every n-th input, up to SEED_RUNS runs */
+static void seed(void)
+{
+    ucpu_t run, cpu = prog;
+    unsigned long n = combinations() / SEED_RUNS + 1, i = 0, steps;
+    int a;
+
+    first_inputs(cpu.ram);
+    do {
+	if (i++ % n != 0)
+	    continue;
+	run = cpu;
+	for (steps = 0; steps < SEED_STEPS && !ucpu_halted(&run); ++steps) {
+	    if ((a = write_addr(&run)) >= 0)
+		track(a);
+	    ucpu_step(&run);
+	}
+    } while (next_inputs(cpu.ram));
+}
+
+/* the initial states for all the input values, returns -1 if too many */
+static int initial(void)
+{
+    ucpu_t cpu = prog;
+    uint64_t s[MAX_WORDS];
+    uint32_t t;
+    int r;
+
+    first_inputs(cpu.ram);
+    do {
+	encode(&cpu, s);
+	if ((r = insert(s, &t)) < 0)
+	    return -1;
+	if (r) {
+	    frontier[0][cur_n++] = t;
+	    check(t, &cpu);
+	}
+    } while (next_inputs(cpu.ram));
+
+    return 0;
+}
+
+static int explore(void)
+{
+    pthread_t tid[jobs];
+    unsigned id[jobs], i;
+
+    memset(tag, 0, slots * sizeof(*tag));
+    used = cur_n = next_n = cursor = 0;
+    level = 0;
+    done = full = 0;
+
+    if (initial() != 0)
+	return -1;
+    done = stopped() || cur_n == 0;
+
+    pthread_barrier_init(&barrier, NULL, jobs);
+    for (i = 0; i < jobs; ++i)
+	id[i] = i;
+    for (i = 1; i < jobs; ++i)
+	if (pthread_create(&tid[i], NULL, worker, &id[i]) != 0) {
+	    perror("pthread_create");
+	    exit(2);
+	}
+    worker(&id[0]);
+    for (i = 1; i < jobs; ++i)
+	pthread_join(tid[i], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    return full ? -1 : 0;
+}
+
+/* reports */
+
+static void print_state(uint32_t slot, unsigned n)
+{
+    ucpu_t cpu = prog;
+    const insn_t *i;
+
+    decode(&state[slot * words], &cpu);
+    i = &cfg_insn[cpu.rom[cpu.pc]];
+    printf("%5u  PC = %02X, Acc = %02X, IX = %02X, IY = %02X, CF = %u, ZF = %u, X = %02X  %s",
+	   n, cpu.pc, cpu.acc, cpu.ix, cpu.iy, cpu.cf, cpu.zf, cpu.x, i->text);
+    if (i->flow == FLOW_BRANCH || i->flow == FLOW_JUMP)
+	printf("%02X", i->dat);
+    printf("\n");
+}
+
+static void print_inputs(uint32_t root)
+{
+    ucpu_t cpu = prog;
+    unsigned k;
+
+    decode(&state[root * words], &cpu);
+    printf("inputs:");
+    for (k = 0; k < inputs; ++k)
+	printf(" [%02X] = %02X", input[k].addr, cpu.ram[input[k].addr]);
+    printf(inputs ? "\n" : " none\n");
+}
+
+/* the shortest run to the slot */
+static void print_trace(uint32_t slot)
+{
+    uint32_t *path = malloc((level + 2) * sizeof(*path));
+    unsigned n = 0, i;
+
+    for (; slot != NONE; slot = parent[slot])
+	path[n++] = slot;
+
+    print_inputs(path[n - 1]);
+    for (i = n; i-- > 0;)
+	print_state(path[i], n - 1 - i);
+
+    free(path);
+}
+
+/*
+ * Every run must halt at halt_addr. The runs are deterministic, so a state
+ * fails if its successor does, or if it is on a loop or a halt elsewhere.
+ * Returns a failing initial state, or NONE.
+ */
+enum {UNKNOWN, GOOD, FAILS, ON_PATH, OPEN};
+
+static uint32_t check_halts(int *open)
+{
+    unsigned char *status = calloc(slots, 1);
+    uint32_t *path = malloc(used * sizeof(*path)), s, u, found = NONE;
+    size_t i, n;
+    unsigned result;
+
+    *open = 0;
+    for (i = 0; i < slots; ++i) {
+	if (tag[i] < 2 || status[i] != UNKNOWN)
+	    continue;
+	n = 0;
+	for (s = i;; s = u) {
+	    status[s] = ON_PATH;
+	    path[n++] = s;
+	    u = succ[s];
+	    if (u == HALTED) {
+		/* PC is the first byte of a state */
+		result = *(unsigned char *) &state[s * words] == halt_addr ? GOOD : FAILS;
+		break;
+	    }
+	    if (u == NONE) {
+		result = OPEN;
+		break;
+	    }
+	    if (status[u] != UNKNOWN) {
+		result = status[u] == ON_PATH ? FAILS : status[u];
+		break;
+	    }
+	}
+	while (n > 0)
+	    status[path[--n]] = result;
+    }
+
+    for (i = 0; i < slots; ++i)
+	if (tag[i] >= 2 && parent[i] == NONE) {
+	    if (status[i] == FAILS && found == NONE)
+		found = i;
+	    *open |= status[i] == OPEN;
+	}
+
+    free(path);
+    free(status);
+
+    return found;
+}
+
+/* the run of a failing initial state up to the loop or the halt */
+static void print_run(uint32_t root)
+{
+    unsigned char *seen = calloc(slots, 1);
+    uint32_t s;
+    unsigned n = 0;
+
+    print_inputs(root);
+    for (s = root; s != HALTED && !seen[s]; s = succ[s]) {
+	seen[s] = 1;
+	print_state(s, n++);
+    }
+    if (s != HALTED) {
+	printf("loops back to\n");
+	print_state(s, n);
+    }
+
+    free(seen);
+}
+
+/* options */
+
+static int parse_input(const char *arg)
+{
+    input_t *in = &input[inputs];
+    char *end;
+
+    in->addr = strtoul(arg, &end, 16);
+    in->lo = 0;
+    in->hi = 0xff;
+    if (*end == '=') {
+	in->lo = strtoul(end + 1, &end, 16);
+	in->hi = in->lo;
+	if (*end == '-')
+	    in->hi = strtoul(end + 1, &end, 16);
+    }
+    if (*end != '\0' || in->addr >= RAM_SIZE || in->lo > in->hi || in->hi > 0xff || inputs == MAX_CELLS)
+	return -1;
+
+    ++inputs;
+
+    return 0;
+}
+
+static int parse_assertion(const char *arg)
+{
+    assertion_t *a = &assertion[assertions];
+    const char *end;
+
+    if (assertions == MAX_ASSERTS)
+	return -1;
+
+    a->text = arg;
+    if ((end = cond_parse(&a->cond, arg)) == NULL || *end != '\0')
+	return -1;
+
+    ++assertions;
+
+    return 0;
+}
+
+static void usage(const char *prog_name)
+{
+    printf("Usage: %s [-i <addr>[=<lo>[-<hi>]]]... [-a <assertion>]... [-w] [-H <addr>]\n"
+	   "       [-r <ram-init>] [-c <max-depth>] [-j <threads>] [-m <log2-states>] <rom>\n",
+	   prog_name);
+    printf("       assertion: pc|acc|ix|iy|x|cf|zf|[<addr>] ==|!=|<|<=|>|>= <value>, in hex\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ram_name = NULL;
+    unsigned a, k, ir, op;
+    uint32_t root;
+    double start;
+    int c, open, more, restarts = 0;
+
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((c = getopt(argc, argv, "i:a:wH:r:c:j:m:")) != -1)
+	switch (c) {
+	    case 'i':
+		if (parse_input(optarg) != 0) {
+		    fprintf(stderr, "bad input: %s\n", optarg);
+		    return -1;
+		}
+		break;
+	    case 'a':
+		if (parse_assertion(optarg) != 0) {
+		    fprintf(stderr, "bad assertion: %s\n", optarg);
+		    return -1;
+		}
+		break;
+	    case 'w':
+		check_wrap = 1;
+		break;
+	    case 'H':
+		halt_addr = strtoul(optarg, NULL, 16) & 0xff;
+		break;
+	    case 'r':
+		ram_name = optarg;
+		break;
+	    case 'c':
+		max_level = strtoul(optarg, NULL, 0);
+		break;
+	    case 'j':
+		jobs = strtoul(optarg, NULL, 0);
+		break;
+	    case 'm':
+		log_slots = strtoul(optarg, NULL, 0);
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind != argc - 1 || log_slots < 8 || log_slots > 31) {
+	usage(argv[0]);
+	return -1;
+    }
+    if (jobs == 0)
+	jobs = 1;
+
+    if (load_hex(argv[optind], prog.rom, ROM_SIZE, 1) < 0) {
+	perror(argv[optind]);
+	return 2;
+    }
+    if (ram_name != NULL && load_hex(ram_name, prog.ram, RAM_SIZE, 0) < 0) {
+	perror(ram_name);
+	return 2;
+    }
+    ucpu_reset(&prog);
+
+    slots = (size_t) 1 << log_slots;
+    mask = slots - 1;
+    if (combinations() > slots - slots / 4) {
+	fprintf(stderr, "%.0f input values, more than the states, see -m\n", combinations());
+	return 2;
+    }
+
+    /* the inputs, the cells of the properties and those written in test runs */
+    for (k = 0; k < inputs; ++k)
+	track(input[k].addr);
+    for (k = 0; k < assertions; ++k)
+	if (assertion[k].cond.lhs == COND_RAM)
+	    track(assertion[k].cond.cell);
+    seed();
+    for (a = 0; a < ROM_SIZE; ++a) {
+	ir = prog.rom[a];
+	op = ir >> 8;
+	keep_x |= op == OP_STX;
+	keep_idx |= (op & 1) == 0 && op != OP_BNC && (ir & 0xff) >= ISA_IND;
+	keep_idx |= op == OP_STX && (ir & 0xff) >= ISA_IND;
+    }
+    for (k = 0; k < assertions; ++k) {
+	keep_x |= assertion[k].cond.lhs == COND_X;
+	keep_idx |= assertion[k].cond.lhs == COND_IX || assertion[k].cond.lhs == COND_IY;
+    }
+
+    tag = calloc(slots, sizeof(*tag));
+    parent = malloc(slots * sizeof(*parent));
+    succ = malloc(slots * sizeof(*succ));
+    frontier[0] = malloc(slots * sizeof(*frontier[0]));
+    frontier[1] = malloc(slots * sizeof(*frontier[1]));
+    if (tag == NULL || parent == NULL || succ == NULL ||
+	frontier[0] == NULL || frontier[1] == NULL) {
+	perror("malloc");
+	return 2;
+    }
+
+    start = now();
+    for (;;) {
+	words = (REGS + cells + 7) / 8;
+	free(state);
+	if ((state = malloc(slots * words * sizeof(*state))) == NULL) {
+	    perror("malloc");
+	    return 2;
+	}
+
+	if (explore() != 0) {
+	    fprintf(stderr, "more than %zu states, see -m\n", slots - slots / 4);
+	    return 2;
+	}
+	if (bad != NONE)
+	    break;
+
+	/* restart with the cells written through IX / IY, or with all */
+	for (a = more = 0; a < RAM_SIZE; ++a)
+	    if (grow[a >> 6] >> (a & 63) & 1) {
+		track(a);
+		more = 1;
+	    }
+	if (!more)
+	    break;
+	if (++restarts == MAX_RESTARTS)
+	    for (a = 0; a < RAM_SIZE; ++a)
+		track(a);
+	memset(grow, 0, sizeof(grow));
+    }
+
+    printf("%zu states, %u levels, %u RAM cells, %.2f s\n", used, level, cells, now() - start);
+
+    if (bad != NONE) {
+	printf("violated: %s\n", bad_what);
+	print_trace(bad);
+	return 1;
+    }
+
+    if (halt_addr >= 0) {
+	root = check_halts(&open);
+	if (root != NONE) {
+	    printf("violated: halts at %02X\n", halt_addr);
+	    print_run(root);
+	    return 1;
+	}
+	if (open) {
+	    printf("inconclusive: depth limit reached\n");
+	    return 2;
+	}
+    } else if (max_level != 0 && level >= max_level && cur_n != 0) {
+	printf("holds up to depth %u\n", max_level);
+	return 0;
+    }
+
+    printf("holds\n");
+
+    return 0;
+}
@@ -0,0 +1,563 @@
+/*
+ * Failing program minimizer for uCPU.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Shrinks a ROM image and its RAM image while they still fail, by delta
+ * debugging: the candidates of a pass are smaller variants of the images,
+ * the first failing one is taken and the pass goes on from it, and the
+ * passes are repeated until none takes a candidate:
+ *
+ *   delete  - removes runs of words, halving their length down to one
+ *             word; the label operands of "BNC", "BNZ" and "JMP" after
+ *             a run are moved with the code, those into it go past it
+ *   gaps    - removes every run of zero words the source would skip with
+ *             "ORG", all at once first
+ *   words   - replaces a word with 000, an operand other than a label
+ *             with a smaller one: 0, 1, half of it or one less
+ *   RAM     - clears the image from an address on, the lowest first, then
+ *             replaces a byte with 0, 1 or half of it
+ *
+ * and a halt is put after the last word if they still fail with it.
+ *
+ * The candidates of a pass are run in parallel on the threads, each on
+ * the simulator of sim/ucpu.c. The first failing candidate in the order
+ * of the pass is the one taken, whatever the threads, so the result is
+ * the same on any machine. The minimized program is written to
+ * <prefix>.uca for ucasm, its RAM image to <prefix>.ram, truncated after
+ * the last non-zero byte, for ucsim -r.
+ *
+ * The images fail if
+ *
+ *   -d              ucpu_run_threaded() ends in a state other than that
+ *                   of ucpu_run(), the RAM and the cycles included
+ *   -b|-R|-W <w>    the run hits a watch of ucsim (see debug.h)
+ *   -x <command>    "<command> <rom> <ram>" exits with 0, the images are
+ *                   written for it to <prefix>.<thread>.hex and .ram; e.g.
+ *                   a script comparing ucsim with the RTL of tb/bench.v
+ *
+ * every run to a halt or the cycle limit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ucpu.h"
+#include "cfg.h"
+#include "debug.h"
+
+#define DEFAULT_LIMIT  1000000UL
+#define MAX_CANDIDATES (5 * ROM_SIZE)
+#define MAX_THREADS    256
+
+/* operand classes */
+enum {REG, IMM, LAB};
+#define OPERAND(name, c0, c1, c2, opcode, operand) [opcode] = operand,
+static const unsigned char operand[ISA_OPCODES] = {ISA_INSNS(OPERAND)};
+#undef OPERAND
+
+typedef struct {
+    unsigned short rom[ROM_SIZE];
+    unsigned char ram[RAM_SIZE];
+} image_t;
+
+/* the failure */
+static int differential;
+static debug_t dbg;
+static const char *command, *prefix = "min";
+static unsigned long limit = DEFAULT_LIMIT;
+
+/* the candidates of a pass */
+static image_t cand[MAX_CANDIDATES];
+static unsigned cand_at[MAX_CANDIDATES];	/* the address changed */
+static unsigned cands, threads;
+static unsigned next, first;	/* the next to run, the first failing one */
+static unsigned long runs;
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static int same_state(const ucpu_t *a, const ucpu_t *b)
+{
+    return a->pc == b->pc && a->acc == b->acc && a->ix == b->ix && a->iy == b->iy &&
+	a->x == b->x && a->cf == b->cf && a->zf == b->zf && a->cycles == b->cycles &&
+	memcmp(a->ram, b->ram, RAM_SIZE) == 0;
+}
+
+static int write_images(const image_t *img, const char *rom_name, const char *ram_name)
+{
+    unsigned i;
+    FILE *f;
+
+    if ((f = fopen(rom_name, "w")) == NULL)
+	return -1;
+    for (i = 0; i < ROM_SIZE; ++i)
+	fprintf(f, (i & 15) == 15 ? " %03X\n" : " %03X", img->rom[i]);
+    if (fclose(f) != 0 || (f = fopen(ram_name, "w")) == NULL)
+	return -1;
+    dump_hex(f, img->ram, RAM_SIZE);
+
+    return fclose(f);
+}
+
+static int fails(const image_t *img, unsigned thread)
+{
+    char rom_name[FILENAME_MAX], ram_name[FILENAME_MAX], cmd[2 * FILENAME_MAX + 1024];
+    ucpu_t ref, cpu;
+    decode_t dec;
+    const watch_t *hit = NULL;
+
+    if (command != NULL) {
+	snprintf(rom_name, sizeof(rom_name), "%s.%u.hex", prefix, thread);
+	snprintf(ram_name, sizeof(ram_name), "%s.%u.ram", prefix, thread);
+	if (write_images(img, rom_name, ram_name) != 0) {
+	    perror(rom_name);
+	    exit(1);
+	}
+	snprintf(cmd, sizeof(cmd), "%s %s %s", command, rom_name, ram_name);
+	return system(cmd) == 0;
+    }
+
+    memcpy(cpu.rom, img->rom, sizeof(cpu.rom));
+    memcpy(cpu.ram, img->ram, sizeof(cpu.ram));
+    ucpu_reset(&cpu);
+
+    if (!differential)
+	return ucpu_run_debug(&cpu, &dbg, limit, &hit) == HALT_WATCH;
+
+    ref = cpu;
+    ucpu_decode(&dec, &cpu, 0, ROM_SIZE);
+    ucpu_run(&ref, limit);
+    ucpu_run_threaded(&cpu, &dec, limit);
+
+    return !same_state(&ref, &cpu);
+}
+
+/* those of the command */
+static void remove_images(void)
+{
+    char name[FILENAME_MAX];
+    unsigned i;
+
+    for (i = 0; command != NULL && i < threads; ++i) {
+	snprintf(name, sizeof(name), "%s.%u.hex", prefix, i);
+	remove(name);
+	snprintf(name, sizeof(name), "%s.%u.ram", prefix, i);
+	remove(name);
+    }
+}
+
+/* runs the candidates up to the first failing one known */
+static void *worker(void *arg)
+{
+    unsigned thread = (unsigned long) arg, i, f;
+
+    while ((i = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) < cands &&
+	   i < __atomic_load_n(&first, __ATOMIC_RELAXED)) {
+	__atomic_fetch_add(&runs, 1, __ATOMIC_RELAXED);
+	if (!fails(&cand[i], thread))
+	    continue;
+	f = __atomic_load_n(&first, __ATOMIC_RELAXED);
+	while (i < f && !__atomic_compare_exchange_n(&first, &f, i, 0, __ATOMIC_RELAXED,
+						     __ATOMIC_RELAXED))
+	    ;
+    }
+
+    return NULL;
+}
+
+/* the first failing candidate, taken into *img, returns 0 if none fails */
+static int take_first(image_t *img)
+{
+    static pthread_t tid[MAX_THREADS];
+    unsigned long i, started;
+
+    next = 0;
+    first = cands;
+    for (started = 1; started < threads && started < cands; ++started)
+	if (pthread_create(&tid[started], NULL, worker, (void *) started) != 0)
+	    break;
+    worker((void *) 0);
+    for (i = 1; i < started; ++i)
+	pthread_join(tid[i], NULL);
+
+    if (first == cands)
+	return 0;
+    *img = cand[first];
+
+    return 1;
+}
+
+/* the words up to the last non-zero one */
+static unsigned rom_len(const image_t *img)
+{
+    unsigned len = ROM_SIZE;
+
+    while (len > 0 && img->rom[len - 1] == 0)
+	--len;
+
+    return len;
+}
+
+/* out is img without the n words from a on */
+static void delete_words(image_t *out, const image_t *img, unsigned a, unsigned n)
+{
+    unsigned i, w, t;
+
+    memcpy(out->ram, img->ram, sizeof(out->ram));
+    memset(out->rom, 0, sizeof(out->rom));
+
+    for (i = 0; i < ROM_SIZE - n; ++i) {
+	w = img->rom[i < a ? i : i + n];
+	if (operand[w >> 8 & 0xf] == LAB) {
+	    t = w & 0xff;
+	    t = t >= a + n ? t - n : t >= a ? a : t;
+	    w = (w & 0xf00) | t;
+	}
+	out->rom[i] = w;
+    }
+}
+
+static int pass_delete(image_t *img)
+{
+    unsigned len = rom_len(img), g = len / 2, a;
+    int taken = 0;
+
+    for (g = g ? g : 1; len > 0;) {
+	for (cands = 0, a = 0; a < len; a += g)
+	    delete_words(&cand[cands++], img, a, a + g < len ? g : len - a);
+	if (take_first(img)) {
+	    taken = 1;
+	    if ((len = rom_len(img)) < g)
+		g = len / 2 ? len / 2 : 1;
+	} else if (g == 1)
+	    break;
+	else
+	    g /= 2;
+    }
+
+    return taken;
+}
+
+/* the runs of zero words before the last non-zero one, the last run first */
+static unsigned zero_runs(const image_t *img, unsigned *at, unsigned *len)
+{
+    unsigned a = rom_len(img), n = 0, end;
+
+    while (a > 0) {
+	if (img->rom[--a] != 0)
+	    continue;
+	for (end = a + 1; a > 0 && img->rom[a - 1] == 0; --a)
+	    ;
+	at[n] = a;
+	len[n++] = end - a;
+    }
+
+    return n;
+}
+
+static int pass_gaps(image_t *img)
+{
+    static image_t all;
+    unsigned at[ROM_SIZE / 2], len[ROM_SIZE / 2], n, i;
+    int taken = 0;
+
+    while ((n = zero_runs(img, at, len)) > 0) {
+	/* all, then one at a time; deleting from the end keeps the rest in place */
+	all = *img;
+	for (i = 0; i < n; ++i) {
+	    delete_words(&cand[0], &all, at[i], len[i]);
+	    all = cand[0];
+	}
+	for (cands = 1, i = 0; n > 1 && i < n; ++i)
+	    delete_words(&cand[cands++], img, at[i], len[i]);
+	if (!take_first(img))
+	    break;
+	taken = 1;
+    }
+
+    return taken;
+}
+
+/* the simpler values of v in order, returns their number */
+static unsigned simpler(unsigned v, unsigned *s)
+{
+    unsigned c[4] = {0, 1, v / 2, v - 1}, i, j, n = 0;
+
+    for (i = 0; i < 4; ++i) {
+	if (c[i] >= v)
+	    continue;
+	for (j = 0; j < n && s[j] != c[i]; ++j)
+	    ;
+	if (j == n)
+	    s[n++] = c[i];
+    }
+
+    return n;
+}
+
+static int pass_words(image_t *img)
+{
+    unsigned from = 0, a, w, s[4], n, i, len;
+    int taken = 0;
+
+    while (from < (len = rom_len(img))) {
+	for (cands = 0, a = from; a < len; ++a) {
+	    if ((w = img->rom[a]) == 0)
+		continue;
+	    cand_at[cands] = a;
+	    cand[cands] = *img;
+	    cand[cands++].rom[a] = 0;
+	    n = operand[w >> 8 & 0xf] == LAB ? 0 : simpler(w & 0xff, s);
+	    for (i = 0; i < n; ++i) {
+		cand_at[cands] = a;
+		cand[cands] = *img;
+		cand[cands++].rom[a] = (w & 0xf00) | s[i];
+	    }
+	}
+	if (!take_first(img))
+	    break;
+	/* from the word taken, which may get simpler still */
+	from = cand_at[first];
+	taken = 1;
+    }
+
+    return taken;
+}
+
+/* the bytes up to the last non-zero one */
+static unsigned ram_len(const image_t *img)
+{
+    unsigned len = RAM_SIZE;
+
+    while (len > 0 && img->ram[len - 1] == 0)
+	--len;
+
+    return len;
+}
+
+static int pass_ram(image_t *img)
+{
+    unsigned from = 0, a, s[4], n, i, len = ram_len(img);
+    int taken = 0;
+
+    for (cands = 0, a = 0; a < len; ++a) {
+	cand[cands] = *img;
+	memset(cand[cands++].ram + a, 0, RAM_SIZE - a);
+    }
+    taken = take_first(img);
+
+    while (from < (len = ram_len(img))) {
+	for (cands = 0, a = from; a < len; ++a)
+	    for (i = 0, n = simpler(img->ram[a], s); i < n; ++i) {
+		cand_at[cands] = a;
+		cand[cands] = *img;
+		cand[cands++].ram[a] = s[i];
+	    }
+	if (!take_first(img))
+	    break;
+	from = cand_at[first];
+	taken = 1;
+    }
+
+    return taken;
+}
+
+/*
+ * A halt after the last word, if the images still fail with it, so a run
+ * falling through the zero words to the cycle limit needs none of them.
+ * After the passes, which would delete it again.
+ */
+static void try_halt(image_t *img)
+{
+    unsigned len = rom_len(img);
+
+    if (len == ROM_SIZE)
+	return;
+    cands = 1;
+    cand[0] = *img;
+    cand[0].rom[len] = OP_JMP << 8 | len;
+    take_first(img);
+}
+
+/*
+ * The source of the image, the zero words not run up to the failure and
+ * not labels skipped with "ORG", those after the last other word left
+ * out: ucasm fills the ROM with zeros.
+ */
+static int write_source(const char *name, const char *rom_name, const image_t *img)
+{
+    unsigned char run[ROM_SIZE] = {0}, label[ROM_SIZE] = {0};
+    const insn_t *in;
+    const watch_t *hit = NULL;
+    unsigned long until = limit;
+    ucpu_t cpu;
+    unsigned a, end, next_a = 0;
+    FILE *f;
+
+    memcpy(cpu.rom, img->rom, sizeof(cpu.rom));
+    memcpy(cpu.ram, img->ram, sizeof(cpu.ram));
+    ucpu_reset(&cpu);
+    if (dbg.watches != 0) {
+	ucpu_t hit_cpu = cpu;
+
+	ucpu_run_debug(&hit_cpu, &dbg, limit, &hit);
+	until = hit_cpu.cycles;
+    }
+    for (run[cpu.pc] = 1; cpu.cycles < until && !ucpu_halted(&cpu); run[cpu.pc] = 1)
+	ucpu_step(&cpu);
+
+    for (a = 0; a < ROM_SIZE; ++a)
+	if (operand[img->rom[a] >> 8 & 0xf] == LAB)
+	    label[img->rom[a] & 0xff] = 1;
+    for (end = ROM_SIZE; end > 0 && img->rom[end - 1] == 0 && !label[end - 1]; --end)
+	;
+
+    if ((f = fopen(name, "w")) == NULL)
+	return -1;
+    fprintf(f, ";\n; %s minimized, RAM image %s.ram\n;\n\tORG\t0\n", rom_name, prefix);
+    for (a = 0; a < end; ++a) {
+	if (img->rom[a] == 0 && !run[a] && !label[a])
+	    continue;
+	if (a != next_a)
+	    fprintf(f, "\tORG\t%02X\n", a);
+	next_a = a + 1;
+
+	if (label[a])
+	    fprintf(f, "$%u", a);
+	in = &cfg_insn[img->rom[a]];
+	if (in->flow == FLOW_BRANCH || in->flow == FLOW_JUMP)
+	    fprintf(f, "\t%s$%u\n", in->text, in->dat);
+	else
+	    fprintf(f, "\t%s\n", in->text);
+    }
+
+    return fclose(f);
+}
+
+static int write_ram(const char *name, const image_t *img)
+{
+    unsigned a, len = ram_len(img);
+    FILE *f;
+
+    if ((f = fopen(name, "w")) == NULL)
+	return -1;
+    for (a = 0; a < len; ++a)
+	fprintf(f, (a & 15) == 15 || a == len - 1 ? " %02X\n" : " %02X", img->ram[a]);
+
+    return fclose(f);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-j <threads>] [-c <max-cycles>] [-r <ram-init>] [-o <prefix>]\n"
+	   "       -d|-x <command>|-b|-R|-W <addr>[:<lhs><op><value>]... <rom>\n", prog);
+    printf("       lhs: pc|acc|ix|iy|x|cf|zf|[<addr>], op: ==|!=|<|<=|>|>=, in hex\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static image_t img;
+    const char *ram_name = NULL;
+    char name[FILENAME_MAX];
+    unsigned rom_words, ram_bytes;
+    int c, taken;
+    double t;
+
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((c = getopt(argc, argv, "j:c:r:o:dx:b:R:W:")) != -1)
+	switch (c) {
+	    case 'j':
+		threads = strtoul(optarg, NULL, 0);
+		break;
+	    case 'c':
+		limit = strtoul(optarg, NULL, 0);
+		break;
+	    case 'r':
+		ram_name = optarg;
+		break;
+	    case 'o':
+		prefix = optarg;
+		break;
+	    case 'd':
+		differential = 1;
+		break;
+	    case 'x':
+		command = optarg;
+		break;
+	    case 'b':
+	    case 'R':
+	    case 'W':
+		if (debug_add(&dbg, c == 'b' ? WATCH_PC : c == 'R' ? WATCH_READ : WATCH_WRITE,
+			      optarg) != 0) {
+		    fprintf(stderr, "%s: bad watch \"%s\"\n", argv[0], optarg);
+		    return -1;
+		}
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    /* one kind of failure */
+    if (optind != argc - 1 || differential + (command != NULL) + (dbg.watches != 0) != 1) {
+	usage(argv[0]);
+	return -1;
+    }
+    threads = threads == 0 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
+
+    if (load_hex(argv[optind], img.rom, ROM_SIZE, 1) < 0) {
+	perror(argv[optind]);
+	return 1;
+    }
+    if (ram_name != NULL && load_hex(ram_name, img.ram, RAM_SIZE, 0) < 0) {
+	perror(ram_name);
+	return 1;
+    }
+
+    if (!fails(&img, 0)) {
+	remove_images();
+	fprintf(stderr, "%s: the image does not fail\n", argv[optind]);
+	return 2;
+    }
+
+    rom_words = rom_len(&img);
+    ram_bytes = ram_len(&img);
+    t = now();
+    do {
+	taken = pass_delete(&img);
+	taken |= pass_gaps(&img);
+	taken |= pass_words(&img);
+	taken |= pass_ram(&img);
+    } while (taken);
+    try_halt(&img);
+    t = now() - t;
+
+    remove_images();
+
+    printf("ROM: %u -> %u words, RAM: %u -> %u bytes, %lu runs, %.3f s\n", rom_words,
+	   rom_len(&img), ram_bytes, ram_len(&img), runs, t);
+
+    snprintf(name, sizeof(name), "%s.uca", prefix);
+    if (write_source(name, argv[optind], &img) != 0) {
+	perror(name);
+	return 1;
+    }
+    snprintf(name, sizeof(name), "%s.ram", prefix);
+    if (write_ram(name, &img) != 0) {
+	perror(name);
+	return 1;
+    }
+
+    return 0;
+}
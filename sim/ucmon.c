@@ -0,0 +1,87 @@
+/*
+ * Live monitor of uCPU runs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Attaches to the event ring of "ucsim -S <ring>" (see ring.h), waiting
+ * for it to appear, and prints every record as uctrace does, or with -p
+ * only counts them and prints at the end of the run the executions of
+ * every ROM address and the reads and writes of every RAM cell. With -q
+ * it only counts the records. The records lost by a lossy ring are
+ * reported at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-p|-q] <ring>\n", prog);
+    printf("       -p  print a profile at the end instead of the records\n");
+    printf("       -q  print only the number of records\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static uint64_t retired[ROM_SIZE], reads[RAM_SIZE], writes[RAM_SIZE];
+    const trace_hdr_t *hdr;
+    ring_t *ring;
+    trace_rec_t r;
+    uint64_t cycle, records = 0, lost = 0;
+    unsigned a;
+    int c, profile = 0, quiet = 0;
+
+    while ((c = getopt(argc, argv, "pq")) != -1)
+	switch (c) {
+	    case 'p':
+		profile = 1;
+		break;
+	    case 'q':
+		quiet = 1;
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind != argc - 1) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    while ((ring = ring_attach(argv[optind])) == NULL)
+	usleep(10000);
+    hdr = ring_header(ring);
+
+    while (ring_get(ring, &r, &cycle, &lost)) {
+	++records;
+	if (profile) {
+	    ++retired[r.pc];
+	    if (r.flags & TR_READ)
+		++reads[r.addr];
+	    if (r.flags & TR_WRITE)
+		++writes[r.addr];
+	} else if (!quiet)
+	    trace_print(stdout, hdr, cycle, &r);
+    }
+
+    if (profile) {
+	printf("pc   insn  retired\n");
+	for (a = 0; a < ROM_SIZE; ++a)
+	    if (retired[a])
+		printf("%02X   %03X   %llu\n", a, hdr->rom[a], (unsigned long long) retired[a]);
+	printf("addr reads writes\n");
+	for (a = 0; a < RAM_SIZE; ++a)
+	    if (reads[a] || writes[a])
+		printf("%02X   %llu %llu\n", a, (unsigned long long) reads[a],
+		       (unsigned long long) writes[a]);
+    }
+    printf("records: %llu, lost: %llu\n", (unsigned long long) records,
+	   (unsigned long long) lost);
+
+    ring_detach(ring);
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * Instruction set simulator for uCPU, version 0.1.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * The semantics follow rtl/ucpu.v signal by signal:
+ *
+ *  - register operands F8 / F9 are plain RAM addresses, except that
+ *    "STA" to them also loads IX / IY (the RAM copy is written as well);
+ *  - register operands FA - FF select the indirect modes for every
+ *    instruction with i = 0 except "BNC", and for "STX";
+ *  - X latches the RAM data read by every instruction with i = 0
+ *    except "BNC" and "STA";
+ *  - "SBA" / "CPI" set CF on borrow, "CPI" leaves Acc untouched;
+ *  - "JPR" takes the jump address from RAM.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ucpu.h"
+
+void ucpu_reset(ucpu_t *cpu)
+{
+    cpu->pc = cpu->acc = cpu->ix = cpu->iy = cpu->x = 0;
+    cpu->cf = cpu->zf = 0;
+    cpu->cycles = 0;
+}
+
+/* RAM address of a register operand, updates IX / IY in the indirect modes */
+static unsigned char ea(ucpu_t *cpu, unsigned char dat)
+{
+    unsigned char *idx;
+
+    if (dat < 0xfa)
+	return dat;
+
+    idx = (dat & 1) ? &cpu->iy : &cpu->ix;
+
+    switch (dat & 6) {
+	case 2:			/* (IX), (IY) */
+	    return *idx;
+	case 4:			/* (IX)+, (IY)+ */
+	    return (*idx)++;
+	default:		/* -(IX), -(IY) */
+	    return --*idx;
+    }
+}
+
+unsigned ucpu_addr(const ucpu_t *cpu, unsigned dat)
+{
+    unsigned char idx = (dat & 1) ? cpu->iy : cpu->ix;
+
+    if (dat < ISA_IND)
+	return dat;
+
+    return (dat & 6) == 6 ? (unsigned char) (idx - 1) : idx;
+}
+
+#define READ(cpu, dat) ((cpu)->x = (cpu)->ram[ea(cpu, dat)])
+
+void ucpu_step(ucpu_t *cpu)
+{
+    unsigned ir = cpu->rom[cpu->pc];
+    unsigned char dat = ir;
+    unsigned r;
+
+    ++cpu->pc;
+    ++cpu->cycles;
+
+    switch (ir >> 8 & 0xf) {
+	case OP_ANA:
+	    dat = READ(cpu, dat);
+	    /* fall through */
+	case OP_ANI:
+	    cpu->acc &= dat;
+	    cpu->zf = !cpu->acc;
+	    break;
+	case OP_XRA:
+	    dat = READ(cpu, dat);
+	    /* fall through */
+	case OP_XRI:
+	    cpu->acc ^= dat;
+	    cpu->zf = !cpu->acc;
+	    break;
+	case OP_ADA:
+	    dat = READ(cpu, dat);
+	    /* fall through */
+	case OP_ADI:
+	    r = cpu->acc + dat;
+	    cpu->acc = r;
+	    cpu->cf = r >> 8 & 1;
+	    cpu->zf = !cpu->acc;
+	    break;
+	case OP_SBA:
+	    r = cpu->acc - READ(cpu, dat);
+	    cpu->acc = r;
+	    cpu->cf = r >> 8 & 1;
+	    cpu->zf = !cpu->acc;
+	    break;
+	case OP_CPI:
+	    r = cpu->acc - dat;
+	    cpu->cf = r >> 8 & 1;
+	    cpu->zf = !(r & 0xff);
+	    break;
+	case OP_BNC:
+	    if (!cpu->cf)
+		cpu->pc = dat;
+	    break;
+	case OP_BNZ:
+	    if (!cpu->zf)
+		cpu->pc = dat;
+	    break;
+	case OP_JPR:
+	    cpu->pc = READ(cpu, dat);
+	    break;
+	case OP_JMP:
+	    cpu->pc = dat;
+	    break;
+	case OP_LDA:
+	    cpu->acc = READ(cpu, dat);
+	    break;
+	case OP_LDI:
+	    cpu->acc = dat;
+	    break;
+	case OP_STA:
+	    if (dat == REG_IX)
+		cpu->ix = cpu->acc;
+	    else if (dat == REG_IY)
+		cpu->iy = cpu->acc;
+	    cpu->ram[ea(cpu, dat)] = cpu->acc;
+	    break;
+	case OP_STX:
+	    cpu->ram[ea(cpu, dat)] = cpu->x;
+	    break;
+    }
+}
+
+halt_t ucpu_run(ucpu_t *cpu, unsigned long max_cycles)
+{
+    while (cpu->cycles < max_cycles) {
+	if (ucpu_halted(cpu))
+	    return HALT_JMP;
+	ucpu_step(cpu);
+    }
+
+    return ucpu_halted(cpu) ? HALT_JMP : HALT_LIMIT;
+}
+
+/* reads a $readmemh style image, returns the number of words read or -1 */
+int load_hex(const char *name, void *mem, unsigned size, int wide)
+{
+    FILE *f;
+    unsigned i, word;
+
+    if ((f = fopen(name, "r")) == NULL)
+	return -1;
+
+    if (wide)
+	memset(mem, 0, size * sizeof(unsigned short));
+    else
+	memset(mem, 0, size);
+
+    for (i = 0; i < size && fscanf(f, "%x", &word) == 1; ++i)
+	if (wide)
+	    ((unsigned short *) mem)[i] = word & 0xfff;
+	else
+	    ((unsigned char *) mem)[i] = word;
+
+    fclose(f);
+
+    return i;
+}
+
+/* writes RAM in the same format as rtl/null.hex */
+int dump_hex(FILE *f, const unsigned char *mem, unsigned size)
+{
+    unsigned i;
+
+    for (i = 0; i < size; ++i)
+	fprintf(f, (i & 15) == 15 ? " %02X\n" : " %02X", mem[i]);
+
+    return ferror(f) ? -1 : 0;
+}
+
+const char *halt_name(halt_t halt)
+{
+    static const char *name[] = {"none", "jmp", "limit", "watch"};
+
+    return name[halt];
+}
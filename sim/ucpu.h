@@ -0,0 +1,79 @@
+/*
+ * Instruction set simulator for uCPU, version 0.1.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Cycle accurate reference model of rtl/ucpu.v. Every instruction takes
+ * exactly one clock cycle, so the cycle counter is the retired instruction
+ * counter. A "JMP" to its own address is treated as a halt: it is detected
+ * before execution and is not counted.
+ */
+
+#ifndef UCPU_H
+#define UCPU_H
+
+#include <stdio.h>
+
+#include "isa.h"
+
+#define ROM_SIZE 256
+#define RAM_SIZE 256
+
+/* opcode field of the instruction word (ccci), OP_ANA - OP_STX */
+#define OP_ENUM(name, c0, c1, c2, opcode, operand) OP_##name = opcode,
+enum {ISA_INSNS(OP_ENUM)};
+#undef OP_ENUM
+
+/* special register addresses, REG_IX, REG_IY, REG_AT_IX, ... */
+#define REG_ENUM(name, text, code) REG_##name = code,
+enum {ISA_REGS(REG_ENUM)};
+#undef REG_ENUM
+
+/* HALT_WATCH is a breakpoint or a watchpoint hit, see debug.h */
+typedef enum {HALT_NONE, HALT_JMP, HALT_LIMIT, HALT_WATCH} halt_t;
+
+typedef struct {
+    unsigned char pc, acc, ix, iy, x;
+    unsigned char cf, zf;
+    unsigned short rom[ROM_SIZE];
+    unsigned char ram[RAM_SIZE];
+    unsigned long cycles;
+} ucpu_t;
+
+/*
+ * Pre-decoded handler kinds of the threaded interpreter: 0 - 15 are the
+ * opcodes, then K_<name>_IND for the indirect modes of every REG operand
+ * instruction, then the special cases.
+ */
+#define K_IND(name, c0, c1, c2, opcode, operand) ISA_IF(REG, operand, K_##name##_IND,)
+enum {
+    K_IND_BEFORE = ISA_OPCODES - 1, ISA_INSNS(K_IND)
+    K_STA_IX, K_STA_IY, K_HALT, K_KINDS
+};
+#undef K_IND
+
+typedef struct {
+    unsigned char kind[ROM_SIZE];
+} decode_t;
+
+void ucpu_reset(ucpu_t *cpu);
+void ucpu_step(ucpu_t *cpu);
+halt_t ucpu_run(ucpu_t *cpu, unsigned long max_cycles);
+
+/* RAM address of register operand dat in this state, before the autoincrement */
+unsigned ucpu_addr(const ucpu_t *cpu, unsigned dat);
+
+unsigned char ucpu_decode_word(unsigned ir, unsigned addr);
+void ucpu_decode(decode_t *dec, const ucpu_t *cpu, unsigned from, unsigned to);
+halt_t ucpu_run_threaded(ucpu_t *cpu, const decode_t *dec, unsigned long max_cycles);
+
+/* ucpu_run() skipping the iterations of simple counted loops, see loop.c */
+halt_t ucpu_run_loops(ucpu_t *cpu, unsigned long max_cycles);
+
+/* true if the instruction at PC is a jump to itself */
+#define ucpu_halted(cpu) ((cpu)->rom[(cpu)->pc] == (OP_JMP << 8 | (cpu)->pc))
+
+int load_hex(const char *name, void *mem, unsigned size, int wide);
+int dump_hex(FILE *f, const unsigned char *mem, unsigned size);
+const char *halt_name(halt_t halt);
+
+#endif
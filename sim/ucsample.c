@@ -0,0 +1,444 @@
+/*
+ * Sampled simulation of long uCPU runs.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Estimates the cycles of a run on a detailed timing model, the ROM cache
+ * of romcache.h, by simulating in detail only a few intervals of it, the
+ * way SimPoint does:
+ *
+ *  - the run is made once functionally, cut into intervals of a fixed
+ *    number of instructions; the state at the start of every interval is
+ *    kept as its checkpoint, and the instructions it executes in every
+ *    basic block (a leader being any target of a taken jump or branch)
+ *    as its basic block vector, normalized and randomly projected to DIMS
+ *    dimensions;
+ *  - the vectors are clustered by k-means for k = 1 .. the maximum, from
+ *    SEEDS k-means++ starts each, and the smallest k whose BIC reaches 90%
+ *    of the range of the scores is taken, or 1 if the vectors hardly
+ *    differ;
+ *  - of every cluster the interval closest to the centroid, on ties not
+ *    the first one, is run on the model from its checkpoint, after the
+ *    last instructions of the interval before it warmed the cache up, or
+ *    for the first interval of a cluster of several its own first ones;
+ *  - the cycles are the sum over the clusters of the CPI of the
+ *    representative times the instructions of the cluster.
+ *
+ * With -f the whole run is also made on the model, for the error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "romcache.h"
+
+#define DEFAULT_LIMIT    1000000000UL
+#define DEFAULT_INTERVAL 1000000UL
+#define DEFAULT_WARMUP   10000UL
+#define DEFAULT_CLUSTERS 10
+#define DIMS             15
+#define SEEDS            5
+#define MAX_ITERATIONS   100
+#define SPREAD           1e-6	/* of the vectors around their mean, relative */
+
+typedef struct {
+    ucpu_t start;		/* the checkpoint */
+    uint64_t insns;
+    double v[DIMS];
+    unsigned cluster;
+} interval_t;
+
+static double proj[DIMS][ROM_SIZE];
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+
+    return rng_state;
+}
+
+/* uniform in [0, 1) */
+static double rng_unit(void)
+{
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-f] [-c <max-cycles>] [-r <ram-init>] [-i <interval>] [-k <max-clusters>]\n"
+	   "       [-w <warmup>] [-m <sets>:<ways>:<line>:<penalty>] <rom>\n", prog);
+}
+
+/* the functional run, the intervals in *ivs */
+static unsigned profile(ucpu_t *cpu, unsigned long limit, uint64_t size, interval_t **ivs)
+{
+    static uint64_t bbv[ROM_SIZE];
+    unsigned n = 0, cap = 0, b, d;
+    unsigned char leader = cpu->pc, next = cpu->pc, pc;
+    interval_t *iv;
+    uint64_t i;
+
+    *ivs = NULL;
+    while (cpu->cycles < limit && !ucpu_halted(cpu)) {
+	if (n == cap) {
+	    cap = cap ? 2 * cap : 1024;
+	    if ((iv = realloc(*ivs, cap * sizeof(*iv))) == NULL) {
+		free(*ivs);
+		*ivs = NULL;
+		return 0;
+	    }
+	    *ivs = iv;
+	}
+	iv = &(*ivs)[n++];
+	iv->start = *cpu;
+
+	memset(bbv, 0, sizeof(bbv));
+	for (i = 0; i < size && cpu->cycles < limit && !ucpu_halted(cpu); ++i) {
+	    pc = cpu->pc;
+	    if (pc != next)
+		leader = pc;
+	    ++bbv[leader];
+	    ucpu_step(cpu);
+	    next = pc + 1;
+	}
+	iv->insns = i;
+
+	for (d = 0; d < DIMS; ++d) {
+	    iv->v[d] = 0;
+	    for (b = 0; b < ROM_SIZE; ++b)
+		if (bbv[b])
+		    iv->v[d] += proj[d][b] * bbv[b];
+	    iv->v[d] /= i;
+	}
+    }
+
+    return n;
+}
+
+static double dist2(const double *a, const double *b)
+{
+    double s = 0;
+    unsigned d;
+
+    for (d = 0; d < DIMS; ++d)
+	s += (a[d] - b[d]) * (a[d] - b[d]);
+
+    return s;
+}
+
+/* k-means from a k-means++ start, the assignment in cl[], returns the distortion */
+static double kmeans(const interval_t *iv, unsigned n, unsigned k, double (*c)[DIMS],
+		     unsigned *cl)
+{
+    double *near = malloc(n * sizeof(*near)), sum, r, best, dd, distortion = 0;
+    unsigned i, j, d, it, changed, *count = calloc(k, sizeof(*count));
+
+    if (near == NULL || count == NULL) {
+	free(near);
+	free(count);
+	return HUGE_VAL;
+    }
+
+    /* k-means++: the next center by the square of the distance to the nearest */
+    memcpy(c[0], iv[rng() % n].v, sizeof(c[0]));
+    for (i = 0; i < n; ++i)
+	near[i] = dist2(iv[i].v, c[0]);
+    for (j = 1; j < k; ++j) {
+	for (i = 0, sum = 0; i < n; ++i)
+	    sum += near[i];
+	r = rng_unit() * sum;
+	for (i = 0; i + 1 < n && (r -= near[i]) > 0; ++i)
+	    ;
+	memcpy(c[j], iv[i].v, sizeof(c[j]));
+	for (i = 0; i < n; ++i)
+	    if ((dd = dist2(iv[i].v, c[j])) < near[i])
+		near[i] = dd;
+    }
+
+    for (i = 0; i < n; ++i)
+	cl[i] = k;
+    for (it = 0, changed = 1; changed && it < MAX_ITERATIONS; ++it) {
+	changed = 0;
+	distortion = 0;
+	for (i = 0; i < n; ++i) {
+	    for (j = 0, best = HUGE_VAL, d = 0; j < k; ++j)
+		if ((dd = dist2(iv[i].v, c[j])) < best) {
+		    best = dd;
+		    d = j;
+		}
+	    changed += cl[i] != d;
+	    cl[i] = d;
+	    distortion += best;
+	}
+
+	/* an empty cluster keeps its center */
+	memset(count, 0, k * sizeof(*count));
+	for (i = 0; i < n; ++i)
+	    ++count[cl[i]];
+	for (j = 0; j < k; ++j)
+	    if (count[j])
+		memset(c[j], 0, sizeof(c[j]));
+	for (i = 0; i < n; ++i)
+	    for (d = 0; d < DIMS; ++d)
+		c[cl[i]][d] += iv[i].v[d] / count[cl[i]];
+    }
+
+    free(near);
+    free(count);
+
+    return distortion;
+}
+
+/* the Bayesian information criterion of the clustering (Pelleg and Moore) */
+static double bic(unsigned n, unsigned k, const unsigned *cl, double distortion)
+{
+    double var, l = 0, p;
+    unsigned *count = calloc(k, sizeof(*count)), i;
+
+    if (count == NULL)
+	return -HUGE_VAL;
+    for (i = 0; i < n; ++i)
+	++count[cl[i]];
+
+    var = n > k ? distortion / (n - k) / DIMS : 0;
+    if (var <= 0)
+	var = 1e-12;
+    for (i = 0; i < k; ++i)
+	if (count[i])
+	    l += count[i] * log(count[i]) - count[i] * log(n) -
+		count[i] * DIMS / 2.0 * log(2 * M_PI * var) - (count[i] - 1) * DIMS / 2.0;
+    p = (k - 1) + DIMS * k + 1;
+    free(count);
+
+    return l - p / 2 * log(n);
+}
+
+/* the mean square of the vectors */
+static double norm2(const interval_t *iv, unsigned n)
+{
+    static const double zero[DIMS];
+    double s = 0;
+    unsigned i;
+
+    for (i = 0; i < n; ++i)
+	s += dist2(iv[i].v, zero);
+
+    return s / n;
+}
+
+/* the best clustering of 1 .. max clusters, returns k */
+static unsigned cluster(interval_t *iv, unsigned n, unsigned max, double (*c)[DIMS])
+{
+    unsigned k, s, i, best_k = 1, *cl, *cl_k, *cl_all;
+    double d, best_d, score[max + 1], lo = HUGE_VAL, hi = -HUGE_VAL, (*ck)[DIMS], (*c_all)[DIMS];
+
+    if (max > n)
+	max = n;
+    cl = malloc(n * sizeof(*cl));
+    cl_all = malloc((size_t) n * (max + 1) * sizeof(*cl_all));
+    c_all = malloc((size_t) (max + 1) * max * sizeof(*c_all));
+    ck = malloc(max * sizeof(*ck));
+    if (cl == NULL || cl_all == NULL || c_all == NULL || ck == NULL) {
+	free(cl);
+	free(cl_all);
+	free(c_all);
+	free(ck);
+	return 0;
+    }
+
+    for (k = 1; k <= max; ++k) {
+	cl_k = cl_all + (size_t) n * k;
+	for (s = 0, best_d = HUGE_VAL; s < SEEDS; ++s)
+	    if ((d = kmeans(iv, n, k, ck, cl)) < best_d) {
+		best_d = d;
+		memcpy(cl_k, cl, n * sizeof(*cl));
+		memcpy(c_all + (size_t) k * max, ck, k * sizeof(*ck));
+	    }
+	score[k] = bic(n, k, cl_k, best_d);
+	lo = score[k] < lo ? score[k] : lo;
+	hi = score[k] > hi ? score[k] : hi;
+
+	/* a steady run is one phase, more clusters only split the noise */
+	if (k == 1 && best_d / n < SPREAD * norm2(iv, n))
+	    break;
+    }
+
+    if (k <= max)
+	max = k;
+    for (k = 1; k <= max; ++k)
+	if (score[k] >= lo + 0.9 * (hi - lo)) {
+	    best_k = k;
+	    break;
+	}
+
+    for (i = 0; i < n; ++i)
+	iv[i].cluster = cl_all[(size_t) n * best_k + i];
+    memcpy(c, c_all + (size_t) best_k * max, best_k * sizeof(*c));
+
+    free(cl);
+    free(cl_all);
+    free(c_all);
+    free(ck);
+
+    return best_k;
+}
+
+/* the cycles of interval r on a fresh model, warmed up before it */
+static uint64_t detailed(const interval_t *iv, unsigned r, const rom_cache_t *model,
+			 uint64_t warmup)
+{
+    rom_cache_t c = *model;
+    ucpu_t cpu;
+
+    if (r > 0 && warmup > 0) {
+	cpu = iv[r - 1].start;
+	if (warmup > iv[r - 1].insns)
+	    warmup = iv[r - 1].insns;
+	ucpu_run(&cpu, cpu.cycles + iv[r - 1].insns - warmup);
+	rom_cache_run(&c, &cpu, warmup);
+	c.cycles = c.misses = 0;
+    } else if (warmup > 0) {
+	/* nothing ran before the first one, its own start warms up */
+	cpu = iv[r].start;
+	rom_cache_run(&c, &cpu, warmup < iv[r].insns ? warmup : iv[r].insns);
+	c.cycles = c.misses = 0;
+    }
+    cpu = iv[r].start;
+
+    rom_cache_run(&c, &cpu, iv[r].insns);
+
+    return c.cycles;
+}
+
+int main(int argc, char *argv[])
+{
+    static ucpu_t cpu;
+    static rom_cache_t model;
+    const char *ram_name = NULL;
+    unsigned long limit = DEFAULT_LIMIT;
+    uint64_t size = DEFAULT_INTERVAL, warmup = DEFAULT_WARMUP, insns = 0, sim = 0, cycles;
+    uint64_t *c_insns;
+    unsigned max = DEFAULT_CLUSTERS, sets = 4, ways = 2, line = 8, penalty = 8;
+    unsigned n, k, i, j, *rep, *members;
+    double (*c)[DIMS], estimate = 0, *cpi, dd, best;
+    interval_t *iv;
+    ucpu_t full;
+    halt_t halt;
+    int opt, full_run = 0;
+
+    while ((opt = getopt(argc, argv, "fc:r:i:k:w:m:")) != -1)
+	switch (opt) {
+	    case 'f':
+		full_run = 1;
+		break;
+	    case 'c':
+		limit = strtoul(optarg, NULL, 0);
+		break;
+	    case 'r':
+		ram_name = optarg;
+		break;
+	    case 'i':
+		size = strtoull(optarg, NULL, 0);
+		break;
+	    case 'k':
+		max = strtoul(optarg, NULL, 0);
+		break;
+	    case 'w':
+		warmup = strtoull(optarg, NULL, 0);
+		break;
+	    case 'm':
+		if (sscanf(optarg, "%u:%u:%u:%u", &sets, &ways, &line, &penalty) != 4) {
+		    usage(argv[0]);
+		    return -1;
+		}
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    if (optind != argc - 1 || size == 0 || max == 0 ||
+	rom_cache_init(&model, sets, ways, line, penalty) != 0) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    if (load_hex(argv[optind], cpu.rom, ROM_SIZE, 1) < 0) {
+	perror(argv[optind]);
+	return 1;
+    }
+
+    if (ram_name != NULL && load_hex(ram_name, cpu.ram, RAM_SIZE, 0) < 0) {
+	perror(ram_name);
+	return 1;
+    }
+
+    ucpu_reset(&cpu);
+    full = cpu;
+
+    for (i = 0; i < DIMS; ++i)
+	for (j = 0; j < ROM_SIZE; ++j)
+	    proj[i][j] = 2 * rng_unit() - 1;
+
+    n = profile(&cpu, limit, size, &iv);
+    halt = ucpu_halted(&cpu) ? HALT_JMP : HALT_LIMIT;
+    printf("halt: %s\n", halt_name(halt));
+    if (n == 0) {
+	printf("cycles: 0\n");
+	return halt == HALT_JMP ? 0 : 2;
+    }
+
+    c = malloc(max * sizeof(*c));
+    rep = calloc(max, sizeof(*rep));
+    members = calloc(max, sizeof(*members));
+    c_insns = calloc(max, sizeof(*c_insns));
+    cpi = calloc(max, sizeof(*cpi));
+    if (c == NULL || rep == NULL || members == NULL || c_insns == NULL || cpi == NULL ||
+	(k = cluster(iv, n, max, c)) == 0) {
+	perror("cluster");
+	return 1;
+    }
+
+    for (i = 0; i < n; ++i) {
+	insns += iv[i].insns;
+	++members[iv[i].cluster];
+	c_insns[iv[i].cluster] += iv[i].insns;
+    }
+
+    printf("instructions: %llu in %u intervals of %llu\n", (unsigned long long) insns, n,
+	   (unsigned long long) size);
+    printf("cluster  intervals  weight  rep        CPI\n");
+    for (j = 0; j < k; ++j) {
+	if (members[j] == 0)
+	    continue;
+	for (i = 0, best = HUGE_VAL; i < n; ++i)
+	    if (iv[i].cluster == j &&
+		((dd = dist2(iv[i].v, c[j])) < best || (dd == best && rep[j] == 0))) {
+		best = dd;
+		rep[j] = i;
+	    }
+	/* the first interval alone stands for the cold start only */
+	cycles = detailed(iv, rep[j], &model, rep[j] == 0 && members[j] == 1 ? 0 : warmup);
+	sim += iv[rep[j]].insns;
+	cpi[j] = (double) cycles / iv[rep[j]].insns;
+	estimate += cpi[j] * c_insns[j];
+	printf("%-8u %-10u %.4f  %-8u %.4f\n", j, members[j], (double) c_insns[j] / insns,
+	       rep[j], cpi[j]);
+    }
+    printf("detailed: %llu instructions (%.2f%%)\n", (unsigned long long) sim,
+	   100.0 * sim / insns);
+    printf("cycles: %.0f estimated, CPI %.4f\n", estimate, estimate / insns);
+
+    if (full_run) {
+	rom_cache_run(&model, &full, insns);
+	printf("cycles: %llu full, CPI %.4f, error %+.2f%%\n", (unsigned long long) model.cycles,
+	       (double) model.cycles / insns, 100.0 * (estimate - model.cycles) / model.cycles);
+    }
+
+    return halt == HALT_JMP ? 0 : 2;
+}
@@ -0,0 +1,220 @@
+/*
+ * Simulator for uCPU, version 0.1.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Runs a ROM image produced by ucasm from reset until the program halts
+ * ("JMP" to itself) or the cycle limit is reached, then prints the final
+ * machine state and optionally dumps the RAM in the rtl/null.hex format.
+ * With -C the coverage of the run is merged into a database (see cov.h).
+ * With -L simple counted loops are skipped (see loop.c), the final state
+ * is the same; -L has no effect together with -C.
+ *
+ * With -K, or $UCSIM_CACHE, the result is looked up in a persistent cache
+ * (see cache.h) first and stored there after a run, so a regression that
+ * runs the same ROM and RAM with the same limit again costs a lookup. A
+ * cache that cannot be opened is reported and the program runs normally.
+ * Runs with -L are not cached, the cache holds the results of ucpu_run().
+ *
+ * -b, -R and -W stop the run at a breakpoint, a RAM read or a RAM write
+ * (see debug.h), such runs are neither cached nor have loops skipped.
+ *
+ * -T writes a record per instruction executed to a trace file (see
+ * trace.h) for uctrace to query, -S publishes them live to the analyzers
+ * attached to a shared memory ring (see ring.h), lossy unless -l gives
+ * the number of readers a lossless run waits for. Such runs are not
+ * cached either.
+ *
+ * -P replays a core of a cluster alone from the log of its inputs written
+ * by "uccluster -w" (see replay.h), the RAM image is that of the log.
+ * Replays are not cached.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ucpu.h"
+#include "cov.h"
+#include "cache.h"
+#include "debug.h"
+#include "trace.h"
+#include "ring.h"
+#include "replay.h"
+
+#define DEFAULT_LIMIT 1000000UL
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-L] [-c <max-cycles>] [-r <ram-init>] [-o <ram-dump>] [-C <cov-db>] [-K <cache>]\n"
+	   "       [-T <trace>] [-S <ring> [-l <readers>]] [-P <replay>] [-b|-R|-W <addr>[:<lhs><op><value>]]...\n"
+	   "       <rom>\n", prog);
+    printf("       lhs: pc|acc|ix|iy|x|cf|zf|[<addr>], op: ==|!=|<|<=|>|>=, in hex\n");
+}
+
+static void print_state(FILE *f, const ucpu_t *cpu, halt_t halt)
+{
+    fprintf(f, "halt: %s\n", halt_name(halt));
+    fprintf(f, "cycles: %lu\n", cpu->cycles);
+    fprintf(f, "PC = %02X, Acc = %02X, IX = %02X, IY = %02X, CF = %u, ZF = %u, X = %02X\n",
+	    cpu->pc, cpu->acc, cpu->ix, cpu->iy, cpu->cf, cpu->zf, cpu->x);
+}
+
+int main(int argc, char *argv[])
+{
+    static ucpu_t cpu;
+    const char *ram_name = NULL, *dump_name = NULL, *cov_name = NULL, *trace_name = NULL;
+    const char *ring_name = NULL, *replay_name = NULL;
+    ring_t *ring;
+    replay_t *replay = NULL;
+    replay_hdr_t replay_hdr;
+    const char *cache_name = getenv("UCSIM_CACHE");
+    cache_t *cache = NULL;
+    cache_key_t key;
+    static debug_t dbg;
+    const watch_t *hit = NULL;
+    cov_t cov = {{0}};
+    unsigned long limit = DEFAULT_LIMIT, readers = 0;
+    FILE *dump_file, *trace_file;
+    halt_t halt;
+    int c, loops = 0;
+
+    while ((c = getopt(argc, argv, "Lc:r:o:C:K:T:S:l:P:b:R:W:")) != -1)
+	switch (c) {
+	    case 'L':
+		loops = 1;
+		break;
+	    case 'c':
+		limit = strtoul(optarg, NULL, 0);
+		break;
+	    case 'r':
+		ram_name = optarg;
+		break;
+	    case 'o':
+		dump_name = optarg;
+		break;
+	    case 'C':
+		cov_name = optarg;
+		break;
+	    case 'K':
+		cache_name = optarg;
+		break;
+	    case 'T':
+		trace_name = optarg;
+		break;
+	    case 'S':
+		ring_name = optarg;
+		break;
+	    case 'l':
+		readers = strtoul(optarg, NULL, 0);
+		break;
+	    case 'P':
+		replay_name = optarg;
+		break;
+	    case 'b':
+	    case 'R':
+	    case 'W':
+		if (debug_add(&dbg, c == 'b' ? WATCH_PC : c == 'R' ? WATCH_READ : WATCH_WRITE,
+			      optarg) != 0) {
+		    fprintf(stderr, "%s: bad watch \"%s\"\n", argv[0], optarg);
+		    return -1;
+		}
+		break;
+	    default:
+		usage(argv[0]);
+		return -1;
+	}
+
+    /* coverage, watches, a trace, a ring and a replay are each a run of its own */
+    if (optind != argc - 1 || readers > RING_READERS || (replay_name != NULL && ram_name != NULL) ||
+	(cov_name != NULL) + (dbg.watches != 0) + (trace_name != NULL) + (ring_name != NULL) +
+	(replay_name != NULL) > 1) {
+	usage(argv[0]);
+	return -1;
+    }
+
+    if (load_hex(argv[optind], cpu.rom, ROM_SIZE, 1) < 0) {
+	perror(argv[optind]);
+	return 1;
+    }
+
+    if (ram_name != NULL && load_hex(ram_name, cpu.ram, RAM_SIZE, 0) < 0) {
+	perror(ram_name);
+	return 1;
+    }
+
+    if (replay_name != NULL) {
+	if ((replay = replay_open(replay_name, &replay_hdr)) == NULL) {
+	    perror(replay_name);
+	    return 1;
+	}
+	memcpy(cpu.ram, replay_hdr.ram, RAM_SIZE);
+    }
+
+    ucpu_reset(&cpu);
+
+    if (cache_name != NULL && *cache_name != 0 && !loops && dbg.watches == 0 &&
+	trace_name == NULL && ring_name == NULL && replay_name == NULL &&
+	(cache = cache_open(cache_name)) == NULL)
+	perror(cache_name);
+
+    halt = HALT_NONE;
+    if (cache != NULL) {
+	cache_key(&key, &cpu, limit);
+	halt = cache_lookup(cache, &key, &cpu, cov_name != NULL ? &cov : NULL);
+    }
+
+    if (dbg.watches != 0)
+	halt = ucpu_run_debug(&cpu, &dbg, limit, &hit);
+    else if (trace_name != NULL) {
+	if ((trace_file = fopen(trace_name, "wb")) == NULL) {
+	    perror(trace_name);
+	    return 1;
+	}
+	halt = ucpu_run_trace(&cpu, limit, trace_file);
+	if (fclose(trace_file) != 0) {
+	    perror(trace_name);
+	    return 1;
+	}
+    } else if (ring_name != NULL) {
+	if ((ring = ring_create(ring_name, readers, &cpu)) == NULL) {
+	    perror(ring_name);
+	    return 1;
+	}
+	halt = ucpu_run_ring(&cpu, limit, ring);
+	ring_close(ring);
+    } else if (replay_name != NULL) {
+	halt = ucpu_run_replay(&cpu, replay, limit);
+	replay_close(replay);
+    } else if (halt == HALT_NONE) {
+	if (cov_name != NULL)
+	    halt = ucpu_run_cov(&cpu, limit, &cov);
+	else
+	    halt = loops ? ucpu_run_loops(&cpu, limit) : ucpu_run(&cpu, limit);
+	if (cache != NULL)
+	    cache_store(cache, &key, &cpu, halt, cov_name != NULL ? &cov : NULL);
+    }
+
+    if (cache != NULL)
+	cache_close(cache);
+
+    if (hit != NULL)
+	printf("watch: %s %s\n", watch_kind_name(hit->kind), hit->text);
+    print_state(stdout, &cpu, halt);
+
+    if (dump_name != NULL) {
+	if ((dump_file = fopen(dump_name, "w")) == NULL) {
+	    perror(dump_name);
+	    return 1;
+	}
+	dump_hex(dump_file, cpu.ram, RAM_SIZE);
+	fclose(dump_file);
+    }
+
+    if (cov_name != NULL && cov_merge(cov_name, &cov) != 0) {
+	perror(cov_name);
+	return 1;
+    }
+
+    return halt == HALT_JMP ? 0 : 2;
+}
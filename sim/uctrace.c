@@ -0,0 +1,550 @@
+/*
+ * Indexed queries over uCPU execution traces.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * Answers queries over a trace written by "ucsim -T" (see trace.h):
+ *
+ *   write <addr> [<from> [<to>]]   the writes to the RAM cell
+ *   read <addr> [<from> [<to>]]    the reads of it
+ *   retire <pc> [<from> [<to>]]    the executions of the instruction
+ *   flags [<from> [<to>]]          the cycles where CF or ZF changed
+ *   first <lhs>==<value> [<from>]  the first cycle where it holds, lhs is
+ *                                  pc, acc, ix, iy, x, cf or zf
+ *   state <cycle>                  the record of the cycle
+ *
+ * Addresses and values are in hex, cycles in decimal, a range is from
+ * <from> up to but not including <to>. The trace is mapped, next to it
+ * <trace>.idx is built when missing or made for another trace, one of
+ * another size, modification time (in ns) or header: the cycles of the writes
+ * and the reads of every RAM cell and of the executions of every ROM
+ * address as sorted lists, the flag changes, and for every segment of
+ * SEG_SIZE records the set of values each register takes in it. A list
+ * query is a binary search, "first" scans only the segments whose set
+ * holds the value, in parallel. The index is built in parallel over the
+ * segments, too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "cond.h"
+
+#define SEG_SIZE  (1UL << 18)	/* records */
+#define IDX_MAGIC 0x3230584449435554ULL	/* "TUCIDX02" */
+
+/* the lists of the index, by key: writes, reads, executions, flag changes */
+#define K_WRITE 0
+#define K_READ  (K_WRITE + RAM_SIZE)
+#define K_PC    (K_READ + RAM_SIZE)
+#define K_CF    (K_PC + ROM_SIZE)
+#define K_ZF    (K_CF + 1)
+#define KEYS    (K_ZF + 1)
+
+/* the value sets of the segments, in the order of the COND_ registers */
+enum {S_PC, S_ACC, S_IX, S_IY, S_X, SETS};
+
+typedef struct {
+    uint64_t magic, records, segments;
+    uint64_t size, mtime_sec, mtime_nsec, hdr_hash;	/* of the trace */
+    uint64_t off[KEYS + 1];	/* of the lists in list[] */
+} idx_hdr_t;
+
+/* the trace and the index */
+static const trace_hdr_t *hdr;
+static const trace_rec_t *rec;
+static uint64_t records, segments;
+static idx_hdr_t *idx;
+static uint64_t *list;		/* cycles, relative to the trace */
+static uint64_t (*sets)[SETS][4];
+
+static unsigned jobs;
+
+/* parallel over the segments */
+
+static void (*seg_fn)(uint64_t seg);
+static uint64_t next_seg;
+
+static void *worker(void *arg)
+{
+    uint64_t seg;
+
+    while ((seg = __atomic_fetch_add(&next_seg, 1, __ATOMIC_RELAXED)) < segments)
+	seg_fn(seg);
+
+    return NULL;
+}
+
+static void parallel(void (*fn)(uint64_t seg), uint64_t first_seg)
+{
+    pthread_t tid[jobs];
+    unsigned i, started = 0;
+
+    seg_fn = fn;
+    next_seg = first_seg;
+    for (i = 1; i < jobs; ++i)
+	if (pthread_create(&tid[started], NULL, worker, NULL) == 0)
+	    ++started;
+    worker(NULL);
+    for (i = 0; i < started; ++i)
+	pthread_join(tid[i], NULL);
+}
+
+/* index building */
+
+static uint32_t (*count)[KEYS];	/* per segment, then the starts in list[] */
+
+static unsigned rec_flags(uint64_t n)
+{
+    return n == 0 ? (hdr->cf ? TR_CF : 0) | (hdr->zf ? TR_ZF : 0) : rec[n - 1].flags;
+}
+
+/* calls fn(key, n) for the list entries of record n */
+#define FOR_KEYS(n, fn) \
+    do { \
+	const trace_rec_t *r_ = &rec[n]; \
+	unsigned prev_ = rec_flags(n); \
+	if (r_->flags & TR_WRITE) \
+	    fn(K_WRITE + r_->addr, n); \
+	if (r_->flags & TR_READ) \
+	    fn(K_READ + r_->addr, n); \
+	fn(K_PC + r_->pc, n); \
+	if ((r_->flags ^ prev_) & TR_CF) \
+	    fn(K_CF, n); \
+	if ((r_->flags ^ prev_) & TR_ZF) \
+	    fn(K_ZF, n); \
+    } while (0)
+
+static void count_seg(uint64_t seg)
+{
+    uint64_t n, end = (seg + 1) * SEG_SIZE < records ? (seg + 1) * SEG_SIZE : records;
+    uint32_t *c = count[seg];
+    uint64_t (*s)[4] = sets[seg];
+    const trace_rec_t *r;
+
+#define COUNT(key, n) ++c[key]
+#define ADD(set, v) ((set)[(v) >> 6] |= (uint64_t) 1 << ((v) & 63))
+    for (n = seg * SEG_SIZE; n < end; ++n) {
+	FOR_KEYS(n, COUNT);
+	r = &rec[n];
+	ADD(s[S_PC], r->pc);
+	ADD(s[S_ACC], r->acc);
+	ADD(s[S_IX], r->ix);
+	ADD(s[S_IY], r->iy);
+	ADD(s[S_X], r->x);
+    }
+#undef COUNT
+#undef ADD
+}
+
+static void fill_seg(uint64_t seg)
+{
+    uint64_t n, end = (seg + 1) * SEG_SIZE < records ? (seg + 1) * SEG_SIZE : records;
+    uint64_t pos[KEYS];
+    unsigned k;
+
+    for (k = 0; k < KEYS; ++k)
+	pos[k] = idx->off[k] + count[seg][k];
+
+#define FILL(key, n) (list[pos[key]++] = (n))
+    for (n = seg * SEG_SIZE; n < end; ++n)
+	FOR_KEYS(n, FILL);
+#undef FILL
+}
+
+static size_t idx_size(uint64_t entries)
+{
+    return sizeof(idx_hdr_t) + entries * sizeof(uint64_t) + segments * sizeof(*sets);
+}
+
+static void *map_idx(void *base)
+{
+    idx = base;
+    list = (uint64_t *) (idx + 1);
+    sets = (uint64_t (*)[SETS][4]) (list + idx->off[KEYS]);
+
+    return base;
+}
+
+/* FNV-1a of the trace header */
+static uint64_t hdr_hash(void)
+{
+    const unsigned char *p = (const unsigned char *) hdr;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < sizeof(*hdr); ++i)
+	h = (h ^ p[i]) * 0x100000001b3ULL;
+
+    return h;
+}
+
+/* the fields of the index header identifying the trace */
+static void trace_id(idx_hdr_t *h, const struct stat *st_trace)
+{
+    h->records = records;
+    h->segments = segments;
+    h->size = st_trace->st_size;
+    h->mtime_sec = st_trace->st_mtim.tv_sec;
+    h->mtime_nsec = st_trace->st_mtim.tv_nsec;
+    h->hdr_hash = hdr_hash();
+}
+
+static int build_index(const char *trace_name, const struct stat *st_trace, const char *name)
+{
+    char tmp[FILENAME_MAX];
+    uint64_t (*seg_sets)[SETS][4];
+    uint64_t seg, total[KEYS], run, start;
+    idx_hdr_t h;
+    unsigned k;
+    size_t size;
+    void *base;
+    int fd, rc = -1;
+
+    /* counts and sets first, then the lists go to their places */
+    count = calloc(segments ? segments : 1, sizeof(*count));
+    seg_sets = calloc(segments ? segments : 1, sizeof(*seg_sets));
+    if (count == NULL || seg_sets == NULL)
+	goto out;
+    sets = seg_sets;
+    parallel(count_seg, 0);
+
+    memset(&h, 0, sizeof(h));
+    h.magic = IDX_MAGIC;
+    trace_id(&h, st_trace);
+    memset(total, 0, sizeof(total));
+    for (seg = 0; seg < segments; ++seg)
+	for (k = 0; k < KEYS; ++k) {
+	    start = total[k];
+	    total[k] += count[seg][k];
+	    count[seg][k] = start;	/* within the list of the key */
+	}
+    for (k = 0, run = 0; k < KEYS; ++k) {
+	h.off[k] = run;
+	run += total[k];
+    }
+    h.off[KEYS] = run;
+
+    snprintf(tmp, sizeof(tmp), "%s.idx.tmp", trace_name);
+    size = idx_size(run);
+    if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+	goto out;
+    if (ftruncate(fd, size) != 0 ||
+	(base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+	close(fd);
+	goto out;
+    }
+    close(fd);
+
+    memcpy(base, &h, sizeof(h));
+    map_idx(base);
+    memcpy(sets, seg_sets, segments * sizeof(*sets));
+    parallel(fill_seg, 0);
+
+    munmap(base, size);
+    rc = rename(tmp, name);
+
+out:
+    free(count);
+    free(seg_sets);
+
+    return rc;
+}
+
+/* maps the index, building it if needed */
+static int open_index(const char *trace_name)
+{
+    char name[FILENAME_MAX];
+    struct stat st_trace, st;
+    idx_hdr_t h, id;
+    void *base;
+    int fd, built = 0;
+
+    snprintf(name, sizeof(name), "%s.idx", trace_name);
+    if (stat(trace_name, &st_trace) != 0)
+	return -1;
+    trace_id(&id, &st_trace);
+
+    for (;;) {
+	if ((fd = open(name, O_RDONLY)) >= 0) {
+	    if (fstat(fd, &st) == 0 && read(fd, &h, sizeof(h)) == sizeof(h) &&
+		h.magic == IDX_MAGIC && h.records == id.records && h.segments == id.segments &&
+		h.size == id.size && h.mtime_sec == id.mtime_sec &&
+		h.mtime_nsec == id.mtime_nsec && h.hdr_hash == id.hdr_hash &&
+		(size_t) st.st_size == idx_size(h.off[KEYS])) {
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED)
+		    return -1;
+		map_idx(base);
+		return 0;
+	    }
+	    close(fd);
+	}
+	if (built) {
+	    errno = EINVAL;
+	    return -1;
+	}
+	if (build_index(trace_name, &st_trace, name) != 0)
+	    return -1;
+	built = 1;
+    }
+}
+
+/* queries */
+
+static void print_rec(uint64_t n)
+{
+    trace_print(stdout, hdr, hdr->start_cycle + n, &rec[n]);
+}
+
+/* the entries of the list of the key in [from, to) */
+static const uint64_t *find(unsigned key, uint64_t from, const uint64_t **end)
+{
+    const uint64_t *lo = list + idx->off[key];
+    size_t a = 0, b = idx->off[key + 1] - idx->off[key], m;
+
+    *end = lo + b;
+    while (a < b) {
+	m = a + (b - a) / 2;
+	if (lo[m] < from)
+	    a = m + 1;
+	else
+	    b = m;
+    }
+
+    return lo + a;
+}
+
+static unsigned long query_list(unsigned key, uint64_t from, uint64_t to)
+{
+    const uint64_t *end, *p = find(key, from, &end);
+    unsigned long found = 0;
+
+    for (; p < end && *p < to; ++p, ++found)
+	print_rec(*p);
+
+    return found;
+}
+
+/* the CF and the ZF changes merged, a cycle changing both once */
+static unsigned long query_flags(uint64_t from, uint64_t to)
+{
+    const uint64_t *c_end, *z_end, *c = find(K_CF, from, &c_end), *z = find(K_ZF, from, &z_end);
+    uint64_t n;
+    unsigned long found = 0;
+
+    for (;; ++found) {
+	n = c < c_end ? *c : UINT64_MAX;
+	if (z < z_end && *z < n)
+	    n = *z;
+	if (n >= to)
+	    break;
+	print_rec(n);
+	c += c < c_end && *c == n;
+	z += z < z_end && *z == n;
+    }
+
+    return found;
+}
+
+static unsigned first_lhs, first_value;
+static uint64_t first_from, first_found;
+
+static unsigned rec_value(const trace_rec_t *r, unsigned lhs)
+{
+    switch (lhs) {
+	case COND_PC:
+	    return r->pc;
+	case COND_ACC:
+	    return r->acc;
+	case COND_IX:
+	    return r->ix;
+	case COND_IY:
+	    return r->iy;
+	case COND_X:
+	    return r->x;
+	case COND_CF:
+	    return !!(r->flags & TR_CF);
+	default:
+	    return !!(r->flags & TR_ZF);
+    }
+}
+
+static void first_seg(uint64_t seg)
+{
+    uint64_t n, found, end = (seg + 1) * SEG_SIZE < records ? (seg + 1) * SEG_SIZE : records;
+    const uint64_t *set = sets[seg][first_lhs];
+
+    /* a later segment than the one found, or the value is not in it */
+    if (seg * SEG_SIZE >= __atomic_load_n(&first_found, __ATOMIC_RELAXED) ||
+	(first_lhs < SETS && !(set[first_value >> 6] >> (first_value & 63) & 1)))
+	return;
+
+    for (n = seg * SEG_SIZE > first_from ? seg * SEG_SIZE : first_from; n < end; ++n)
+	if (rec_value(&rec[n], first_lhs) == first_value)
+	    break;
+    if (n == end)
+	return;
+
+    found = __atomic_load_n(&first_found, __ATOMIC_RELAXED);
+    while (n < found &&
+	   !__atomic_compare_exchange_n(&first_found, &found, n, 0, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+	;
+}
+
+static int query_first(const char *text, uint64_t from)
+{
+    const char *end;
+    cond_t c;
+
+    /* the registers in the records only */
+    if ((end = cond_parse(&c, text)) == NULL || *end != '\0' || c.lhs >= COND_RAM ||
+	c.op != COND_EQ || c.value > 0xff)
+	return -1;
+    first_lhs = c.lhs;
+    first_value = c.value;
+
+    first_from = from;
+    first_found = UINT64_MAX;
+    if (from < records)
+	parallel(first_seg, from / SEG_SIZE);
+
+    if (first_found == UINT64_MAX)
+	printf("not found\n");
+    else
+	print_rec(first_found);
+
+    return 0;
+}
+
+/* cycles are those of the run, relative to the trace here */
+static uint64_t cycle_arg(const char *s, uint64_t none)
+{
+    uint64_t c;
+
+    if (s == NULL)
+	return none;
+    c = strtoull(s, NULL, 10);
+
+    return c < hdr->start_cycle ? 0 : c - hdr->start_cycle;
+}
+
+static int query(char *text)
+{
+    char *word[4] = {NULL}, *save;
+    unsigned words = 0, addr;
+    uint64_t from, to;
+
+    while (words < 4 && (word[words] = strtok_r(words ? NULL : text, " ", &save)) != NULL)
+	++words;
+    if (words == 0 || (words == 4 && strtok_r(NULL, " ", &save) != NULL))
+	return -1;
+
+    if (strcmp(word[0], "flags") == 0) {
+	from = cycle_arg(word[1], 0);
+	to = cycle_arg(word[2], UINT64_MAX);
+	if (query_flags(from, to) == 0)
+	    printf("none\n");
+	return words > 3 ? -1 : 0;
+    }
+    if (words < 2)
+	return -1;
+
+    if (strcmp(word[0], "first") == 0)
+	return words > 3 ? -1 : query_first(word[1], cycle_arg(word[2], 0));
+
+    if (strcmp(word[0], "state") == 0) {
+	from = cycle_arg(word[1], 0);
+	if (from >= records)
+	    printf("not in the trace\n");
+	else
+	    print_rec(from);
+	return words == 2 ? 0 : -1;
+    }
+
+    addr = strtoul(word[1], NULL, 16) & 0xff;
+    from = cycle_arg(word[2], 0);
+    to = cycle_arg(word[3], UINT64_MAX);
+    if (strcmp(word[0], "write") == 0)
+	addr += K_WRITE;
+    else if (strcmp(word[0], "read") == 0)
+	addr += K_READ;
+    else if (strcmp(word[0], "retire") == 0)
+	addr += K_PC;
+    else
+	return -1;
+    if (query_list(addr, from, to) == 0)
+	printf("none\n");
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-j <threads>] <trace> <query>...\n", prog);
+    printf("       query: \"write|read <addr> [<from> [<to>]]\", \"retire <pc> [<from> [<to>]]\",\n"
+	   "              \"flags [<from> [<to>]]\", \"first <lhs>==<value> [<from>]\", \"state <cycle>\"\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct stat st;
+    void *base;
+    int fd, c, i;
+
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((c = getopt(argc, argv, "j:")) != -1)
+	switch (c) {
+	    case 'j':
+		jobs = strtoul(optarg, NULL, 0);
+		break;
+	    default:
+		usage(argv[0]);
+		return 2;
+	}
+
+    if (optind > argc - 2 || jobs == 0) {
+	usage(argv[0]);
+	return 2;
+    }
+
+    if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+	perror(argv[optind]);
+	return 2;
+    }
+    if ((size_t) st.st_size < sizeof(*hdr) ||
+	(base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ||
+	((const trace_hdr_t *) base)->magic != TRACE_MAGIC) {
+	fprintf(stderr, "%s: not a trace\n", argv[optind]);
+	return 2;
+    }
+    close(fd);
+
+    hdr = base;
+    rec = (const trace_rec_t *) (hdr + 1);
+    records = (st.st_size - sizeof(*hdr)) / sizeof(*rec);
+    segments = (records + SEG_SIZE - 1) / SEG_SIZE;
+
+    if (open_index(argv[optind]) != 0) {
+	perror("index");
+	return 2;
+    }
+
+    for (i = optind + 1; i < argc; ++i)
+	if (query(argv[i]) != 0) {
+	    fprintf(stderr, "bad query \"%s\"\n", argv[i]);
+	    return 2;
+	}
+
+    return 0;
+}
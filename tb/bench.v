@@ -0,0 +1,195 @@
+`timescale 1 ns / 10 ps
+
+// Benchmark testbench: runs the program from reset until it halts on a
+// "JMP" to itself or the cycle limit is reached, then prints the cycle
+// count and the final state and dumps the RAM in the rtl/null.hex format.
+// The halting "JMP" is not counted, as in sim/ucsim.
+//
+// With +repeat=<n> the program is run n times, reloading the RAM image
+// and resetting the uCPU between the runs, to measure simulation speed
+// without the start-up cost. The cycle count printed is that of one run.
+//
+// With +cov=<file> the functional coverage of the run is written to the
+// file in the bin layout of sim/cov.h, a 64 bit word in hex per line, for
+// sim/uccov to merge with the databases of ucsim -C.
+//
+// Plusargs: +rom=<hex> +ram=<hex> (see rtl/mem.v), +dump=<file>, +limit=<n>,
+//           +repeat=<n>, +cov=<file>
+
+module bench;
+
+reg         clk, rst;
+wire        wr_en;
+wire  [7:0] rom_abus;
+wire [11:0] rom_dbus;
+wire  [7:0] ram_abus;
+wire  [7:0] ram_dbus;
+
+integer         cycles, limit, runs, repeats, fd, i;
+reg [8*256-1:0] dump, cov_file;
+
+// coverage bins, see sim/cov.h
+
+localparam COV_MODE = 0, COV_ZF = 144, COV_CF = 160, COV_STX = 168, COV_BRANCH = 176;
+
+reg   [703:0] cov;
+reg           cov_en, cov_pend;
+reg     [3:0] cov_op;
+reg     [2:0] x_src;
+
+// uCPU instance, the behavioral one of tb/ucpu_fast.v with -DUCPU_FAST
+
+`ifdef UCPU_FAST
+uCPU_fast uCPU0 (
+`else
+uCPU uCPU0 (
+`endif
+    .clk(clk),
+    .rom_addr(rom_abus),
+    .rom_data(rom_dbus),
+    .ram_addr(ram_abus),
+    .ram_data(ram_dbus),
+    .wr_en(wr_en),
+    .rst(rst));
+
+// ROM instance
+
+rom rom0 (
+    .abus(rom_abus),
+    .dbus(rom_dbus),
+    .en(1'b1));
+
+// RAM instance
+
+ram ram0 (
+    .clk(clk),
+    .abus(ram_abus),
+    .dbus(ram_dbus),
+    .wr_en(wr_en));
+
+// Clocks
+
+always
+    #10 clk <= ~clk;
+
+// final state and RAM dump
+
+task finish_run;
+    begin
+	$display("cycles: %0d", cycles);
+	$display("PC = %h, Acc = %h, IX = %h, IY = %h, CF = %b, ZF = %b, X = %h",
+		 uCPU0.PC, uCPU0.Acc, uCPU0.IX, uCPU0.IY, uCPU0.CF, uCPU0.ZF, uCPU0.X);
+	fd = $fopen(dump, "w");
+	for (i = 0; i < 256; i = i + 1)
+	    begin
+		$fwrite(fd, " %h", ram0.mem[i]);
+		if (i % 16 == 15)
+		    $fwrite(fd, "\n");
+	    end
+	$fclose(fd);
+	if (cov_en)
+	    begin
+		cov_flags;
+		fd = $fopen(cov_file, "w");
+		for (i = 0; i < 11; i = i + 1)
+		    $fwrite(fd, "%h\n", cov[64*i +: 64]);
+		$fclose(fd);
+	    end
+	$finish;
+    end
+endtask
+
+// coverage of the flags written by the previous instruction
+
+task cov_flags;
+    if (cov_pend)
+	begin
+	    cov[COV_ZF + 2 * cov_op + uCPU0.ZF] = 1'b1;
+	    if (cov_op[2])
+		cov[COV_CF + 2 * (cov_op - 4) + uCPU0.CF] = 1'b1;
+	    cov_pend = 1'b0;
+	end
+endtask
+
+// coverage of the instruction executing at this edge
+
+task cov_insn;
+    begin
+	cov_flags;
+	cov_op = rom_dbus[11:8];
+	if ((cov_op[0] == 1'b0 && cov_op != 4'h8 || cov_op == 4'hF) && rom_dbus[7:3] == 5'b11111)
+	    cov[COV_MODE + 9 * cov_op + rom_dbus[2:0] + 1] = 1'b1;
+	else
+	    cov[COV_MODE + 9 * cov_op] = 1'b1;
+	if (cov_op == 4'h8)
+	    cov[COV_BRANCH + 2 * rom_abus + !uCPU0.CF] = 1'b1;
+	if (cov_op == 4'h9)
+	    cov[COV_BRANCH + 2 * rom_abus + !uCPU0.ZF] = 1'b1;
+	if (cov_op == 4'hF)
+	    cov[COV_STX + x_src] = 1'b1;
+	if (uCPU0.x_en)
+	    x_src = cov_op[3:1];
+	cov_pend = !cov_op[3];
+    end
+endtask
+
+// cycle counting, the instruction on rom_dbus executes at this edge
+
+always @(posedge clk)
+    if (!rst)
+	begin
+	    if (rom_dbus == {4'hB, rom_abus})
+		begin
+		    if (runs < repeats)
+			begin
+			    // the halting JMP writes nothing, reset at the next edge
+			    runs = runs + 1;
+			    cycles = 0;
+			    if (cov_en)
+				cov_flags;
+			    $readmemh(ram0.file, ram0.mem, 0, 255);
+			    rst <= 1'b1;
+			end
+		    else
+			begin
+			    $display("halt: jmp");
+			    finish_run;
+			end
+		end
+	    else if (cycles == limit)
+		begin
+		    $display("halt: limit");
+		    finish_run;
+		end
+	    else
+		begin
+		    if (cov_en)
+			cov_insn;
+		    cycles = cycles + 1;
+		end
+	end
+    else
+	rst <= 1'b0;
+
+// simulation
+
+initial
+    begin
+	if (!$value$plusargs("limit=%d", limit))
+	    limit = 1000000;
+	if (!$value$plusargs("dump=%s", dump))
+	    dump = "bench.out";
+	if (!$value$plusargs("repeat=%d", repeats))
+	    repeats = 1;
+	cov_en = $value$plusargs("cov=%s", cov_file);
+	cov = 0;
+	cov_pend = 1'b0;
+	x_src = 3'd7;
+	runs = 1;
+	cycles = 0;
+	rst = 1'b1;
+	clk = 1'b0;
+	#20 rst = 1'b0;
+    end
+
+endmodule
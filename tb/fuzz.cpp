@@ -0,0 +1,101 @@
+/*
+ * Verilated uCPU for sim/ucfuzz, see tb/fuzz.v.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * The ROM and the RAM are the arrays of the ucpu_t: the ROM word and the
+ * RAM data are looked up after every evaluation of the address outputs
+ * and the write is done at the rising edge, as in rtl/mem.v.
+ */
+
+#include "verilated.h"
+#include "Vfuzz.h"
+
+#include "fuzz.h"
+
+struct rtl {
+    VerilatedContext ctx;
+    Vfuzz *top;
+};
+
+/* drives the memory outputs for the current state */
+static void settle(Vfuzz *top, const ucpu_t *cpu)
+{
+    top->rom_data = cpu->rom[top->rom_addr];
+    top->eval();
+    top->ram_rdata = cpu->ram[top->ram_addr];
+    top->eval();
+}
+
+static void read_state(const Vfuzz *top, ucpu_t *cpu)
+{
+    cpu->pc = top->pc;
+    cpu->acc = top->acc;
+    cpu->ix = top->ix;
+    cpu->iy = top->iy;
+    cpu->x = top->x;
+    cpu->cf = top->cf;
+    cpu->zf = top->zf;
+}
+
+rtl_t *rtl_open(void)
+{
+    rtl_t *rtl = new rtl_t;
+
+    rtl->top = new Vfuzz(&rtl->ctx, "fuzz");
+    rtl->top->clk = 0;
+    rtl->top->rst = 1;
+
+    return rtl;
+}
+
+void rtl_close(rtl_t *rtl)
+{
+    rtl->top->final();
+    delete rtl->top;
+    delete rtl;
+}
+
+void rtl_reset(rtl_t *rtl, ucpu_t *cpu)
+{
+    Vfuzz *top = rtl->top;
+
+    top->rst = 1;
+    settle(top, cpu);
+    top->clk = 1;
+    top->eval();
+    top->clk = 0;
+    top->rst = 0;
+    top->eval();
+
+    read_state(top, cpu);
+    cpu->cycles = 0;
+}
+
+halt_t rtl_run(rtl_t *rtl, ucpu_t *cpu, unsigned long max_cycles)
+{
+    Vfuzz *top = rtl->top;
+
+    while (cpu->cycles < max_cycles) {
+	unsigned char wr_en, addr, data;
+
+	if (ucpu_halted(cpu))
+	    return HALT_JMP;
+
+	settle(top, cpu);
+	wr_en = top->wr_en;
+	addr = top->ram_addr;
+	data = top->ram_wdata;
+
+	top->clk = 1;
+	top->eval();
+	if (wr_en)
+	    cpu->ram[addr] = data;
+	top->clk = 0;
+	top->eval();
+
+	read_state(top, cpu);
+	++cpu->cycles;
+    }
+
+    return ucpu_halted(cpu) ? HALT_JMP : HALT_LIMIT;
+}
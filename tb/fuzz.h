@@ -0,0 +1,33 @@
+/*
+ * Verilated uCPU for sim/ucfuzz, see tb/fuzz.v.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ */
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include "ucpu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rtl rtl_t;
+
+rtl_t *rtl_open(void);
+void rtl_close(rtl_t *rtl);
+
+/*
+ * Resets the model and reads its state into cpu. X is not reset in the
+ * RTL, cpu->x is what the model holds.
+ */
+void rtl_reset(rtl_t *rtl, ucpu_t *cpu);
+
+/* clocks the model as ucpu_run() steps cpu, the memories are those of cpu */
+halt_t rtl_run(rtl_t *rtl, ucpu_t *cpu, unsigned long max_cycles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,42 @@
+`timescale 1 ns / 10 ps
+
+// Fuzzing harness for Verilator: uCPU with the memories left to the C++
+// side (tb/fuzz.cpp) and the architectural state brought out to ports, so
+// that sim/ucfuzz can step it in lockstep with the simulator.
+
+module fuzz (clk, rst, rom_addr, rom_data, ram_addr, ram_rdata, ram_wdata, wr_en,
+	     pc, acc, ix, iy, x, cf, zf);
+
+input  wire        clk, rst;
+input  wire [11:0] rom_data;
+input  wire  [7:0] ram_rdata;
+output wire  [7:0] rom_addr, ram_addr, ram_wdata;
+output wire        wr_en;
+output wire  [7:0] pc, acc, ix, iy, x;
+output wire        cf, zf;
+
+wire [7:0] ram_data;
+
+// the RAM drives the bus unless uCPU writes, as in rtl/mem.v
+
+assign ram_data  = wr_en ? 8'bz : ram_rdata;
+assign ram_wdata = ram_data;
+
+uCPU uCPU0 (
+    .clk(clk),
+    .rom_addr(rom_addr),
+    .rom_data(rom_data),
+    .ram_addr(ram_addr),
+    .ram_data(ram_data),
+    .wr_en(wr_en),
+    .rst(rst));
+
+assign pc  = uCPU0.PC;
+assign acc = uCPU0.Acc;
+assign ix  = uCPU0.IX;
+assign iy  = uCPU0.IY;
+assign x   = uCPU0.X;
+assign cf  = uCPU0.CF;
+assign zf  = uCPU0.ZF;
+
+endmodule
@@ -1,5 +1,35 @@
 `timescale 1 ns / 10 ps
 
+// Testbench with triggered waveform dumping: the program runs from reset
+// until it halts on a "JMP" to itself or +limit cycles (default 2500) have
+// passed, with +wave=<file> the waveforms of a window of the run are
+// dumped. Icarus writes FST with "vvp -fst", Verilator with --trace-fst.
+//
+// The window starts at the first start trigger, from reset if none is
+// given, and ends at the first stop trigger after it, when the
+// simulation is finished:
+//
+//   +start_cycle=<n>, +stop_cycle=<n>  the instruction of cycle n executes
+//   +start_pc=<hex>,  +stop_pc=<hex>   the instruction at the address executes
+//   +start_wr=<hex>,  +stop_wr=<hex>   the RAM cell is written
+//   +window=<n>                        n cycles after the start
+//
+// With +pre=<n> the window begins n cycles before the start trigger. The
+// dump cannot be written backwards, so the program is reset when the
+// trigger is hit, the RAM image reloaded and the n cycles before it run
+// again with dumping on: the runs are the same, X is set back to its
+// power-up value, too. Cycles are counted from reset as in tb/bench.v,
+// "cycle" is in the dump.
+//
+// +monitor prints every change of the signals, as this testbench did
+// before. Plusargs of rtl/mem.v: +rom=<hex> +ram=<hex>.
+//
+// +replay=<log> runs a core of a cluster alone on the log of its inputs
+// written by "uccluster -w" (see sim/replay.h), as "ucsim -P" does: the
+// RAM image is that of the log, the stores of the program to the shared
+// cells are undone and the logged values written to them before the
+// instructions of their cycles.
+
 module test;
 
 reg         clk, rst;
@@ -9,6 +39,17 @@ wire [11:0] rom_dbus;
 wire  [7:0] ram_abus;
 wire  [7:0] ram_dbus;
 
+integer         cycle, limit, pre, window, start_at, stop_at;
+integer         start_cycle, stop_cycle, start_pc, stop_pc, start_wr, stop_wr;
+reg [8*256-1:0] wave;
+reg             wave_en, dumping, dumped, reload;
+
+integer         replay_fd, replay_lo, replay_at, replay_addr, replay_data;
+reg [8*256-1:0] replay;
+reg      [63:0] replay_magic;
+reg       [7:0] replay_waddr, replay_old;
+reg             replay_en, replay_wr;
+
 // uCPU instance
 
 uCPU uCPU0 (
@@ -40,18 +81,193 @@ ram ram0 (
 always
     #10 clk <= ~clk;
 
+// triggers of the instruction executing at this edge, -1 matches nothing
+
+function hit;
+    input integer at_cycle, at_pc, at_wr;
+    hit = cycle == at_cycle || rom_abus == at_pc || wr_en && ram_abus == at_wr;
+endfunction
+
+task dump_on;
+    begin
+	if (!dumped)
+	    begin
+		$dumpfile(wave);
+		$dumpvars(0, test);
+	    end
+	else
+	    $dumpon;
+	dumped = 1'b1;
+	dumping = 1'b1;
+    end
+endtask
+
+always @(posedge clk)
+    if (!rst)
+	begin
+	    if (cycle == limit || rom_dbus == {4'hB, rom_abus} || dumping && (cycle == stop_at ||
+		cycle > start_at && hit(stop_cycle, stop_pc, stop_wr)))
+		$finish;
+
+	    if (wave_en && !dumping && start_at >= 0 && cycle == start_at - pre)
+		dump_on;
+
+	    if (wave_en && start_at < 0 && hit(start_cycle, start_pc, start_wr))
+		begin
+		    start_at = cycle;
+		    if (window > 0)
+			stop_at = cycle + window;
+		    if (pre > cycle)
+			pre = cycle;
+		    if (pre == 0)
+			dump_on;
+		    else
+			reload = 1'b1;
+		end
+
+	    if (reload)
+		begin
+		    // run again from reset, the RAM is reloaded at the reset edge
+		    cycle = 0;
+		    rst <= 1'b1;
+		end
+	    else
+		cycle = cycle + 1;
+	end
+    else
+	begin
+	    rst <= 1'b0;
+	    if (reload)
+		begin
+		    // after the RAM write of the instruction at PC, if any
+		    #1 if (replay_en)
+			replay_start;
+		    else
+			$readmemh(ram0.file, ram0.mem, 0, 255);
+		    uCPU0.X = 8'bx;
+		    reload = 1'b0;
+		end
+	end
+
+// replay log: the next event, replay_at is -1 at the end of the log
+
+task replay_next;
+    integer b, shift, delta;
+    begin
+	delta = 0;
+	shift = 0;
+	b = $fgetc(replay_fd);
+	while (b >= 128)
+	    begin
+		delta = delta | (b - 128) << shift;
+		shift = shift + 7;
+		b = $fgetc(replay_fd);
+	    end
+	delta = delta | b << shift;
+	replay_addr = $fgetc(replay_fd);
+	replay_data = $fgetc(replay_fd);
+	replay_at = b < 0 || replay_data < 0 ? -1 : replay_at + delta;
+    end
+endtask
+
+// the RAM image of the log and its first event
+
+task replay_start;
+    integer i;
+    begin
+	i = $fseek(replay_fd, 8, 0);
+	replay_lo = $fgetc(replay_fd);
+	i = $fseek(replay_fd, 16, 0);
+	for (i = 0; i < 256; i = i + 1)
+	    ram0.mem[i] = $fgetc(replay_fd);
+	replay_at = 0;
+	replay_next;
+    end
+endtask
+
+// after the RAM write at the edge and a reload: the store of the
+// instruction to a shared cell undone, the events up to the cycle of the
+// next one written
+
+always @(posedge clk)
+    if (replay_en)
+	begin
+	    replay_wr = !rst && wr_en && ram_abus >= replay_lo && ram_abus < 8'hf8;
+	    replay_waddr = ram_abus;
+	    replay_old = ram0.mem[ram_abus];
+	    #2 if (replay_wr)
+		ram0.mem[replay_waddr] = replay_old;
+	    while (replay_at >= 0 && replay_at <= cycle)
+		begin
+		    ram0.mem[replay_addr] = replay_data;
+		    replay_next;
+		end
+	end
+
 // simulation
 
 initial
     begin
-	$monitor("%4d ns: rom_abus = %h, rom_dbus = %h, ram_abus = %h, ram_dbus = %h, wr_en = %b\nPC = %h, Acc = %h, IX = %h, IY = %h, CF = %b, ZF = %b, X = %h, x_en = %h, ram_data = %h | %h %h %h %h %h %h %h %h\n",
-		    $time, rom_abus, rom_dbus, ram_abus, ram_dbus, wr_en,
-		    uCPU0.PC, uCPU0.Acc, uCPU0.IX, uCPU0.IY, uCPU0.CF, uCPU0.ZF, uCPU0.X, uCPU0.x_en, uCPU0.ram_data,
-		    ram0.mem[0], ram0.mem[1], ram0.mem[2], ram0.mem[3], ram0.mem[4], ram0.mem[5], ram0.mem[6], ram0.mem[7]);
+	if (!$value$plusargs("limit=%d", limit))
+	    limit = 2500;
+	wave_en = $value$plusargs("wave=%s", wave);
+	if (!$value$plusargs("pre=%d", pre))
+	    pre = 0;
+	if (!$value$plusargs("window=%d", window))
+	    window = 0;
+	if (!$value$plusargs("start_cycle=%d", start_cycle))
+	    start_cycle = -1;
+	if (!$value$plusargs("start_pc=%h", start_pc))
+	    start_pc = -1;
+	if (!$value$plusargs("start_wr=%h", start_wr))
+	    start_wr = -1;
+	if (!$value$plusargs("stop_cycle=%d", stop_cycle))
+	    stop_cycle = -1;
+	if (!$value$plusargs("stop_pc=%h", stop_pc))
+	    stop_pc = -1;
+	if (!$value$plusargs("stop_wr=%h", stop_wr))
+	    stop_wr = -1;
+	// no start trigger: from reset
+	if (start_cycle < 0 && start_pc < 0 && start_wr < 0)
+	    start_cycle = 0;
+	start_at = -1;
+	stop_at = -1;
+	dumping = 1'b0;
+	dumped = 1'b0;
+	reload = 1'b0;
+	cycle = 0;
+
+	replay_en = $value$plusargs("replay=%s", replay);
+	if (replay_en)
+	    begin : replay_open
+		integer c;
+
+		replay_fd = $fopen(replay, "rb");
+		replay_magic = 0;
+		if (replay_fd != 0)
+		    repeat (8)
+			begin
+			    c = $fgetc(replay_fd);
+			    replay_magic = {replay_magic[55:0], c[7:0]};
+			end
+		if (replay_magic != "TUCRPL01")
+		    begin
+			$display("%0s: not a replay log", replay);
+			$finish;
+		    end
+	    end
+
+	if ($test$plusargs("monitor"))
+	    $monitor("%4d ns: rom_abus = %h, rom_dbus = %h, ram_abus = %h, ram_dbus = %h, wr_en = %b\nPC = %h, Acc = %h, IX = %h, IY = %h, CF = %b, ZF = %b, X = %h, x_en = %h, ram_data = %h | %h %h %h %h %h %h %h %h\n",
+			$time, rom_abus, rom_dbus, ram_abus, ram_dbus, wr_en,
+			uCPU0.PC, uCPU0.Acc, uCPU0.IX, uCPU0.IY, uCPU0.CF, uCPU0.ZF, uCPU0.X, uCPU0.x_en, uCPU0.ram_data,
+			ram0.mem[0], ram0.mem[1], ram0.mem[2], ram0.mem[3], ram0.mem[4], ram0.mem[5], ram0.mem[6], ram0.mem[7]);
 	rst = 1'b1;
 	clk = 1'b0;
-	#20 rst = 1'b0;
-	#50000 $finish;
+	// after the RAM image of rtl/mem.v is read
+	#1 if (replay_en)
+	    replay_start;
+	#19 rst = 1'b0;
     end
 
 endmodule
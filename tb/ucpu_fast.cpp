@@ -0,0 +1,66 @@
+/*
+ * DPI-C side of uCPU_fast, see tb/ucpu_fast.v.
+ * (C) 2022, Stanislav Maslovski <stanislav.maslovski@gmail.com>
+ *
+ * The ROM and the RAM are those of the simulation: before an instruction
+ * is stepped its word and the RAM data read from the bus are put where
+ * ucpu_step() looks for them, the word at PC and the cell at the address
+ * decoded by ucpu_fast_bus().
+ */
+
+#include <stdlib.h>
+
+extern "C" {
+#include "ucpu.h"
+}
+
+/* the RTL latches X from the RAM data bus, also during reset */
+#define LATCHES_X(op) (ISA_REG_OP(op) && (op) != OP_STA && (op) != OP_STX)
+
+/* the RAM address of the instruction, without the autoincrement */
+static unsigned address(const ucpu_t *cpu, unsigned ir)
+{
+    unsigned op = ir >> 8 & 0xf, dat = ir & 0xff;
+
+    return ISA_REG_OP(op) ? ucpu_addr(cpu, dat) : dat;
+}
+
+extern "C" void *ucpu_fast_open(void)
+{
+    ucpu_t *cpu = (ucpu_t *) calloc(1, sizeof(ucpu_t));
+
+    return cpu;
+}
+
+extern "C" void ucpu_fast_bus(void *handle, int ir, int *addr, int *wdata, int *wr, int *latch_x)
+{
+    const ucpu_t *cpu = (const ucpu_t *) handle;
+    unsigned op = ir >> 8 & 0xf;
+
+    *addr = address(cpu, ir);
+    *wr = op == OP_STA || op == OP_STX;
+    *wdata = op == OP_STX ? cpu->x : cpu->acc;
+    *latch_x = LATCHES_X(op);
+}
+
+/* state: PC, Acc, IX, IY, X from bit 0 up, then CF and ZF */
+extern "C" void ucpu_fast_clock(void *handle, int rst, int ir, int rdata, long long *state)
+{
+    ucpu_t *cpu = (ucpu_t *) handle;
+    unsigned addr = address(cpu, ir);
+
+    if (rst) {
+	if (LATCHES_X(ir >> 8 & 0xf))
+	    cpu->x = rdata;
+	cpu->pc = cpu->acc = cpu->ix = cpu->iy = 0;
+	cpu->cf = cpu->zf = 0;
+    } else {
+	cpu->rom[cpu->pc] = ir;
+	cpu->ram[addr] = rdata;
+	ucpu_step(cpu);
+    }
+
+    *state = (long long) cpu->pc | (long long) cpu->acc << 8 | (long long) cpu->ix << 16 |
+	(long long) cpu->iy << 24 | (long long) cpu->x << 32 | (long long) cpu->cf << 40 |
+	(long long) cpu->zf << 41;
+}
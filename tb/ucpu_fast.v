@@ -0,0 +1,69 @@
+`timescale 1 ns / 10 ps
+
+// Behavioral uCPU for system level simulation with Verilator: the ports
+// of module uCPU (rtl/ucpu.v), the instructions executed by the simulator
+// of sim/ucpu.c through DPI-C (tb/ucpu_fast.cpp). Every instruction costs
+// two calls: one decoding the bus of the instruction word on rom_data,
+// one executing it at the rising edge with the RAM data read. The bus
+// timing is that of the RTL, the RAM is written at the edge and also
+// during reset. PC, Acc, IX, IY, X, CF, ZF and x_en are kept under their
+// RTL names for the testbenches, X is not reset either. Verilate with
+// tb/ucpu_fast.cpp and sim/ucpu.o, tb/bench.v uses it with -DUCPU_FAST
+// ("make verilated-fast" in bench/).
+
+module uCPU_fast (clk, rom_addr, rom_data, ram_addr, ram_data, wr_en, rst);
+
+input  wire        clk, rst;
+output wire  [7:0] rom_addr;
+input  wire [11:0] rom_data;
+output wire  [7:0] ram_addr;
+inout  wire  [7:0] ram_data;
+output wire        wr_en;
+
+import "DPI-C" function chandle ucpu_fast_open();
+import "DPI-C" function void ucpu_fast_bus(input chandle cpu, input int ir,
+					   output int addr, output int wdata, output int wr,
+					   output int latch_x);
+import "DPI-C" function void ucpu_fast_clock(input chandle cpu, input int rst, input int ir,
+					     input int rdata, output longint state);
+
+chandle cpu = null;	// opened by the block run first
+
+reg  [7:0] PC, Acc, IX, IY, X;
+reg        CF, ZF, x_en;
+
+reg  [7:0] abus, dbus;
+reg        wr;
+
+int        addr, wdata, wr_int, latch_x;
+longint    state;
+
+assign rom_addr = PC;
+assign ram_addr = abus;
+assign ram_data = wr ? dbus : 8'bz;
+assign wr_en    = wr;
+
+// the bus of the instruction fetched
+
+always @(rom_data or PC or Acc or IX or IY or X)
+  begin
+    if (cpu == null)
+      cpu = ucpu_fast_open();
+    ucpu_fast_bus(cpu, {20'b0, rom_data}, addr, wdata, wr_int, latch_x);
+    abus = addr[7:0];
+    dbus = wdata[7:0];
+    wr   = wr_int[0];
+    x_en = latch_x[0];
+  end
+
+// execution
+
+always @(posedge clk)
+  begin
+    if (cpu == null)
+      cpu = ucpu_fast_open();
+    ucpu_fast_clock(cpu, {31'b0, rst}, {20'b0, rom_data}, {24'b0, ram_data}, state);
+    {ZF, CF, X, IY, IX, Acc, PC} <= state[41:0];
+  end
+
+endmodule